@@ -0,0 +1,118 @@
+// BVH inspection tool.
+//
+// Builds the BVH of the built-in scenes with the given build settings and prints its node and leaf
+// counts, the leaf size and leaf depth histograms, the SAH cost and the average overlap of sibling
+// boxes, so build parameters can be tuned per scene. Optionally writes the whole tree as JSON:
+//
+//   BvhStats                                        All scenes with the default settings.
+//   BvhStats --scene Dragon --split spatial-sah     One scene with a different split method.
+//   BvhStats --max-leaf-primitives 8 --max-depth 32 Other leaf size and depth limits.
+//   BvhStats --treelets                             Restructure treelets after the build.
+//   BvhStats --json bvh_dump                        Also write bvh_dump/<scene>.json per scene.
+#include "bounding_volume_hierarchy.h"
+#include "scene.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+static const std::filesystem::path dataPath { DATA_DIR };
+
+static void printUsage()
+{
+    std::cout << "Usage: BvhStats [--scene NAME] [--split median|object-sah|spatial-sah] [--spatial-split-budget 0.3]\n"
+              << "                [--max-leaf-primitives 4] [--max-depth 48] [--traversal-cost 1] [--intersection-cost 1] [--treelets] [--json DIR]" << std::endl;
+}
+
+// Non-empty buckets of a histogram as "index:count".
+static void printHistogram(const std::string& name, const std::vector<size_t>& histogram)
+{
+    std::cout << "  " << std::left << std::setw(22) << name << std::right;
+    for (size_t i = 0; i < histogram.size(); i++) {
+        if (histogram[i] > 0)
+            std::cout << " " << i << ":" << histogram[i];
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::optional<std::string> sceneFilter;
+    std::optional<std::filesystem::path> jsonDirectory;
+    BvhBuildSettings buildSettings;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (argument == "--scene" && hasValue)
+            sceneFilter = argv[++i];
+        else if (argument == "--json" && hasValue)
+            jsonDirectory = argv[++i];
+        else if (argument == "--split" && hasValue) {
+            const std::string value = argv[++i];
+            buildSettings.splitMethod = value == "object-sah" ? BvhSplitMethod::ObjectSah : (value == "spatial-sah" ? BvhSplitMethod::SpatialSah : BvhSplitMethod::Median);
+        } else if (argument == "--spatial-split-budget" && hasValue)
+            buildSettings.spatialSplitBudget = std::stof(argv[++i]);
+        else if (argument == "--max-leaf-primitives" && hasValue)
+            buildSettings.maxLeafPrimitives = uint32_t(std::max(std::atoi(argv[++i]), 1));
+        else if (argument == "--max-depth" && hasValue)
+            buildSettings.maxDepth = std::max(std::atoi(argv[++i]), 1);
+        else if (argument == "--traversal-cost" && hasValue)
+            buildSettings.traversalCost = std::stof(argv[++i]);
+        else if (argument == "--intersection-cost" && hasValue)
+            buildSettings.intersectionCost = std::stof(argv[++i]);
+        else if (argument == "--treelets")
+            buildSettings.restructureTreelets = true;
+        else {
+            printUsage();
+            return argument == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (jsonDirectory)
+        std::filesystem::create_directories(*jsonDirectory);
+
+    for (const SceneType sceneType : allSceneTypes) {
+        const std::string name = sceneName(sceneType);
+        if (sceneFilter && *sceneFilter != name)
+            continue;
+
+        Scene scene;
+        try {
+            scene = loadScene(sceneType, dataPath);
+        } catch (const std::exception&) {
+            std::cerr << "Skipping scene " << name << " (failed to load its data)" << std::endl;
+            continue;
+        }
+        const BoundingVolumeHierarchy bvh { &scene, buildSettings };
+        const BvhStatistics statistics = bvh.statistics();
+
+        std::cout << name << std::fixed << std::setprecision(2) << "\n"
+                  << "  nodes " << statistics.numNodes << ", leaves " << statistics.numLeaves << ", references " << statistics.numReferences
+                  << ", levels " << bvh.numLevels() << ", built in " << bvh.buildStatistics().milliseconds << " ms";
+        if (buildSettings.restructureTreelets)
+            std::cout << " (" << bvh.buildStatistics().restructuredTreelets << " treelets restructured in " << bvh.buildStatistics().restructureMilliseconds << " ms)";
+        std::cout << "\n"
+                  << "  SAH cost " << statistics.sahCost << ", average sibling overlap " << statistics.averageSiblingOverlap * 100.0f << "%" << std::endl;
+        printHistogram("leaf sizes (size:n)", statistics.leafSizeHistogram);
+        printHistogram("leaf depths (depth:n)", statistics.leafDepthHistogram);
+
+        if (jsonDirectory) {
+            const std::filesystem::path file = *jsonDirectory / (name + ".json");
+            std::ofstream stream { file };
+            if (!stream) {
+                std::cerr << "Could not write " << file << std::endl;
+                return EXIT_FAILURE;
+            }
+            bvh.writeJson(stream);
+            std::cout << "  written to " << file << std::endl;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,361 @@
+// Micro benchmarks of the intersection kernels and of the BVH traversal.
+//
+// Every built-in scene is traced with three fixed ray sets (coherent primary rays, incoherent random
+// rays and shadow rays towards the first light). Besides the Catch2 statistics (time per pass over
+// the whole ray set) a table with ns/ray and rays/s is printed so kernel changes can be compared.
+// The BVH is built with every split method, with quantized geometry and with treelet restructuring;
+// the traversal cost (nodes visited and triangles tested per ray) of every variant is printed next to
+// its throughput. The ray sets are also traced in packets of 64 rays (8x8 pixel tiles of the primary
+// rays, consecutive rays of the other sets), after checking that they find the same hits as single rays.
+// A separate test checks that the native OBJ importer loads every model of the data directory like Assimp.
+// Run with e.g. `MicroBenchmarks --benchmark-samples 20`.
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "bounding_volume_hierarchy.h"
+#include "disable_all_warnings.h"
+#include "mesh.h"
+#include "ray_tracing.h"
+#include "scene.h"
+DISABLE_WARNINGS_PUSH()
+#include <catch2/catch.hpp>
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <array>
+#include <bitset>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+static const std::filesystem::path dataPath { DATA_DIR };
+
+// Resolution of the coherent primary ray grid; the other ray sets have the same number of rays.
+static constexpr int primaryResolution = 128;
+
+struct RaySet {
+    std::string name;
+    std::vector<Ray> rays;
+};
+
+static AxisAlignedBox sceneBounds(const Scene& scene)
+{
+    AxisAlignedBox bounds { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+    for (const Mesh& mesh : scene.meshes) {
+        for (const glm::vec3& position : mesh.positions) {
+            bounds.lower = glm::min(bounds.lower, position);
+            bounds.upper = glm::max(bounds.upper, position);
+        }
+    }
+    for (const MeshInstance& instance : scene.instances) {
+        for (const glm::vec3& position : scene.instancedMeshes[instance.mesh].positions) {
+            const glm::vec3 worldPosition = glm::vec3(instance.transform * glm::vec4(position, 1.0f));
+            bounds.lower = glm::min(bounds.lower, worldPosition);
+            bounds.upper = glm::max(bounds.upper, worldPosition);
+        }
+    }
+    for (const Sphere& sphere : scene.spheres) {
+        bounds.lower = glm::min(bounds.lower, sphere.center - sphere.radius);
+        bounds.upper = glm::max(bounds.upper, sphere.center + sphere.radius);
+    }
+    return bounds;
+}
+
+// Pinhole camera in front of the scene (looking along +z like the Trackball) covering its bounding box.
+static RaySet coherentPrimaryRays(const AxisAlignedBox& bounds)
+{
+    const glm::vec3 center = (bounds.lower + bounds.upper) * 0.5f;
+    const float radius = glm::length(bounds.upper - bounds.lower) * 0.5f;
+    const float halfScreenPlaneSize = std::tan(glm::radians(50.0f) / 2.0f);
+    const glm::vec3 origin = center - glm::vec3(0.0f, 0.0f, radius / halfScreenPlaneSize + radius);
+
+    RaySet raySet { "primary", {} };
+    for (int y = 0; y < primaryResolution; y++) {
+        for (int x = 0; x < primaryResolution; x++) {
+            const glm::vec2 pixel { float(x) / primaryResolution * 2.0f - 1.0f, float(y) / primaryResolution * 2.0f - 1.0f };
+            const glm::vec3 direction = glm::normalize(glm::vec3(-pixel.x * halfScreenPlaneSize, pixel.y * halfScreenPlaneSize, 1.0f));
+            raySet.rays.push_back(Ray { origin, direction, std::numeric_limits<float>::max() });
+        }
+    }
+    return raySet;
+}
+
+// Random origins inside the scene bounds with uniformly distributed directions (fixed seed).
+static RaySet incoherentRays(const AxisAlignedBox& bounds)
+{
+    std::mt19937 generator { 12345 };
+    std::uniform_real_distribution<float> unit { 0.0f, 1.0f };
+    std::normal_distribution<float> normal { 0.0f, 1.0f };
+
+    RaySet raySet { "incoherent", {} };
+    for (int i = 0; i < primaryResolution * primaryResolution; i++) {
+        const glm::vec3 origin = bounds.lower + (bounds.upper - bounds.lower) * glm::vec3(unit(generator), unit(generator), unit(generator));
+        const glm::vec3 direction = glm::normalize(glm::vec3(normal(generator), normal(generator), normal(generator)));
+        raySet.rays.push_back(Ray { origin, direction, std::numeric_limits<float>::max() });
+    }
+    return raySet;
+}
+
+// Rays from the primary hit points towards the first light, limited to the light distance.
+static RaySet shadowRays(const Scene& scene, const BoundingVolumeHierarchy& bvh, const RaySet& primaryRays)
+{
+    glm::vec3 lightPosition { 0.0f, 1.0f, 0.0f };
+    if (!scene.pointLights.empty())
+        lightPosition = scene.pointLights.front().position;
+    else if (!scene.sphericalLight.empty())
+        lightPosition = scene.sphericalLight.front().position;
+
+    RaySet raySet { "shadow", {} };
+    for (Ray ray : primaryRays.rays) {
+        HitInfo hitInfo;
+        if (!bvh.intersect(ray, hitInfo))
+            continue;
+        const glm::vec3 position = ray.origin + ray.t * ray.direction;
+        const glm::vec3 toLight = lightPosition - position;
+        const glm::vec3 direction = glm::normalize(toLight);
+        raySet.rays.push_back(Ray { position + 0.001f * direction, direction, glm::length(toLight) });
+    }
+    return raySet;
+}
+
+// The primary rays reordered into 8x8 pixel tiles, so that every 64 consecutive rays form a coherent packet.
+static std::vector<Ray> packetTiles(const std::vector<Ray>& primaryRays)
+{
+    std::vector<Ray> rays;
+    for (int tileY = 0; tileY < primaryResolution; tileY += 8)
+        for (int tileX = 0; tileX < primaryResolution; tileX += 8)
+            for (int y = tileY; y < tileY + 8; y++)
+                for (int x = tileX; x < tileX + 8; x++)
+                    rays.push_back(primaryRays[size_t(y * primaryResolution + x)]);
+    return rays;
+}
+
+// Print the average number of nodes visited and triangles tested per ray.
+static void reportTraversalCost(const std::string& name, const BoundingVolumeHierarchy& bvh, const std::vector<Ray>& rays)
+{
+    TraversalCost cost;
+    for (Ray ray : rays) {
+        HitInfo hitInfo;
+        bvh.intersect(ray, hitInfo, &cost);
+    }
+    const double numRays = double(std::max(rays.size(), size_t(1)));
+    std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << cost.nodesVisited / numRays << " nodes/ray" << std::setw(10) << cost.trianglesTested / numRays << " triangles/ray" << std::endl;
+}
+
+// Trace every ray on its own through the BVH and count the hits.
+static size_t traceAll(const BoundingVolumeHierarchy& bvh, const std::vector<Ray>& rays)
+{
+    size_t hits = 0;
+    for (Ray ray : rays) {
+        HitInfo hitInfo;
+        hits += bvh.intersect(ray, hitInfo);
+    }
+    return hits;
+}
+
+// Time a few passes over the ray set and print the median as ns/ray and rays/s.
+template <typename F>
+static void reportThroughput(const std::string& name, size_t numRays, F&& trace)
+{
+    using clock = std::chrono::high_resolution_clock;
+    std::vector<double> timings;
+    for (int i = 0; i < 5; i++) {
+        const auto start = clock::now();
+        volatile size_t hits = trace();
+        (void)hits;
+        timings.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count());
+    }
+    std::nth_element(std::begin(timings), std::begin(timings) + 2, std::end(timings));
+    const double nsPerRay = timings[2] / double(std::max(numRays, size_t(1)));
+    std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << nsPerRay << " ns/ray" << std::setw(12) << std::setprecision(2) << 1e3 / nsPerRay << " Mrays/s" << std::endl;
+}
+
+// Number of triangle corners whose position or normal differs between the two meshes (which must have the same
+// number of triangles). The vertex arrays are not compared directly so that only the triangles that use them count.
+static size_t differentCorners(const Mesh& expected, const Mesh& actual)
+{
+    const auto close = [](const glm::vec3& lhs, const glm::vec3& rhs, float tolerance) {
+        return glm::length(lhs - rhs) <= tolerance * std::max(1.0f, glm::length(lhs));
+    };
+    size_t differences = 0;
+    for (size_t i = 0; i < expected.triangles.size(); i++) {
+        for (int corner = 0; corner < 3; corner++) {
+            const uint32_t expectedVertex = expected.triangles[i][corner];
+            const uint32_t actualVertex = actual.triangles[i][corner];
+            if (!close(expected.positions[expectedVertex], actual.positions[actualVertex], 1e-5f) || !close(expected.normals[expectedVertex], actual.normals[actualVertex], 1e-3f))
+                differences++;
+        }
+    }
+    return differences;
+}
+
+TEST_CASE("Native OBJ importer matches Assimp")
+{
+    for (const auto& entry : std::filesystem::directory_iterator(dataPath)) {
+        if (entry.path().extension() != ".obj")
+            continue;
+        INFO(entry.path().filename().string());
+        const Model expected = loadMesh(entry.path(), false, MeshLoadSettings { MeshImporter::Assimp, MeshCache::Disabled });
+        const Model actual = loadMesh(entry.path(), false, MeshLoadSettings { MeshImporter::Native, MeshCache::Disabled });
+
+        REQUIRE(actual.meshes.size() == expected.meshes.size());
+        for (size_t i = 0; i < expected.meshes.size(); i++) {
+            INFO("mesh " << i);
+            REQUIRE(actual.meshes[i].triangles.size() == expected.meshes[i].triangles.size());
+            CHECK(actual.meshes[i].materialId == expected.meshes[i].materialId);
+            CHECK(differentCorners(expected.meshes[i], actual.meshes[i]) == 0);
+        }
+
+        REQUIRE(actual.materials.size() == expected.materials.size());
+        for (size_t i = 0; i < expected.materials.size(); i++) {
+            INFO("material " << i);
+            for (int channel = 0; channel < 3; channel++) {
+                CHECK(actual.materials[i].kd[channel] == Approx(expected.materials[i].kd[channel]));
+                CHECK(actual.materials[i].ks[channel] == Approx(expected.materials[i].ks[channel]));
+            }
+            CHECK(actual.materials[i].shininess == Approx(expected.materials[i].shininess));
+            CHECK(actual.materials[i].transparency == Approx(expected.materials[i].transparency));
+        }
+    }
+}
+
+TEST_CASE("Intersection kernels and BVH traversal")
+{
+    const auto sceneType = GENERATE(from_range(allSceneTypes));
+    const std::string name = sceneName(sceneType);
+
+    Scene scene;
+    try {
+        scene = loadScene(sceneType, dataPath);
+    } catch (const std::exception&) {
+        WARN("Skipping scene " << name << " (failed to load its data)");
+        return;
+    }
+    const BoundingVolumeHierarchy bvh { &scene };
+    BoundingVolumeHierarchy quantizedBvh { &scene };
+    quantizedBvh.setGeometryFormat(GeometryFormat::Quantized);
+    std::cout << name << " geometry: " << bvh.geometryBytes() << " bytes full, " << quantizedBvh.geometryBytes() << " bytes quantized" << std::endl;
+    BvhBuildSettings objectSahSettings;
+    objectSahSettings.splitMethod = BvhSplitMethod::ObjectSah;
+    const BoundingVolumeHierarchy objectSahBvh { &scene, objectSahSettings };
+    BvhBuildSettings spatialSahSettings;
+    spatialSahSettings.splitMethod = BvhSplitMethod::SpatialSah;
+    const BoundingVolumeHierarchy spatialSahBvh { &scene, spatialSahSettings };
+    BvhBuildSettings treeletSettings;
+    treeletSettings.restructureTreelets = true;
+    const BoundingVolumeHierarchy treeletBvh { &scene, treeletSettings };
+    std::cout << name << " build: " << bvh.buildStatistics().milliseconds << " ms median, " << objectSahBvh.buildStatistics().milliseconds << " ms object SAH, "
+              << spatialSahBvh.buildStatistics().milliseconds << " ms spatial SAH (" << spatialSahBvh.buildStatistics().spatialSplits << " spatial splits, "
+              << spatialSahBvh.buildStatistics().duplicatedReferences << " duplicated references), " << treeletBvh.buildStatistics().milliseconds
+              << " ms median + treelets (" << treeletBvh.buildStatistics().restructuredTreelets << " restructured)" << std::endl;
+    // The variants of the BVH that are traced ray by ray.
+    struct BvhVariant {
+        std::string name;
+        const BoundingVolumeHierarchy* pBvh;
+    };
+    const std::array<BvhVariant, 5> bvhVariants { {
+        { "median", &bvh },
+        { "quantized", &quantizedBvh },
+        { "object SAH", &objectSahBvh },
+        { "spatial SAH", &spatialSahBvh },
+        { "median + treelets", &treeletBvh },
+    } };
+    const AxisAlignedBox bounds = sceneBounds(scene);
+
+    // Kernels that intersect a single primitive test every ray against the "next" triangle so
+    // that the whole mesh data is touched, like a traversal would.
+    struct TriangleRef {
+        const Mesh* pMesh;
+        Triangle triangle;
+    };
+    std::vector<TriangleRef> triangles;
+    for (const Mesh& mesh : scene.meshes)
+        for (const Triangle& triangle : mesh.triangles)
+            triangles.push_back({ &mesh, triangle });
+    const Sphere sphere = scene.spheres.empty() ? Sphere { (bounds.lower + bounds.upper) * 0.5f, glm::length(bounds.upper - bounds.lower) * 0.25f, 0 } : scene.spheres.front();
+
+    const RaySet primary = coherentPrimaryRays(bounds);
+    for (const RaySet& raySet : { primary, incoherentRays(bounds), shadowRays(scene, bvh, primary) }) {
+        const auto& rays = raySet.rays;
+        const auto prefix = name + " / " + raySet.name + " / ";
+
+        const auto traceTriangles = [&]() {
+            size_t hits = 0;
+            glm::vec2 barycentric;
+            for (size_t i = 0; i < rays.size() && !triangles.empty(); i++) {
+                Ray ray = rays[i];
+                const auto& [pMesh, triangle] = triangles[i % triangles.size()];
+                hits += intersectRayWithTriangle(pMesh->positions[triangle[0]], pMesh->positions[triangle[1]], pMesh->positions[triangle[2]], ray, barycentric);
+            }
+            return hits;
+        };
+        const auto traceSphere = [&]() {
+            size_t hits = 0;
+            for (Ray ray : rays) {
+                HitInfo hitInfo;
+                hits += intersectRayWithShape(sphere, ray, hitInfo);
+            }
+            return hits;
+        };
+        const auto traceBox = [&]() {
+            size_t hits = 0;
+            for (Ray ray : rays)
+                hits += intersectRayWithShape(bounds, ray);
+            return hits;
+        };
+        const std::vector<Ray> packetRays = raySet.name == primary.name ? packetTiles(rays) : rays;
+        const auto tracePackets = [&]() {
+            size_t hits = 0;
+            std::array<Ray, maxRayPacketSize> packet;
+            std::array<HitInfo, maxRayPacketSize> hitInfos;
+            for (size_t first = 0; first < packetRays.size(); first += maxRayPacketSize) {
+                const size_t count = std::min(maxRayPacketSize, packetRays.size() - first);
+                std::copy_n(packetRays.begin() + std::ptrdiff_t(first), count, packet.begin());
+                hits += std::bitset<64>(objectSahBvh.intersectPacket({ packet.data(), count }, { hitInfos.data(), count })).count();
+            }
+            return hits;
+        };
+        // The packet traversal is only worth benchmarking if it finds the same closest hits as the single ray traversal.
+        for (size_t first = 0; first < packetRays.size(); first += maxRayPacketSize) {
+            const size_t count = std::min(maxRayPacketSize, packetRays.size() - first);
+            std::array<Ray, maxRayPacketSize> packet;
+            std::array<HitInfo, maxRayPacketSize> hitInfos;
+            std::copy_n(packetRays.begin() + std::ptrdiff_t(first), count, packet.begin());
+            const uint64_t packetHits = objectSahBvh.intersectPacket({ packet.data(), count }, { hitInfos.data(), count });
+            for (size_t i = 0; i < count; i++) {
+                Ray ray = packetRays[first + i];
+                HitInfo hitInfo;
+                const bool hit = objectSahBvh.intersect(ray, hitInfo);
+                INFO(prefix << "ray " << first + i);
+                REQUIRE(((packetHits >> i) & 1) == uint64_t(hit));
+                if (hit) {
+                    CHECK(packet[i].t == ray.t);
+                    CHECK(hitInfos[i].primitive == hitInfo.primitive);
+                }
+            }
+        }
+
+        BENCHMARK(prefix + "intersectRayWithTriangle") { return traceTriangles(); };
+        BENCHMARK(prefix + "intersectRayWithShape(Sphere)") { return traceSphere(); };
+        BENCHMARK(prefix + "intersectRayWithShape(AxisAlignedBox)") { return traceBox(); };
+        for (const BvhVariant& variant : bvhVariants)
+            BENCHMARK(prefix + "BoundingVolumeHierarchy::intersect (" + variant.name + ")") { return traceAll(*variant.pBvh, rays); };
+        BENCHMARK(prefix + "BoundingVolumeHierarchy::intersectPacket (object SAH)") { return tracePackets(); };
+
+        reportThroughput(prefix + "intersectRayWithTriangle", rays.size(), traceTriangles);
+        reportThroughput(prefix + "intersectRayWithShape(Sphere)", rays.size(), traceSphere);
+        reportThroughput(prefix + "intersectRayWithShape(AxisAlignedBox)", rays.size(), traceBox);
+        for (const BvhVariant& variant : bvhVariants)
+            reportThroughput(prefix + "BoundingVolumeHierarchy::intersect (" + variant.name + ")", rays.size(), [&]() { return traceAll(*variant.pBvh, rays); });
+        reportThroughput(prefix + "BoundingVolumeHierarchy::intersectPacket (object SAH)", rays.size(), tracePackets);
+        for (const BvhVariant& variant : bvhVariants)
+            reportTraversalCost(prefix + "traversal cost (" + variant.name + ")", *variant.pBvh, rays);
+    }
+}
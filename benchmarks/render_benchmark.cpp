@@ -0,0 +1,366 @@
+// Headless end-to-end render benchmark / regression check.
+//
+// Renders every built-in scene from a fixed camera with fixed settings (no window or OpenGL needed)
+// and records BVH build time, render time, rays/s, peak RSS and an image checksum. The image is
+// compared (PSNR) against a reference bitmap and, optionally, all numbers against a previous run:
+//
+//   RenderBenchmark --output results.json                       Measure and write JSON.
+//   RenderBenchmark --update-references                         (Re)create the reference images.
+//   RenderBenchmark --baseline baseline.json --tolerance 0.1    Fail when a scene got >10% slower
+//                                                               or its PSNR dropped below --min-psnr.
+//   RenderBenchmark --mesh-cache read                           Compare scene loading (disabled|read|mapped)
+//   RenderBenchmark --importer native --mesh-cache disabled     and mesh importers (assimp|native).
+//   RenderBenchmark --geometry quantized                        Trace the compact vertex format (full|quantized).
+//   RenderBenchmark --split object-sah --max-leaf-primitives 8  Compare BVH build settings (see BvhBuildSettings).
+//   RenderBenchmark --packets 8                                 Trace the primary rays in 8x8 packets (4 or 8).
+//   RenderBenchmark --wavefront                                 Render with the wavefront pipeline.
+//   RenderBenchmark --wavefront --unsorted-rays                 ... without binning the secondary rays.
+//   RenderBenchmark --aperture 0.05 --focus-distance 3          Render with depth of field (thin lens camera).
+#include "bounding_volume_hierarchy.h"
+#include "disable_all_warnings.h"
+#include "ray_statistics.h"
+#include "render.h"
+#include "scene.h"
+#include "screen.h"
+#include "trackball.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/vec3.hpp>
+#include <stb_image.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+static const std::filesystem::path dataPath { DATA_DIR };
+static const std::filesystem::path defaultReferencePath { std::filesystem::path(DATA_DIR) / "references" };
+
+struct SceneResult {
+    std::string scene;
+    float loadMilliseconds { 0 };
+    float bvhBuildMilliseconds { 0 };
+    uint64_t bvhArenaPeakBytes { 0 }; // Scratch memory of the BVH build (see BvhBuildStatistics).
+    uint64_t bvhArenaBlocks { 0 };
+    float bvhRefitMilliseconds { 0 }; // Per-frame cost of updating the BVH of animated geometry.
+    float renderMilliseconds { 0 };
+    uint64_t rays { 0 };
+    double megaRaysPerSecond { 0 };
+    uint64_t peakRssKiloBytes { 0 };
+    uint64_t geometryBytes { 0 }; // Vertex, triangle and primitive data read by the traversal.
+    std::string checksum;
+    std::optional<double> psnr; // Missing when there is no reference image.
+};
+
+// Peak resident set size of the process so far.
+static uint64_t peakRssKiloBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return uint64_t(counters.PeakWorkingSetSize / 1024);
+#else
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return uint64_t(usage.ru_maxrss) / 1024; // Bytes on macOS.
+#else
+    return uint64_t(usage.ru_maxrss); // Kilobytes on Linux.
+#endif
+#endif
+}
+
+// Pixels quantized exactly like Screen::writeBitmapToFile does.
+static std::vector<uint8_t> quantize(const Screen& screen)
+{
+    std::vector<uint8_t> result;
+    for (const glm::vec3& color : screen.pixels()) {
+        const glm::vec3 clamped = glm::clamp(color, 0.0f, 1.0f) * 255.0f;
+        result.push_back(uint8_t(clamped.x));
+        result.push_back(uint8_t(clamped.y));
+        result.push_back(uint8_t(clamped.z));
+    }
+    return result;
+}
+
+// 64-bit FNV-1a.
+static std::string checksum(const std::vector<uint8_t>& bytes)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (uint8_t byte : bytes) {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    }
+    std::stringstream stream;
+    stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return stream.str();
+}
+
+static std::optional<double> psnr(const std::vector<uint8_t>& image, const std::filesystem::path& referenceFile)
+{
+    if (!std::filesystem::exists(referenceFile))
+        return {};
+
+    int width, height, numChannels;
+    const std::string referenceFileString = referenceFile.string();
+    stbi_uc* pReference = stbi_load(referenceFileString.c_str(), &width, &height, &numChannels, STBI_rgb);
+    if (!pReference || size_t(width * height * 3) != image.size()) {
+        std::cerr << "Reference image " << referenceFile << " is unreadable or has a different resolution" << std::endl;
+        stbi_image_free(pReference);
+        return 0.0;
+    }
+
+    double squaredError = 0.0;
+    for (size_t i = 0; i < image.size(); i++) {
+        const double difference = double(image[i]) - double(pReference[i]);
+        squaredError += difference * difference;
+    }
+    stbi_image_free(pReference);
+
+    const double meanSquaredError = squaredError / double(image.size());
+    if (meanSquaredError == 0.0)
+        return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
+
+static void writeJson(std::ostream& stream, int resolution, const std::vector<SceneResult>& results)
+{
+    stream << "{\n  \"resolution\": " << resolution << ",\n  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const SceneResult& result = results[i];
+        stream << "    {\n"
+               << "      \"scene\": \"" << result.scene << "\",\n"
+               << "      \"load_ms\": " << result.loadMilliseconds << ",\n"
+               << "      \"bvh_build_ms\": " << result.bvhBuildMilliseconds << ",\n"
+               << "      \"bvh_arena_peak_bytes\": " << result.bvhArenaPeakBytes << ",\n"
+               << "      \"bvh_arena_blocks\": " << result.bvhArenaBlocks << ",\n"
+               << "      \"bvh_refit_ms\": " << result.bvhRefitMilliseconds << ",\n"
+               << "      \"render_ms\": " << result.renderMilliseconds << ",\n"
+               << "      \"rays\": " << result.rays << ",\n"
+               << "      \"mrays_per_second\": " << result.megaRaysPerSecond << ",\n"
+               << "      \"peak_rss_kb\": " << result.peakRssKiloBytes << ",\n"
+               << "      \"geometry_bytes\": " << result.geometryBytes << ",\n"
+               << "      \"checksum\": \"" << result.checksum << "\",\n"
+               << "      \"psnr_db\": ";
+        if (!result.psnr)
+            stream << "null";
+        else if (std::isinf(*result.psnr))
+            stream << "\"inf\"";
+        else
+            stream << *result.psnr;
+        stream << "\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    stream << "  ]\n}\n";
+}
+
+// Read scene -> render_ms from a file written by writeJson (not a general JSON parser).
+static std::map<std::string, float> readBaseline(const std::filesystem::path& file)
+{
+    std::ifstream stream { file };
+    if (!stream) {
+        std::cerr << "Could not open baseline " << file << std::endl;
+        throw std::exception();
+    }
+    const std::string text { std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+
+    std::map<std::string, float> result;
+    const std::regex scenePattern { R"re("scene":\s*"([^"]+)"[^}]*"render_ms":\s*([0-9.eE+-]+))re" };
+    for (auto it = std::sregex_iterator(std::begin(text), std::end(text), scenePattern); it != std::sregex_iterator(); ++it)
+        result[(*it)[1].str()] = std::stof((*it)[2].str());
+    return result;
+}
+
+static void printUsage()
+{
+    std::cout << "Usage: RenderBenchmark [--resolution N] [--output results.json] [--references DIR] [--update-references]\n"
+              << "                       [--mesh-cache disabled|read|mapped] [--importer assimp|native] [--geometry full|quantized]\n"
+              << "                       [--baseline baseline.json] [--tolerance 0.1] [--min-psnr 30]\n"
+              << "                       [--split median|object-sah|spatial-sah] [--max-leaf-primitives 4] [--max-depth 48]\n"
+              << "                       [--traversal-cost 1] [--intersection-cost 1] [--spatial-split-budget 0.3] [--treelets]\n"
+              << "                       [--packets 4|8] [--wavefront] [--unsorted-rays]\n"
+              << "                       [--aperture 0] [--focus-distance 3]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    int resolution = 256;
+    std::filesystem::path outputFile = "render_benchmark.json";
+    std::filesystem::path referencePath = defaultReferencePath;
+    std::optional<std::filesystem::path> baselineFile;
+    bool updateReferences = false;
+    float tolerance = 0.1f;
+    double minPsnr = 30.0;
+    MeshLoadSettings meshLoadSettings;
+    GeometryFormat geometryFormat = GeometryFormat::Full;
+    BvhBuildSettings bvhBuildSettings;
+    RenderSettings settings;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (argument == "--resolution" && hasValue)
+            resolution = std::atoi(argv[++i]);
+        else if (argument == "--output" && hasValue)
+            outputFile = argv[++i];
+        else if (argument == "--references" && hasValue)
+            referencePath = argv[++i];
+        else if (argument == "--baseline" && hasValue)
+            baselineFile = argv[++i];
+        else if (argument == "--tolerance" && hasValue)
+            tolerance = std::stof(argv[++i]);
+        else if (argument == "--min-psnr" && hasValue)
+            minPsnr = std::stod(argv[++i]);
+        else if (argument == "--mesh-cache" && hasValue) {
+            const std::string value = argv[++i];
+            meshLoadSettings.cache = value == "disabled" ? MeshCache::Disabled : (value == "read" ? MeshCache::Read : MeshCache::Mapped);
+        } else if (argument == "--importer" && hasValue) {
+            meshLoadSettings.importer = std::string(argv[++i]) == "native" ? MeshImporter::Native : MeshImporter::Assimp;
+        } else if (argument == "--geometry" && hasValue) {
+            geometryFormat = std::string(argv[++i]) == "quantized" ? GeometryFormat::Quantized : GeometryFormat::Full;
+        } else if (argument == "--split" && hasValue) {
+            const std::string value = argv[++i];
+            bvhBuildSettings.splitMethod = value == "object-sah" ? BvhSplitMethod::ObjectSah : (value == "spatial-sah" ? BvhSplitMethod::SpatialSah : BvhSplitMethod::Median);
+        } else if (argument == "--max-leaf-primitives" && hasValue)
+            bvhBuildSettings.maxLeafPrimitives = uint32_t(std::max(std::atoi(argv[++i]), 1));
+        else if (argument == "--max-depth" && hasValue)
+            bvhBuildSettings.maxDepth = std::max(std::atoi(argv[++i]), 1);
+        else if (argument == "--traversal-cost" && hasValue)
+            bvhBuildSettings.traversalCost = std::stof(argv[++i]);
+        else if (argument == "--intersection-cost" && hasValue)
+            bvhBuildSettings.intersectionCost = std::stof(argv[++i]);
+        else if (argument == "--spatial-split-budget" && hasValue)
+            bvhBuildSettings.spatialSplitBudget = std::stof(argv[++i]);
+        else if (argument == "--treelets")
+            bvhBuildSettings.restructureTreelets = true;
+        else if (argument == "--packets" && hasValue)
+            settings.rayPacketSize = std::atoi(argv[++i]);
+        else if (argument == "--wavefront")
+            settings.wavefront = true;
+        else if (argument == "--unsorted-rays")
+            settings.sortSecondaryRays = false;
+        else if (argument == "--aperture" && hasValue)
+            settings.lens.apertureRadius = std::stof(argv[++i]);
+        else if (argument == "--focus-distance" && hasValue)
+            settings.lens.focusDistance = std::stof(argv[++i]);
+        else if (argument == "--update-references")
+            updateReferences = true;
+        else {
+            printUsage();
+            return argument == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    // Same camera as the interactive application starts with.
+    Trackball camera { nullptr, glm::radians(50.0f), 3.0f };
+    camera.setCamera(glm::vec3(0.0f, 0.0f, 0.0f), glm::radians(glm::vec3(20.0f, 20.0f, 0.0f)), 3.0f);
+
+    using clock = std::chrono::high_resolution_clock;
+    std::vector<SceneResult> results;
+    for (const SceneType sceneType : allSceneTypes) {
+        SceneResult result;
+        result.scene = sceneName(sceneType);
+
+        Scene scene;
+        try {
+            const auto loadStart = clock::now();
+            scene = loadScene(sceneType, dataPath, meshLoadSettings);
+            result.loadMilliseconds = std::chrono::duration<float, std::milli>(clock::now() - loadStart).count();
+        } catch (const std::exception&) {
+            std::cerr << "Skipping scene " << result.scene << " (failed to load its data)" << std::endl;
+            continue;
+        }
+
+        const auto bvhStart = clock::now();
+        BoundingVolumeHierarchy bvh { &scene, bvhBuildSettings };
+        bvh.setGeometryFormat(geometryFormat);
+        result.bvhBuildMilliseconds = std::chrono::duration<float, std::milli>(clock::now() - bvhStart).count();
+        result.bvhArenaPeakBytes = bvh.buildStatistics().arenaPeakBytes;
+        result.bvhArenaBlocks = bvh.buildStatistics().arenaBlocks;
+        result.geometryBytes = bvh.geometryBytes();
+
+        Screen screen { glm::ivec2(resolution) };
+        resetRayStatistics();
+        const auto renderStart = clock::now();
+        renderRayTracing(scene, camera, bvh, screen, settings);
+        result.renderMilliseconds = std::chrono::duration<float, std::milli>(clock::now() - renderStart).count();
+        result.rays = collectRayStatistics().totalRays();
+        result.megaRaysPerSecond = double(result.rays) / (double(result.renderMilliseconds) * 1e3);
+        result.peakRssKiloBytes = peakRssKiloBytes();
+        // The geometry did not move, so this only measures the cost of a refit. It runs after the render because a
+        // refit undoes the clipping of spatial splits, which would otherwise be missing from the timed render.
+        result.bvhRefitMilliseconds = bvh.refit().milliseconds;
+
+        const std::vector<uint8_t> image = quantize(screen);
+        result.checksum = checksum(image);
+        const std::filesystem::path referenceFile = referencePath / (result.scene + ".bmp");
+        if (updateReferences) {
+            std::filesystem::create_directories(referencePath);
+            screen.writeBitmapToFile(referenceFile);
+        }
+        result.psnr = psnr(image, referenceFile);
+
+        std::cout << std::left << std::setw(26) << result.scene << std::right << std::fixed << std::setprecision(1)
+                  << " load " << std::setw(8) << result.loadMilliseconds << " ms"
+                  << "  BVH " << std::setw(8) << result.bvhBuildMilliseconds << " ms"
+                  << " (arena " << std::setw(6) << result.bvhArenaPeakBytes / 1024 << " KB in " << result.bvhArenaBlocks << " blocks, refit " << result.bvhRefitMilliseconds << " ms)"
+                  << "  render " << std::setw(9) << result.renderMilliseconds << " ms"
+                  << "  " << std::setw(7) << std::setprecision(2) << result.megaRaysPerSecond << " Mrays/s"
+                  << "  peak RSS " << std::setw(8) << result.peakRssKiloBytes << " KB"
+                  << "  geometry " << std::setw(8) << result.geometryBytes / 1024 << " KB"
+                  << "  checksum " << result.checksum;
+        if (result.psnr)
+            std::cout << "  PSNR " << std::setprecision(1) << *result.psnr << " dB";
+        std::cout << std::endl;
+        results.push_back(result);
+    }
+
+    {
+        std::ofstream stream { outputFile };
+        writeJson(stream, resolution, results);
+        std::cout << "Results written to " << outputFile << std::endl;
+    }
+
+    bool failed = false;
+    for (const SceneResult& result : results) {
+        if (result.psnr && *result.psnr < minPsnr) {
+            std::cout << "FAIL " << result.scene << ": PSNR " << *result.psnr << " dB is below " << minPsnr << " dB" << std::endl;
+            failed = true;
+        }
+    }
+    if (baselineFile) {
+        const auto baseline = readBaseline(*baselineFile);
+        for (const SceneResult& result : results) {
+            const auto it = baseline.find(result.scene);
+            if (it == std::end(baseline))
+                continue;
+            const float ratio = result.renderMilliseconds / std::max(it->second, 1e-3f);
+            const bool slower = ratio > 1.0f + tolerance;
+            std::cout << (slower ? "FAIL " : "OK   ") << std::left << std::setw(26) << result.scene << std::right
+                      << std::setprecision(2) << " speedup x" << 1.0f / ratio << " (" << it->second << " ms -> " << result.renderMilliseconds << " ms)" << std::endl;
+            failed |= slower;
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -14,6 +14,7 @@ class Window;
 class Trackball {
 public:
 	// NOTE(Mathijs): field of view in radians! (use glm::radians(...) to convert from degrees to radians).
+	// pWindow may be nullptr for headless rendering: the camera then ignores input and uses a square aspect ratio.
 	Trackball(Window* pWindow, float fovy, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
 	Trackball(Window* pWindow, float fovy, const glm::vec3& lookAt, float distanceFromLookAt = 4.0f, float rotationX = 0.0f, float rotationY = 0.0f);
 	~Trackball() = default;
@@ -30,6 +31,8 @@ public:
 	[[nodiscard]] glm::vec3 lookAt() const; // Point that the camera is looking at / rotating around.
 	[[nodiscard]] glm::mat4 viewMatrix() const;
 	[[nodiscard]] glm::mat4 projectionMatrix() const;
+	[[nodiscard]] float fieldOfView() const; // Vertical field of view in radians.
+	[[nodiscard]] float aspectRatio() const; // Aspect ratio of the window (1 without a window).
 
 	void setCamera(const glm::vec3 lookAt, const glm::vec3 rotations, const float dist); // Set the position and orientation of the camera.
 	void setLookAt(const glm::vec3 lookAt); //set the lookAt of the camera
@@ -1,11 +1,44 @@
 #include "bounding_volume_hierarchy.h"
+#include "build_arena.h"
 #include "draw.h"
+#include "ray_statistics.h"
+#include "disable_all_warnings.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
 #include <queue>
+#include <sstream>
+#include <system_error>
+#include <type_traits>
 
 AxisAlignedBox getRootBoundingBox(std::vector<Mesh> &meshes);
-void sortTrianglesByCentres(std::vector<Triangle> &triangles, Mesh &onlyMesh, int longestAxis);
-AxisAlignedBox getBoundingBoxFromMeshes(std::vector<Mesh> &meshes);
-bool intersectRecursive(Ray &ray, HitInfo &hitInfo, const Node &current, const std::vector<Node> &nodes);
+AxisAlignedBox getBoundingBoxFromPrimitives(gsl::span<const uint32_t> order, gsl::span<const AxisAlignedBox> bounds);
+AxisAlignedBox getTransformedBoundingBox(const AxisAlignedBox &box, const glm::mat4 &transform);
+float getSurfaceArea(const AxisAlignedBox &box);
+float getSahCost(gsl::span<const Node> nodes, const BvhBuildSettings &settings);
+size_t restructureTreelets(std::vector<Node> &nodes, std::vector<uint32_t> &order, const BvhBuildSettings &settings);
+
+// Data shared by all the traversal functions.
+struct TraversalContext
+{
+    gsl::span<const Node> nodes;
+    gsl::span<const BvhPrimitive> primitives;
+    gsl::span<const Mesh> meshes;
+    // Only set for GeometryFormat::Quantized.
+    const QuantizedGeometry *pQuantized;
+    TraversalCost *pCost;
+};
+
+bool intersectRecursive(Ray &ray, HitInfo &hitInfo, const Node &current, const TraversalContext &context);
 
 //void printTree(std::vector<Node> &nodes) {
 //    std::queue<Node> q;
@@ -33,373 +66,1910 @@ bool intersectRecursive(Ray &ray, HitInfo &hitInfo, const Node &current, const s
 /**
  * Constructor for the bvh. 
  * 
- * Create the root bounding box that will contain all the meshes, 
- * use it to create the root node and call createTree to
- * recursively create the rest of the nodes. 
+ * Builds the tree in memory, see build(), and the hierarchies of the instanced meshes, see buildInstances().
+ * 
+ * @param *pScene Scene pointer with all relevant information for this scene
+ * @param &settings BvhBuildSettings reference selecting how the nodes are split
+ */
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(Scene *pScene, const BvhBuildSettings &settings)
+    : m_pScene(pScene)
+    , m_meshes(pScene->meshes)
+    , m_spheres(pScene->spheres)
+    , m_settings(settings)
+{
+    buildOrLoad(nullptr);
+    buildInstances(nullptr);
+}
+
+/**
+ * Constructor for the bvh that reuses a previously built tree. 
+ * 
+ * The tree is looked up in cacheDirectory under its cache key. If it is found, the node and
+ * primitive arrays are used directly from the memory mapped file (nothing is parsed or copied).
+ * Otherwise the tree is built as usual and saved for the next time.
  * 
  * @param *pScene Scene pointer with all relevant information for this scene
+ * @param &cacheDirectory directory containing the saved trees
+ * @param &settings BvhBuildSettings reference selecting how the nodes are split
  */
-BoundingVolumeHierarchy::BoundingVolumeHierarchy(Scene *pScene)
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(Scene *pScene, const std::filesystem::path &cacheDirectory, const BvhBuildSettings &settings)
     : m_pScene(pScene)
+    , m_meshes(pScene->meshes)
+    , m_spheres(pScene->spheres)
+    , m_settings(settings)
 {
-    //--- TODO ---//
-    // implement the division criteria with SAH+binning (in case)
-    //
-    maxDepth = 12;
+    buildOrLoad(&cacheDirectory);
+    buildInstances(&cacheDirectory);
+}
 
-    std::vector<Mesh> meshes = pScene->meshes;
+/**
+ * Constructor for the bottom-level hierarchy of an instanced mesh. 
+ * 
+ * @param &mesh Mesh in object space, which must outlive the hierarchy
+ * @param &settings BvhBuildSettings reference selecting how the nodes are split
+ * @param *pCacheDirectory directory containing the saved trees, or nullptr to always build the tree
+ */
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(const Mesh &mesh, const BvhBuildSettings &settings, const std::filesystem::path *pCacheDirectory)
+    : m_meshes(&mesh, 1)
+    , m_settings(settings)
+{
+    buildOrLoad(pCacheDirectory);
+}
 
-    if (meshes.empty())
+/**
+ * Build the tree of the meshes, or load it if it was saved before. 
+ * 
+ * @param *pCacheDirectory directory containing the saved trees, or nullptr to always build the tree
+ */
+void BoundingVolumeHierarchy::buildOrLoad(const std::filesystem::path *pCacheDirectory)
+{
+    if (!pCacheDirectory)
     {
+        build();
         return;
     }
 
-    AxisAlignedBox rootAABB = getBoundingBoxFromMeshes(meshes);
+    const uint64_t key = cacheKey();
+    std::stringstream fileName;
+    fileName << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+    const std::filesystem::path file = *pCacheDirectory / fileName.str();
+    if (loadFromFile(file, key))
+    {
+        return;
+    }
 
-    bool isLeaf = maxDepth - 1 == 0 || (meshes.size() == 1 && meshes[0].triangles.size() == 1);
+    build();
+    if (!nodes.empty())
+    {
+        save(file);
+    }
+}
 
-    Node root = Node{
-        isLeaf,
-        0,
-        rootAABB,
-        {},
-        meshes,
-    };
-    createTree(root);
+/**
+ * Per primitive data that the build needs over and over, computed once before the build.
+ * 
+ * All arrays are indexed by the position of the primitive in the primitive array before the build
+ * (the build only reorders an array of these indices and the primitives are gathered at the end).
+ */
+struct BuildPrimitives
+{
+    gsl::span<const BvhPrimitive> primitives;
+    gsl::span<const glm::vec3> centroids;
+    gsl::span<const AxisAlignedBox> bounds;
+};
+
+/**
+ * Build the tree. 
+ * 
+ * Create the primitive array referencing every triangle of the scene, compute the centroid and
+ * bounding box of every primitive and create the root node containing all of them, then call
+ * createTree to create the rest of the nodes. The nodes only reorder one array of primitive
+ * indices in place; it and the other scratch arrays of the build come from an arena that is
+ * released when the build is done. The SAH split methods use createSahTree instead.
+ */
+void BoundingVolumeHierarchy::build()
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    const gsl::span<const Mesh> meshes = m_meshes;
+    size_t numTriangles = 0;
+    for (const Mesh &mesh : meshes)
+    {
+        numTriangles += mesh.triangles.size();
+    }
+    m_primitiveStorage.reserve(numTriangles);
+    for (uint32_t meshIndex = 0; meshIndex < meshes.size(); meshIndex++)
+    {
+        for (uint32_t triangleIndex = 0; triangleIndex < meshes[meshIndex].triangles.size(); triangleIndex++)
+        {
+            m_primitiveStorage.push_back(BvhPrimitive{meshIndex, triangleIndex});
+        }
+    }
+
+    if (m_primitiveStorage.empty())
+    {
+        return;
+    }
+
+    BuildArena arena;
+    const gsl::span<glm::vec3> centroids = arena.allocate<glm::vec3>(m_primitiveStorage.size());
+    const gsl::span<AxisAlignedBox> bounds = arena.allocate<AxisAlignedBox>(m_primitiveStorage.size());
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < int(m_primitiveStorage.size()); i++)
+    {
+        const Mesh &mesh = meshes[m_primitiveStorage[size_t(i)].mesh];
+        const Triangle &triangle = mesh.triangles[m_primitiveStorage[size_t(i)].triangle];
+        const glm::vec3 &v0 = mesh.positions[triangle[0]];
+        const glm::vec3 &v1 = mesh.positions[triangle[1]];
+        const glm::vec3 &v2 = mesh.positions[triangle[2]];
+        centroids[size_t(i)] = (v0 + v1 + v2) / 3.0f;
+        bounds[size_t(i)] = AxisAlignedBox{glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2))};
+    }
+    const BuildPrimitives input{m_primitiveStorage, centroids, bounds};
+
+    // spatial splits reference some primitives from more than one leaf, so the SAH builds return their own
+    // order (as does the treelet restructuring, which changes the leaves)
+    std::vector<uint32_t> ownedOrder;
+    gsl::span<const uint32_t> leafOrder;
+    if (m_settings.splitMethod == BvhSplitMethod::Median)
+    {
+        const gsl::span<uint32_t> order = arena.allocate<uint32_t>(m_primitiveStorage.size());
+        std::iota(order.begin(), order.end(), 0u);
+
+        Node root = Node{
+            getBoundingBoxFromPrimitives(order, bounds),
+            0,
+            0,
+            uint32_t(m_primitiveStorage.size()),
+        };
+        createTree(root, input, order, arena, m_nodeStorage);
+        leafOrder = order;
+    }
+    else
+    {
+        ownedOrder = createSahTree(input, arena);
+        leafOrder = ownedOrder;
+    }
+    if (m_settings.restructureTreelets)
+    {
+        const auto restructureStart = std::chrono::high_resolution_clock::now();
+        ownedOrder.assign(leafOrder.begin(), leafOrder.end());
+        m_buildStatistics.restructuredTreelets = restructureTreelets(m_nodeStorage, ownedOrder, m_settings);
+        leafOrder = ownedOrder;
+        m_buildStatistics.restructureMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - restructureStart).count();
+    }
+
+    // put the primitives in the order of the leaves
+    std::vector<BvhPrimitive> orderedPrimitives(leafOrder.size());
+    for (size_t i = 0; i < leafOrder.size(); i++)
+    {
+        orderedPrimitives[i] = m_primitiveStorage[leafOrder[i]];
+    }
+    m_primitiveStorage = std::move(orderedPrimitives);
+    nodes = m_nodeStorage;
+    primitives = m_primitiveStorage;
+
+    m_builtSahCost = getSahCost(nodes, m_settings);
+    m_buildStatistics.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    m_buildStatistics.arenaPeakBytes = arena.peakBytes();
+    m_buildStatistics.arenaBlocks = arena.numBlocks();
     //std::cout << "\n\n";
     //std::cout << nodes.size() << std::endl;
-    //for (Node node : nodes)
-    //{
-    //    std::cout << node.indices.size() << std::endl;
-    //}
     //printTree(nodes);
 }
 
 /**
- * Sort multiple meshes by their centres. 
+ * Build the two-level part of the hierarchy for the instances of the scene. 
  * 
- * The "centre" of a mesh is the centre of its middle triangle
- * --> use the sortTrianglesByCentres to first sort the triangles inside meshes. 
- * We always only care about the coordinate defined by longestAxis. 
+ * Every instanced mesh gets its own (bottom-level) hierarchy in object space, which is shared by all
+ * of its instances. The top-level tree is built over the world space bounding boxes of the instances
+ * (the transformed corners of the root box of their mesh) in the same way as the tree over triangles.
  * 
- * @param &meshes std::vector reference to the meshes of a node
- * @param longestAxis int deciding which axis to sort by
+ * @param *pCacheDirectory directory for the trees of the instanced meshes, or nullptr to always build them
  */
-void sortMeshesByCentres(std::vector<Mesh> &meshes, int longestAxis)
+void BoundingVolumeHierarchy::buildInstances(const std::filesystem::path *pCacheDirectory)
 {
-    std::sort(meshes.begin(), meshes.end(),
-              [longestAxis](Mesh &m1, Mesh &m2) {
-                  std::vector<Triangle> triangles1 = m1.triangles;
-                  sortTrianglesByCentres(triangles1, m1, longestAxis); // triangles1 is now sorted
-                  std::vector<Triangle> triangles2 = m2.triangles;
-                  sortTrianglesByCentres(triangles2, m2, longestAxis); // triangles2 is now sorted
+    const std::vector<MeshInstance> &instances = m_pScene->instances;
+    if (instances.empty())
+    {
+        return;
+    }
 
-                  // get the middle triangle from the sorted triangles of this mesh
-                  Triangle middle1 = triangles1[triangles1.size() / 2];
-                  Triangle middle2 = triangles2[triangles2.size() / 2];
+    m_meshHierarchies.reserve(m_pScene->instancedMeshes.size());
+    for (const Mesh &mesh : m_pScene->instancedMeshes)
+    {
+        m_meshHierarchies.push_back(BoundingVolumeHierarchy(mesh, m_settings, pCacheDirectory));
+    }
 
-                  // get the centres of these middle triangles
-                  glm::vec3 c1 = (m1.vertices[middle1[0]].p + m1.vertices[middle1[1]].p + m1.vertices[middle1[2]].p) / 3.0f;
-                  glm::vec3 c2 = (m2.vertices[middle2[0]].p + m2.vertices[middle2[1]].p + m2.vertices[middle2[2]].p) / 3.0f;
+    BuildArena arena;
+    const gsl::span<BvhPrimitive> instancePrimitives = arena.allocate<BvhPrimitive>(instances.size());
+    const gsl::span<glm::vec3> centroids = arena.allocate<glm::vec3>(instances.size());
+    const gsl::span<AxisAlignedBox> bounds = arena.allocate<AxisAlignedBox>(instances.size());
+    m_instances.reserve(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        const MeshInstance &instance = instances[i];
+        m_instances.push_back(BvhInstance{glm::inverse(instance.transform), glm::inverseTranspose(glm::mat3(instance.transform)), instance.mesh});
+
+        // an empty mesh is never hit, it only gets a point as its box
+        const BoundingVolumeHierarchy &meshHierarchy = m_meshHierarchies[instance.mesh];
+        const AxisAlignedBox objectBounds = meshHierarchy.nodes.empty() ? AxisAlignedBox{glm::vec3(0.0f), glm::vec3(0.0f)} : meshHierarchy.nodes[0].AABB;
+        // all instances count as the same "mesh" so that every split is a median split
+        instancePrimitives[i] = BvhPrimitive{0, uint32_t(i)};
+        bounds[i] = getTransformedBoundingBox(objectBounds, instance.transform);
+        centroids[i] = (bounds[i].lower + bounds[i].upper) * 0.5f;
+    }
+    const BuildPrimitives input{instancePrimitives, centroids, bounds};
+
+    const gsl::span<uint32_t> order = arena.allocate<uint32_t>(instances.size());
+    std::iota(order.begin(), order.end(), 0u);
+    const Node root{getBoundingBoxFromPrimitives(order, bounds), 0, 0, uint32_t(instances.size())};
+    createTree(root, input, order, arena, m_instanceNodes);
+    m_instanceOrder.assign(order.begin(), order.end());
+    if (m_settings.restructureTreelets)
+    {
+        restructureTreelets(m_instanceNodes, m_instanceOrder, m_settings);
+    }
+    m_builtInstanceSahCost = getSahCost(m_instanceNodes, m_settings);
+}
 
-                  float coord1 = (longestAxis == 0) ? c1.x : ((longestAxis == 1) ? c1.y : (longestAxis == 2) ? c1.z : -1);
-                  float coord2 = (longestAxis == 0) ? c2.x : ((longestAxis == 1) ? c2.y : (longestAxis == 2) ? c2.z : -1);
+/**
+ * Recompute the boxes of a tree bottom-up, keeping its topology. 
+ * 
+ * The nodes are stored breadth first, so the nodes of every level form a contiguous range after the
+ * range of the level above. The levels are processed from the deepest to the root; within a level
+ * every node only reads its children (or primitives), so the nodes of a level are refitted in parallel.
+ * 
+ * @param &nodes std::vector reference to the nodes of the tree
+ * @param &leafBounds function returning the box of the primitives of a leaf
+ */
+template <typename LeafBounds>
+void refitNodes(std::vector<Node> &nodes, const LeafBounds &leafBounds)
+{
+    size_t levelEnd = nodes.size();
+    while (levelEnd > 0)
+    {
+        size_t levelBegin = levelEnd - 1;
+        while (levelBegin > 0 && nodes[levelBegin - 1].level == nodes[levelEnd - 1].level)
+        {
+            levelBegin--;
+        }
 
-                  return coord1 < coord2;
-              });
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+        for (int i = int(levelBegin); i < int(levelEnd); i++)
+        {
+            Node &node = nodes[size_t(i)];
+            if (node.isLeaf())
+            {
+                node.AABB = leafBounds(node);
+            }
+            else
+            {
+                const AxisAlignedBox &left = nodes[node.first].AABB;
+                const AxisAlignedBox &right = nodes[node.first + 1].AABB;
+                node.AABB = AxisAlignedBox{glm::min(left.lower, right.lower), glm::max(left.upper, right.upper)};
+            }
+        }
+        levelEnd = levelBegin;
+    }
 }
 
 /**
- * Sort triangles by their centres. 
+ * Refit the tree of the meshes to their current vertex positions. 
  * 
- * The centre of a triangle is the average of its 3 vertices. 
- * We always only care about the coordinate defined by longestAxis. 
+ * The leaf boxes are the bounds of their whole triangles, so the boxes that spatial splits clipped to
+ * their side of the split plane grow back to the full triangles.
  * 
- * @param &triangles std::vector reference to the triangles of a mesh
- * @param &onlyMesh Mesh reference to the mesh of which we want to sort the triangles
- * @param longestAxis int deciding which axis to sort by
+ * @return the SAH cost of the refitted tree relative to its cost after the build
  */
-void sortTrianglesByCentres(std::vector<Triangle> &triangles, Mesh &onlyMesh, int longestAxis)
+float BoundingVolumeHierarchy::refitMeshes()
 {
-    std::sort(triangles.begin(), triangles.end(),
-              [&onlyMesh, longestAxis](const auto &t1, const auto &t2) {
-                  glm::vec3 c1 = (onlyMesh.vertices[t1[0]].p + onlyMesh.vertices[t1[1]].p + onlyMesh.vertices[t1[2]].p) / 3.0f;
-                  glm::vec3 c2 = (onlyMesh.vertices[t2[0]].p + onlyMesh.vertices[t2[1]].p + onlyMesh.vertices[t2[2]].p) / 3.0f;
+    if (nodes.empty())
+    {
+        return 1.0f;
+    }
 
-                  float coord1 = (longestAxis == 0) ? c1.x : ((longestAxis == 1) ? c1.y : (longestAxis == 2) ? c1.z : -1);
-                  float coord2 = (longestAxis == 0) ? c2.x : ((longestAxis == 1) ? c2.y : (longestAxis == 2) ? c2.z : -1);
+    // the nodes of a loaded tree are in the (read-only) mapped file
+    if (nodes.data() != m_nodeStorage.data())
+    {
+        m_nodeStorage.assign(nodes.begin(), nodes.end());
+    }
+    refitNodes(m_nodeStorage, [&](const Node &leaf) {
+        glm::vec3 lower{std::numeric_limits<float>::max()};
+        glm::vec3 upper{-std::numeric_limits<float>::max()};
+        for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++)
+        {
+            const Mesh &mesh = m_meshes[primitives[i].mesh];
+            const Triangle &triangle = mesh.triangles[primitives[i].triangle];
+            for (int vertex = 0; vertex < 3; vertex++)
+            {
+                lower = glm::min(lower, mesh.positions[triangle[vertex]]);
+                upper = glm::max(upper, mesh.positions[triangle[vertex]]);
+            }
+        }
+        return AxisAlignedBox{lower, upper};
+    });
+    nodes = m_nodeStorage;
 
-                  return coord1 < coord2;
-              });
+    // the quantized vertices are relative to the root box, so they have to be created again
+    if (m_geometryFormat == GeometryFormat::Quantized)
+    {
+        buildQuantizedGeometry();
+    }
+    else
+    {
+        m_quantizedGeometry = QuantizedGeometry{};
+    }
+    return m_builtSahCost > 0.0f ? getSahCost(nodes, m_settings) / m_builtSahCost : 1.0f;
 }
 
 /**
- * !Not used! Get a list of vertices from triangles. 
- * 
- * Because triangles store indices for their vertices, 
- * getting the vertices of a mesh defined only by triangles is annoying.
+ * Refit the trees of the instanced meshes, then the tree of the instances to their current transforms. 
  * 
- * @param &vertices std::vector reference to vertices
- * @param &triangles std::vector reference to triangles
- * @param onlyMesh Mesh needed to retrieve all the vertices of the scene (should maybe be a reference?)
+ * @return the largest SAH cost ratio (refitted / built) of these trees
  */
-void getVerticesFromTriangles(std::vector<Vertex> &vertices, std::vector<Triangle> &triangles, Mesh onlyMesh)
+float BoundingVolumeHierarchy::refitInstances()
 {
-    for (Triangle t : triangles)
+    float sahCostRatio = 1.0f;
+    for (BoundingVolumeHierarchy &meshHierarchy : m_meshHierarchies)
+    {
+        sahCostRatio = std::max(sahCostRatio, meshHierarchy.refitMeshes());
+    }
+    if (m_instanceNodes.empty())
+    {
+        return sahCostRatio;
+    }
+
+    const std::vector<MeshInstance> &instances = m_pScene->instances;
+    for (size_t i = 0; i < m_instances.size(); i++)
+    {
+        m_instances[i] = BvhInstance{glm::inverse(instances[i].transform), glm::inverseTranspose(glm::mat3(instances[i].transform)), instances[i].mesh};
+    }
+    refitNodes(m_instanceNodes, [&](const Node &leaf) {
+        glm::vec3 lower{std::numeric_limits<float>::max()};
+        glm::vec3 upper{-std::numeric_limits<float>::max()};
+        for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++)
+        {
+            const MeshInstance &instance = instances[m_instanceOrder[i]];
+            const BoundingVolumeHierarchy &meshHierarchy = m_meshHierarchies[instance.mesh];
+            if (!meshHierarchy.nodes.empty())
+            {
+                const AxisAlignedBox box = getTransformedBoundingBox(meshHierarchy.nodes[0].AABB, instance.transform);
+                lower = glm::min(lower, box.lower);
+                upper = glm::max(upper, box.upper);
+            }
+        }
+        // a leaf of only empty meshes keeps an (empty) inverted box
+        return AxisAlignedBox{lower, upper};
+    });
+    if (m_builtInstanceSahCost > 0.0f)
     {
-        vertices.push_back(onlyMesh.vertices[t[0]]);
-        vertices.push_back(onlyMesh.vertices[t[1]]);
-        vertices.push_back(onlyMesh.vertices[t[2]]);
+        sahCostRatio = std::max(sahCostRatio, getSahCost(m_instanceNodes, m_settings) / m_builtInstanceSahCost);
     }
+    return sahCostRatio;
+}
+
+BvhRefitStatistics BoundingVolumeHierarchy::refit()
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    BvhRefitStatistics statistics;
+    statistics.sahCostRatio = std::max(refitMeshes(), refitInstances());
+    statistics.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return statistics;
+}
+
+/**
+ * Centre of a triangle, which is the average of its 3 vertices. 
+ * 
+ * @param &mesh Mesh reference to the mesh containing the triangle
+ * @param &triangle Triangle reference to the triangle
+ * @return the centre of the triangle
+ */
+glm::vec3 triangleCentre(const Mesh &mesh, const Triangle &triangle)
+{
+    return (mesh.positions[triangle[0]] + mesh.positions[triangle[1]] + mesh.positions[triangle[2]]) / 3.0f;
+}
+
+/**
+ * Partition triangles around the median of their centres. 
+ * 
+ * Afterwards the primitive at position nth is the one that would be there if the primitives
+ * were sorted by the coordinate of their centre along longestAxis, the ones before it are not
+ * greater and the ones after it not smaller. This is all a median split needs and takes linear
+ * time instead of a full sort.
+ * 
+ * @param order span of the indices of the primitives (triangles) to partition in place
+ * @param centroids the precomputed centres of all primitives
+ * @param longestAxis int deciding which axis to partition along
+ * @param nth position of the primitive that is put in its sorted place
+ */
+void partitionTrianglesByCentres(gsl::span<uint32_t> order, gsl::span<const glm::vec3> centroids, int longestAxis, size_t nth)
+{
+    std::nth_element(order.begin(), order.begin() + nth, order.end(),
+                     [centroids, longestAxis](uint32_t p1, uint32_t p2) {
+                         return centroids[p1][longestAxis] < centroids[p2][longestAxis];
+                     });
 }
 
 /**
  * Split meshes into two groups for a node with multiple meshes. 
  * 
  * When a node contains multiple meshes, these meshes must be split
- * into two groups based on their centres (see sortMeshesByCentres).
+ * into two groups based on their centres. The "centre" of a mesh is the centre
+ * of its middle triangle along longestAxis. The primitives of every mesh are stored
+ * consecutively, the groups are reordered in place.
  * 
- * @param &leftChild std::vector reference of meshes to add to the left child of this node
- * @param &rightChild std::vector reference of meshes to add to the right child of this node
- * @param meshesCopy std::vector copy of the meshes from the parent
- *  --> must be a copy because we will be sorting it
+ * @param order span of the indices of the primitives of the node, grouped by mesh
+ * @param &input the precomputed primitive data
  * @param longestAxis int determining the axis which will be split
+ * @param &arena BuildArena for the group list and the reordering buffer
+ * @return the number of primitives that go to the left child
+ */
+size_t splitMultipleMeshes(gsl::span<uint32_t> order, const BuildPrimitives &input, int longestAxis, BuildArena &arena)
+{
+    struct MeshGroup
+    {
+        size_t begin, end;
+        float centre;
+    };
+    const auto meshOf = [&input](uint32_t index) { return input.primitives[index].mesh; };
+    size_t numGroups = 1;
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        numGroups += meshOf(order[i]) != meshOf(order[i - 1]);
+    }
+    const gsl::span<MeshGroup> groups = arena.allocate<MeshGroup>(numGroups);
+    size_t groupIndex = 0;
+    for (size_t begin = 0; begin < order.size();)
+    {
+        size_t end = begin;
+        while (end < order.size() && meshOf(order[end]) == meshOf(order[begin]))
+        {
+            end++;
+        }
+
+        // the triangles of a mesh may be reordered in place, the children partition them again anyway
+        gsl::span<uint32_t> group = order.subspan(begin, end - begin);
+        partitionTrianglesByCentres(group, input.centroids, longestAxis, group.size() / 2);
+        groups[groupIndex++] = MeshGroup{begin, end, input.centroids[group[group.size() / 2]][longestAxis]};
+        begin = end;
+    }
+
+    // only the groups of the left half have to come first
+    const size_t leftGroups = groups.size() / 2;
+    std::nth_element(groups.begin(), groups.begin() + leftGroups, groups.end(),
+                     [](const MeshGroup &g1, const MeshGroup &g2) { return g1.centre < g2.centre; });
+
+    // split the meshes for the 2 child nodes
+    // note: the middle element is always assigned to the right child
+    const gsl::span<uint32_t> reordered = arena.allocate<uint32_t>(order.size());
+    size_t reorderedCount = 0;
+    size_t leftCount = 0;
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+        reorderedCount = size_t(std::copy(order.begin() + groups[i].begin, order.begin() + groups[i].end, reordered.begin() + reorderedCount) - reordered.begin());
+        if (i + 1 == leftGroups)
+        {
+            leftCount = reorderedCount;
+        }
+    }
+    std::copy(reordered.begin(), reordered.end(), order.begin());
+    return leftCount;
+}
+
+/**
+ * Give the number of levels of the bvh tree.
+ * 
+ * @return int number of levels
+ */
+int BoundingVolumeHierarchy::numLevels() const
+{
+    int maxLevel = 0;
+    for (const Node &n : nodes) {
+        if (n.level > maxLevel) {
+            maxLevel = n.level;
+        }
+    }
+
+    return maxLevel + 1; // even with only one node at level 0 there is 1 level
+}
+
+/**
+ * Create a bounding box from primitives. 
+ * 
+ * Merge the precomputed bounding boxes of the triangles.
+ * 
+ * @param order span of the indices of the primitives (triangles) of a node
+ * @param bounds the precomputed bounding boxes of all primitives
+ * @return an AABB for the inputted primitives
+ */
+AxisAlignedBox getBoundingBoxFromPrimitives(gsl::span<const uint32_t> order, gsl::span<const AxisAlignedBox> bounds)
+{
+    // min and max values for each coordinate will
+    // initially be the ones of the first triangle
+    glm::vec3 mins = bounds[order[0]].lower;
+    glm::vec3 maxs = bounds[order[0]].upper;
+
+    for (const uint32_t index : order)
+    {
+        mins = glm::min(mins, bounds[index].lower);
+        maxs = glm::max(maxs, bounds[index].upper);
+    }
+    return AxisAlignedBox{mins, maxs};
+}
+
+/**
+ * Box around a box after transforming it. 
+ * 
+ * @param &box AxisAlignedBox reference to the box to transform
+ * @param &transform the transformation
+ * @return the AABB of the 8 transformed corners of the box
+ */
+AxisAlignedBox getTransformedBoundingBox(const AxisAlignedBox &box, const glm::mat4 &transform)
+{
+    glm::vec3 lower{std::numeric_limits<float>::max()};
+    glm::vec3 upper{-std::numeric_limits<float>::max()};
+    for (int corner = 0; corner < 8; corner++)
+    {
+        const glm::vec3 objectCorner{(corner & 1) ? box.upper.x : box.lower.x,
+                                     (corner & 2) ? box.upper.y : box.lower.y,
+                                     (corner & 4) ? box.upper.z : box.lower.z};
+        const glm::vec3 worldCorner = glm::vec3(transform * glm::vec4(objectCorner, 1.0f));
+        lower = glm::min(lower, worldCorner);
+        upper = glm::max(upper, worldCorner);
+    }
+    return AxisAlignedBox{lower, upper};
+}
+
+/**
+ * Surface area heuristic cost of a tree. 
+ * 
+ * The expected cost of tracing a ray through the tree: every node costs one traversal step and every
+ * primitive of a leaf one intersection test, weighted by the probability that a ray through the root
+ * box hits the node's box (its surface area relative to the root box).
+ * 
+ * @param nodes span of the nodes of the tree, the root first
+ * @param &settings BvhBuildSettings reference with the costs of a traversal step and an intersection test
+ * @return the SAH cost, 0 for an empty tree
+ */
+float getSahCost(gsl::span<const Node> nodes, const BvhBuildSettings &settings)
+{
+    if (nodes.empty() || getSurfaceArea(nodes[0].AABB) <= 0.0f)
+    {
+        return 0.0f;
+    }
+    double cost = 0.0;
+    for (const Node &node : nodes)
+    {
+        cost += double(getSurfaceArea(node.AABB) * (node.isLeaf() ? settings.intersectionCost * float(node.count) : settings.traversalCost));
+    }
+    return float(cost / double(getSurfaceArea(nodes[0].AABB)));
+}
+
+/**
+ * Surface area of a box. 
+ * 
+ * @param &box AxisAlignedBox reference to the box
+ * @return the surface area, 0 for an empty box
+ */
+float getSurfaceArea(const AxisAlignedBox &box)
+{
+    const glm::vec3 extent = glm::max(box.upper - box.lower, glm::vec3(0.0f));
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+/**
+ * Create two subnodes for this node.
+ * 
+ * The function differentiates between a node with a single mesh
+ * and a node with multiple meshes to be able to split the meshes
+ * and triangles accordingly. The primitive indices of the node are reordered
+ * in place such that those of the left child come first.
+ * 
+ * @param &node Node reference to the node that is split
+ * @param &leftNode Node reference that receives the left child
+ * @param &rightNode Node reference that receives the right child
+ * @param &input the precomputed primitive data
+ * @param order span of the primitive indices of the whole tree
+ * @param &arena BuildArena for the scratch arrays, which are released before returning
+ */
+void BoundingVolumeHierarchy::getSubNodes(const Node &node, Node &leftNode, Node &rightNode, const BuildPrimitives &input, gsl::span<uint32_t> order, BuildArena &arena)
+{
+    // determine the longest axis by which we will be splitting
+    // by taking the bounding box from the parent node
+    glm::vec3 mins = node.AABB.lower;
+    glm::vec3 maxs = node.AABB.upper;
+    float x = maxs.x - mins.x;
+    float y = maxs.y - mins.y;
+    float z = maxs.z - mins.z;
+    int longestAxis = (x > y) ? ((x > z) ? 0 : 2) : ((y > z) ? 1 : 2);
+
+    gsl::span<uint32_t> nodePrimitives = order.subspan(node.first, node.count);
+
+    size_t leftCount;
+    if (input.primitives[nodePrimitives.front()].mesh != input.primitives[nodePrimitives.back()].mesh)
+    {
+        // divide the meshes into groups
+        const BuildArena::Marker marker = arena.mark();
+        leftCount = splitMultipleMeshes(nodePrimitives, input, longestAxis, arena);
+        arena.rewind(marker);
+    }
+    else
+    {
+        // split the triangles of the only mesh
+        // note: the middle element is always assigned to the right child
+        leftCount = nodePrimitives.size() / 2;
+        partitionTrianglesByCentres(nodePrimitives, input.centroids, longestAxis, leftCount);
+    }
+
+    gsl::span<const uint32_t> leftPrimitives = nodePrimitives.subspan(0, leftCount);
+    gsl::span<const uint32_t> rightPrimitives = nodePrimitives.subspan(leftCount);
+
+    leftNode = Node{getBoundingBoxFromPrimitives(leftPrimitives, input.bounds), node.level + 1, node.first, uint32_t(leftPrimitives.size())};
+    rightNode = Node{getBoundingBoxFromPrimitives(rightPrimitives, input.bounds), node.level + 1, node.first + uint32_t(leftCount), uint32_t(rightPrimitives.size())};
+}
+
+/**
+ * Create the whole tree breadth first. 
+ * 
+ * Every node is added to the vector of nodes belonging to this class. A node that is
+ * not at the maximum depth and contains more than the maximum number of primitives of a
+ * leaf is split: its two subnodes are appended and it becomes an inner node referencing them.
+ * 
+ * @param root Node containing all the primitives
+ * @param &input the precomputed primitive data
+ * @param order span of the primitive indices, reordered such that every node references a range of it
+ * @param &arena BuildArena for the scratch arrays of the splits
+ * @param &nodeStorage std::vector reference that receives the nodes
+ */
+void BoundingVolumeHierarchy::createTree(Node root, const BuildPrimitives &input, gsl::span<uint32_t> order, BuildArena &arena, std::vector<Node> &nodeStorage)
+{
+    // a full binary tree has fewer than 2 nodes per leaf, and there is at most one leaf per primitive
+    // (or per node at the maximum depth), so the array never has to grow
+    const size_t maxLeaves = std::min(size_t(root.count), size_t(1) << std::clamp(m_settings.maxDepth, 0, 30));
+    nodeStorage.reserve(2 * maxLeaves - 1);
+    nodeStorage.push_back(root);
+
+    // the treelet restructuring works best on single primitive leaves and collapses them again afterwards
+    const uint32_t maxLeafPrimitives = m_settings.restructureTreelets ? 1u : std::max(m_settings.maxLeafPrimitives, 1u);
+
+    // the children are appended at the end, so every node is visited after its parent
+    for (size_t currentIndex = 0; currentIndex < nodeStorage.size(); currentIndex++)
+    {
+        const Node currentNode = nodeStorage[currentIndex];
+        if (currentNode.level >= m_settings.maxDepth || currentNode.count <= maxLeafPrimitives)
+        {
+            continue; // stays a leaf
+        }
+
+        Node leftNode;
+        Node rightNode;
+        getSubNodes(currentNode, leftNode, rightNode, input, order, arena);
+
+        nodeStorage[currentIndex].first = uint32_t(nodeStorage.size());
+        nodeStorage[currentIndex].count = 0;
+        nodeStorage.push_back(leftNode);
+        nodeStorage.push_back(rightNode);
+    }
+}
+
+// Number of bins along every axis that the SAH builds evaluate split planes at.
+static constexpr int sahBins = 16;
+// Spatial splits are only tried if the children of the best object split overlap by more than this
+// fraction of the surface area of the root (alpha in the SBVH paper).
+static constexpr float spatialSplitMinOverlap = 1e-5f;
+
+// A primitive referenced by a node of the SAH builds, with the part of its box that lies inside the node
+// (smaller than the box of the primitive if a spatial split clipped it).
+struct SahReference
+{
+    uint32_t primitive;
+    AxisAlignedBox bounds;
+};
+
+// The best split found for a node; axis is -1 if no split was possible.
+struct SahSplit
+{
+    float cost = std::numeric_limits<float>::max();
+    int axis = -1;
+    // Object splits: the bin of the centroids that is the first one of the right child.
+    int bin = 0;
+    // Spatial splits: the split plane.
+    float position = 0.0f;
+    bool spatial = false;
+};
+
+static constexpr AxisAlignedBox emptyBox{glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max())};
+
+static AxisAlignedBox mergeBoxes(const AxisAlignedBox &a, const AxisAlignedBox &b)
+{
+    return AxisAlignedBox{glm::min(a.lower, b.lower), glm::max(a.upper, b.upper)};
+}
+
+static bool isEmpty(const AxisAlignedBox &box)
+{
+    return box.lower.x > box.upper.x || box.lower.y > box.upper.y || box.lower.z > box.upper.z;
+}
+
+/**
+ * Bin of a centroid for the object splits. 
+ * 
+ * @param centroid the centroid of the primitive
+ * @param &centroidBounds AxisAlignedBox reference to the box around all centroids of the node
+ * @param axis the axis of the bins
+ * @return the bin index in [0, sahBins)
  */
-void getChildMeshesMultipleMeshes(std::vector<Mesh> &leftChild, std::vector<Mesh> &rightChild,
-                                  std::vector<Mesh> meshesCopy, int longestAxis)
+static int getCentroidBin(const glm::vec3 &centroid, const AxisAlignedBox &centroidBounds, int axis)
 {
-    sortMeshesByCentres(meshesCopy, longestAxis);
+    const float extent = centroidBounds.upper[axis] - centroidBounds.lower[axis];
+    const int bin = int(float(sahBins) * (centroid[axis] - centroidBounds.lower[axis]) / extent);
+    return std::clamp(bin, 0, sahBins - 1);
+}
+
+/**
+ * Box around the part of a triangle between two planes perpendicular to an axis. 
+ * 
+ * Collects the vertices between the planes and the points where the edges cross the planes.
+ * 
+ * @param &v0 first vertex of the triangle
+ * @param &v1 second vertex of the triangle
+ * @param &v2 third vertex of the triangle
+ * @param axis the axis the planes are perpendicular to
+ * @param lower position of the first plane along the axis
+ * @param upper position of the second plane along the axis
+ * @param &bounds AxisAlignedBox reference to the current box of the reference, which the result is limited to
+ * @return the clipped box, empty if the triangle does not reach between the planes
+ */
+static AxisAlignedBox clipTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, int axis, float lower, float upper, const AxisAlignedBox &bounds)
+{
+    const std::array<glm::vec3, 3> vertices{v0, v1, v2};
+    AxisAlignedBox clipped = emptyBox;
+    const auto addPoint = [&clipped](const glm::vec3 &point) {
+        clipped.lower = glm::min(clipped.lower, point);
+        clipped.upper = glm::max(clipped.upper, point);
+    };
+    for (size_t i = 0; i < 3; i++)
+    {
+        const glm::vec3 &start = vertices[i];
+        const glm::vec3 &end = vertices[(i + 1) % 3];
+        if (start[axis] >= lower && start[axis] <= upper)
+        {
+            addPoint(start);
+        }
+        for (const float plane : {lower, upper})
+        {
+            if ((start[axis] - plane) * (end[axis] - plane) < 0.0f)
+            {
+                glm::vec3 crossing = glm::mix(start, end, (plane - start[axis]) / (end[axis] - start[axis]));
+                crossing[axis] = plane;
+                addPoint(crossing);
+            }
+        }
+    }
+    return AxisAlignedBox{glm::max(clipped.lower, bounds.lower), glm::min(clipped.upper, bounds.upper)};
+}
+
+/**
+ * Find the cheapest object split of a node with binned SAH. 
+ * 
+ * The references are binned by their centroids along every axis and every boundary between
+ * two bins is evaluated as a split plane.
+ * 
+ * @param references span of the references of the node
+ * @param &nodeBounds AxisAlignedBox reference to the box of the node
+ * @param &centroidBounds AxisAlignedBox reference to the box around the centroids of the references
+ * @param &settings BvhBuildSettings reference with the SAH costs
+ * @return the best object split (axis -1 if all centroids are at the same position)
+ */
+static SahSplit findObjectSplit(gsl::span<const SahReference> references, const AxisAlignedBox &nodeBounds, const AxisAlignedBox &centroidBounds, const BvhBuildSettings &settings)
+{
+    struct Bin
+    {
+        AxisAlignedBox bounds = emptyBox;
+        uint32_t count = 0;
+    };
+
+    SahSplit best;
+    const float nodeArea = getSurfaceArea(nodeBounds);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (centroidBounds.upper[axis] <= centroidBounds.lower[axis])
+        {
+            continue;
+        }
+
+        std::array<Bin, sahBins> bins;
+        for (const SahReference &reference : references)
+        {
+            Bin &bin = bins[size_t(getCentroidBin((reference.bounds.lower + reference.bounds.upper) * 0.5f, centroidBounds, axis))];
+            bin.bounds = mergeBoxes(bin.bounds, reference.bounds);
+            bin.count++;
+        }
+
+        // sweep from the right to get the cost of the right side of every plane, then from the left
+        std::array<float, sahBins> rightCosts{};
+        Bin right;
+        for (int i = sahBins - 1; i > 0; i--)
+        {
+            right.bounds = mergeBoxes(right.bounds, bins[size_t(i)].bounds);
+            right.count += bins[size_t(i)].count;
+            rightCosts[size_t(i)] = getSurfaceArea(right.bounds) * float(right.count);
+        }
+        Bin left;
+        for (int i = 1; i < sahBins; i++)
+        {
+            left.bounds = mergeBoxes(left.bounds, bins[size_t(i - 1)].bounds);
+            left.count += bins[size_t(i - 1)].count;
+            const float cost = settings.traversalCost + settings.intersectionCost * (getSurfaceArea(left.bounds) * float(left.count) + rightCosts[size_t(i)]) / nodeArea;
+            if (left.count > 0 && left.count < references.size() && cost < best.cost)
+            {
+                best = SahSplit{cost, axis, i, 0.0f, false};
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * Find the cheapest spatial split of a node with binned SAH. 
+ * 
+ * The node box is divided into equally sized bins along every axis. Every reference is clipped to
+ * all bins it overlaps, and counted as entering in its first bin and exiting in its last bin, so a
+ * plane between two bins has the references that entered before it on the left and the references
+ * that exit after it on the right (the references it cuts through on both sides).
+ * 
+ * @param references span of the references of the node
+ * @param &nodeBounds AxisAlignedBox reference to the box of the node
+ * @param &input the precomputed primitive data
+ * @param meshes span of the meshes containing the triangles
+ * @param maxDuplicates the largest number of references the split is allowed to add
+ * @param &settings BvhBuildSettings reference with the SAH costs
+ * @return the best spatial split (axis -1 if none is possible within maxDuplicates)
+ */
+static SahSplit findSpatialSplit(gsl::span<const SahReference> references, const AxisAlignedBox &nodeBounds, const BuildPrimitives &input, gsl::span<const Mesh> meshes, size_t maxDuplicates,
+                                 const BvhBuildSettings &settings)
+{
+    struct Bin
+    {
+        AxisAlignedBox bounds = emptyBox;
+        uint32_t entries = 0;
+        uint32_t exits = 0;
+    };
+
+    SahSplit best;
+    const float nodeArea = getSurfaceArea(nodeBounds);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float origin = nodeBounds.lower[axis];
+        const float binWidth = (nodeBounds.upper[axis] - origin) / float(sahBins);
+        if (binWidth <= 0.0f)
+        {
+            continue;
+        }
+        const auto getBin = [&](float position) { return std::clamp(int((position - origin) / binWidth), 0, sahBins - 1); };
+
+        std::array<Bin, sahBins> bins;
+        for (const SahReference &reference : references)
+        {
+            const BvhPrimitive &primitive = input.primitives[reference.primitive];
+            const Mesh &mesh = meshes[primitive.mesh];
+            const Triangle &triangle = mesh.triangles[primitive.triangle];
+            const int firstBin = getBin(reference.bounds.lower[axis]);
+            const int lastBin = getBin(reference.bounds.upper[axis]);
+            for (int i = firstBin; i <= lastBin; i++)
+            {
+                const float binLower = origin + float(i) * binWidth;
+                const float binUpper = i == sahBins - 1 ? nodeBounds.upper[axis] : binLower + binWidth;
+                const AxisAlignedBox clipped = clipTriangle(mesh.positions[triangle[0]], mesh.positions[triangle[1]], mesh.positions[triangle[2]], axis, binLower, binUpper, reference.bounds);
+                if (!isEmpty(clipped))
+                {
+                    bins[size_t(i)].bounds = mergeBoxes(bins[size_t(i)].bounds, clipped);
+                }
+            }
+            bins[size_t(firstBin)].entries++;
+            bins[size_t(lastBin)].exits++;
+        }
+
+        std::array<float, sahBins> rightCosts{};
+        std::array<uint32_t, sahBins> rightCounts{};
+        AxisAlignedBox rightBounds = emptyBox;
+        uint32_t rightCount = 0;
+        for (int i = sahBins - 1; i > 0; i--)
+        {
+            rightBounds = mergeBoxes(rightBounds, bins[size_t(i)].bounds);
+            rightCount += bins[size_t(i)].exits;
+            rightCosts[size_t(i)] = getSurfaceArea(rightBounds) * float(rightCount);
+            rightCounts[size_t(i)] = rightCount;
+        }
+        AxisAlignedBox leftBounds = emptyBox;
+        uint32_t leftCount = 0;
+        for (int i = 1; i < sahBins; i++)
+        {
+            leftBounds = mergeBoxes(leftBounds, bins[size_t(i - 1)].bounds);
+            leftCount += bins[size_t(i - 1)].entries;
+            const size_t duplicates = size_t(leftCount) + rightCounts[size_t(i)] - references.size();
+            const float cost = settings.traversalCost + settings.intersectionCost * (getSurfaceArea(leftBounds) * float(leftCount) + rightCosts[size_t(i)]) / nodeArea;
+            if (leftCount > 0 && rightCounts[size_t(i)] > 0 && duplicates <= maxDuplicates && cost < best.cost)
+            {
+                best = SahSplit{cost, axis, i, origin + float(i) * binWidth, true};
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * Create the whole tree breadth first with the surface area heuristic. 
+ * 
+ * Every node evaluates the binned object splits (and, for BvhSplitMethod::SpatialSah, the spatial
+ * splits if the children of the best object split overlap) and becomes a leaf if that is cheaper
+ * than the best split and it has at most the maximum number of primitives of a leaf. A spatial split adds the
+ * references that cross the split plane to both children, clipped to their side, as long as the
+ * total number of references stays within the budget of the settings. The nodes are appended in the
+ * same breadth first order as createTree.
+ * 
+ * The references of the nodes of one level are stored consecutively in one array of the arena, and
+ * the children write theirs to a second array for the next level; the two arrays swap roles when the
+ * next level starts. Both hold the largest number of references the budget allows.
+ * 
+ * @param &input the precomputed primitive data
+ * @param &arena BuildArena for the reference arrays and the scratch array of every split
+ * @return the primitive indices of the leaves in order (a primitive may be referenced more than once)
+ */
+std::vector<uint32_t> BoundingVolumeHierarchy::createSahTree(const BuildPrimitives &input, BuildArena &arena)
+{
+    const size_t numPrimitives = input.primitives.size();
+    const size_t maxReferences = numPrimitives + size_t(double(numPrimitives) * double(std::max(m_settings.spatialSplitBudget, 0.0f)));
+    size_t numReferences = numPrimitives;
+
+    // until a node is processed, its first is the offset of its references in the array of its level
+    gsl::span<SahReference> levelReferences = arena.allocate<SahReference>(maxReferences);
+    gsl::span<SahReference> nextLevelReferences = arena.allocate<SahReference>(maxReferences);
+    size_t numNextLevelReferences = 0;
+    int currentLevel = 0;
+    AxisAlignedBox rootBounds = emptyBox;
+    for (uint32_t i = 0; i < numPrimitives; i++)
+    {
+        levelReferences[i] = SahReference{i, input.bounds[i]};
+        rootBounds = mergeBoxes(rootBounds, input.bounds[i]);
+    }
+    const float rootArea = getSurfaceArea(rootBounds);
+    m_nodeStorage.push_back(Node{rootBounds, 0, 0, uint32_t(numPrimitives)});
+
+    std::vector<uint32_t> leafOrder;
+    leafOrder.reserve(numPrimitives);
+    for (size_t currentIndex = 0; currentIndex < m_nodeStorage.size(); currentIndex++)
+    {
+        const Node currentNode = m_nodeStorage[currentIndex];
+        if (currentNode.level != currentLevel)
+        {
+            std::swap(levelReferences, nextLevelReferences);
+            numNextLevelReferences = 0;
+            currentLevel = currentNode.level;
+        }
+        const gsl::span<const SahReference> references = levelReferences.subspan(currentNode.first, currentNode.count);
+
+        SahSplit split;
+        AxisAlignedBox centroidBounds = emptyBox;
+        if (currentNode.level < m_settings.maxDepth && references.size() > 1)
+        {
+            for (const SahReference &reference : references)
+            {
+                const glm::vec3 centroid = (reference.bounds.lower + reference.bounds.upper) * 0.5f;
+                centroidBounds = mergeBoxes(centroidBounds, AxisAlignedBox{centroid, centroid});
+            }
+            split = findObjectSplit(references, currentNode.AABB, centroidBounds, m_settings);
+
+            if (m_settings.splitMethod == BvhSplitMethod::SpatialSah && numReferences < maxReferences)
+            {
+                // the overlap of the children of the object split decides whether spatial splits may help
+                AxisAlignedBox leftBounds = emptyBox;
+                AxisAlignedBox rightBounds = emptyBox;
+                if (split.axis >= 0)
+                {
+                    for (const SahReference &reference : references)
+                    {
+                        AxisAlignedBox &bounds = getCentroidBin((reference.bounds.lower + reference.bounds.upper) * 0.5f, centroidBounds, split.axis) < split.bin ? leftBounds : rightBounds;
+                        bounds = mergeBoxes(bounds, reference.bounds);
+                    }
+                }
+                const AxisAlignedBox overlap{glm::max(leftBounds.lower, rightBounds.lower), glm::min(leftBounds.upper, rightBounds.upper)};
+                if (split.axis < 0 || (!isEmpty(overlap) && getSurfaceArea(overlap) > spatialSplitMinOverlap * rootArea))
+                {
+                    const SahSplit spatialSplit = findSpatialSplit(references, currentNode.AABB, input, m_meshes, maxReferences - numReferences, m_settings);
+                    if (spatialSplit.cost < split.cost)
+                    {
+                        split = spatialSplit;
+                    }
+                }
+            }
+        }
+
+        const float leafCost = m_settings.intersectionCost * float(references.size());
+        const size_t maxLeafPrimitives = std::max(m_settings.maxLeafPrimitives, 1u);
+        const bool canSplit = split.axis >= 0 || references.size() > maxLeafPrimitives;
+        if (currentNode.level >= m_settings.maxDepth || references.size() == 1 || !canSplit || (split.cost >= leafCost && references.size() <= maxLeafPrimitives))
+        {
+            m_nodeStorage[currentIndex].first = uint32_t(leafOrder.size());
+            m_nodeStorage[currentIndex].count = uint32_t(references.size());
+            for (const SahReference &reference : references)
+            {
+                leafOrder.push_back(reference.primitive);
+            }
+            continue; // stays a leaf
+        }
+
+        // the left references go straight to the array of the next level, the right ones to a scratch array
+        // (each side gets every reference at most once) and are appended after the left ones at the end
+        const BuildArena::Marker marker = arena.mark();
+        const gsl::span<SahReference> leftReferences = nextLevelReferences.subspan(numNextLevelReferences, references.size());
+        const gsl::span<SahReference> rightReferences = arena.allocate<SahReference>(references.size());
+        size_t leftCount = 0;
+        size_t rightCount = 0;
+        const auto divideInMiddle = [&]() {
+            leftCount = references.size() / 2;
+            rightCount = references.size() - leftCount;
+            std::copy_n(references.begin(), leftCount, leftReferences.begin());
+            std::copy_n(references.begin() + std::ptrdiff_t(leftCount), rightCount, rightReferences.begin());
+        };
+        if (split.axis < 0)
+        {
+            // all centroids are at the same position: divide the references in the middle
+            divideInMiddle();
+        }
+        else if (!split.spatial)
+        {
+            for (const SahReference &reference : references)
+            {
+                if (getCentroidBin((reference.bounds.lower + reference.bounds.upper) * 0.5f, centroidBounds, split.axis) < split.bin)
+                {
+                    leftReferences[leftCount++] = reference;
+                }
+                else
+                {
+                    rightReferences[rightCount++] = reference;
+                }
+            }
+        }
+        else
+        {
+            for (const SahReference &reference : references)
+            {
+                if (reference.bounds.upper[split.axis] <= split.position)
+                {
+                    leftReferences[leftCount++] = reference;
+                }
+                else if (reference.bounds.lower[split.axis] >= split.position)
+                {
+                    rightReferences[rightCount++] = reference;
+                }
+                else
+                {
+                    // crosses the plane: clip it to both sides
+                    const BvhPrimitive &primitive = input.primitives[reference.primitive];
+                    const Mesh &mesh = m_meshes[primitive.mesh];
+                    const Triangle &triangle = mesh.triangles[primitive.triangle];
+                    const glm::vec3 &v0 = mesh.positions[triangle[0]];
+                    const glm::vec3 &v1 = mesh.positions[triangle[1]];
+                    const glm::vec3 &v2 = mesh.positions[triangle[2]];
+                    const AxisAlignedBox leftBounds = clipTriangle(v0, v1, v2, split.axis, reference.bounds.lower[split.axis], split.position, reference.bounds);
+                    const AxisAlignedBox rightBounds = clipTriangle(v0, v1, v2, split.axis, split.position, reference.bounds.upper[split.axis], reference.bounds);
+                    if (isEmpty(leftBounds) && isEmpty(rightBounds))
+                    {
+                        // only possible through rounding; never lose a primitive
+                        leftReferences[leftCount++] = reference;
+                    }
+                    if (!isEmpty(leftBounds))
+                    {
+                        leftReferences[leftCount++] = SahReference{reference.primitive, leftBounds};
+                    }
+                    if (!isEmpty(rightBounds))
+                    {
+                        rightReferences[rightCount++] = SahReference{reference.primitive, rightBounds};
+                    }
+                }
+            }
+            const size_t duplicates = leftCount + rightCount - references.size();
+            if (leftCount == 0 || rightCount == 0 || duplicates > maxReferences - numReferences)
+            {
+                // clipping removed one side (the triangles only touch the plane), or rounding in the binning duplicated
+                // more references than the budget has left: divide the references in the middle
+                divideInMiddle();
+            }
+            else
+            {
+                numReferences += duplicates;
+                m_buildStatistics.spatialSplits++;
+                m_buildStatistics.duplicatedReferences += duplicates;
+            }
+        }
+        std::copy_n(rightReferences.begin(), rightCount, nextLevelReferences.begin() + std::ptrdiff_t(numNextLevelReferences + leftCount));
+
+        const auto getBounds = [](gsl::span<const SahReference> childReferences) {
+            AxisAlignedBox bounds = emptyBox;
+            for (const SahReference &reference : childReferences)
+            {
+                bounds = mergeBoxes(bounds, reference.bounds);
+            }
+            return bounds;
+        };
+        m_nodeStorage[currentIndex].first = uint32_t(m_nodeStorage.size());
+        m_nodeStorage[currentIndex].count = 0;
+        m_nodeStorage.push_back(Node{getBounds(nextLevelReferences.subspan(numNextLevelReferences, leftCount)), currentNode.level + 1, uint32_t(numNextLevelReferences), uint32_t(leftCount)});
+        m_nodeStorage.push_back(Node{getBounds(nextLevelReferences.subspan(numNextLevelReferences + leftCount, rightCount)), currentNode.level + 1, uint32_t(numNextLevelReferences + leftCount), uint32_t(rightCount)});
+        numNextLevelReferences += leftCount + rightCount;
+        arena.rewind(marker);
+    }
+    return leafOrder;
+}
+
+// Number of leaves of the treelets that restructureTreelets() reorganizes (the best topology is found by
+// trying all 2^7 subsets of the leaves) and the number of passes over the whole tree.
+static constexpr int treeletLeaves = 7;
+static constexpr int treeletPasses = 3;
+
+/**
+ * Index of the lowest set bit of a subset of treelet leaves. 
+ * 
+ * @param subset bit mask of treelet leaves, not 0
+ * @return index of the lowest leaf in the subset
+ */
+static int lowestLeaf(uint32_t subset)
+{
+    int leaf = 0;
+    while ((subset & (1u << leaf)) == 0)
+    {
+        leaf++;
+    }
+    return leaf;
+}
+
+/**
+ * Give the treelet rooted at a node the topology with the lowest SAH cost. 
+ * 
+ * The treelet is grown from the root by replacing the treelet leaf with the largest surface area by its
+ * two children (only inner nodes can be replaced) until it has treeletLeaves leaves. The subtrees below
+ * the treelet leaves keep their cost whatever the treelet above them looks like, so only the inner nodes
+ * of the treelet are compared: the cheapest tree over a subset of the leaves is the traversal cost of the
+ * box of the subset plus the cheapest split into two smaller subsets, which is computed for all subsets
+ * from small to large. The inner nodes of the treelet are reused for the new topology, so its root and
+ * everything outside the treelet stay where they are.
+ * 
+ * @param root index of the root of the treelet, an inner node
+ * @param &nodes std::vector reference to the nodes; only the boxes of inner nodes are written
+ * @param &children std::vector reference to the left and right child of every inner node
+ * @param &settings BvhBuildSettings reference with the cost of a traversal step
+ * @return true if the topology of the treelet changed
+ */
+static bool restructureTreelet(uint32_t root, std::vector<Node> &nodes, std::vector<glm::uvec2> &children, const BvhBuildSettings &settings)
+{
+    std::array<uint32_t, treeletLeaves> leaves;
+    std::array<uint32_t, treeletLeaves - 1> innerNodes;
+    leaves[0] = children[root].x;
+    leaves[1] = children[root].y;
+    innerNodes[0] = root;
+    int numLeaves = 2;
+    int numInnerNodes = 1;
+    float currentCost = settings.traversalCost * getSurfaceArea(nodes[root].AABB);
+    while (numLeaves < treeletLeaves)
+    {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < numLeaves; i++)
+        {
+            const Node &node = nodes[leaves[size_t(i)]];
+            const float area = getSurfaceArea(node.AABB);
+            if (!node.isLeaf() && area > largestArea)
+            {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest < 0)
+        {
+            break;
+        }
+        const uint32_t expanded = leaves[size_t(largest)];
+        innerNodes[size_t(numInnerNodes++)] = expanded;
+        currentCost += settings.traversalCost * largestArea;
+        leaves[size_t(largest)] = children[expanded].x;
+        leaves[size_t(numLeaves++)] = children[expanded].y;
+    }
+    if (numLeaves < 3)
+    {
+        return false; // two leaves can only be connected in one way
+    }
+
+    // every proper subset of a subset is a smaller number, so increasing order visits the parts first
+    const uint32_t allLeaves = (1u << numLeaves) - 1;
+    std::array<AxisAlignedBox, size_t(1) << treeletLeaves> boxes;
+    std::array<float, size_t(1) << treeletLeaves> costs;
+    std::array<uint32_t, size_t(1) << treeletLeaves> splits;
+    for (uint32_t subset = 1; subset <= allLeaves; subset++)
+    {
+        const int leaf = lowestLeaf(subset);
+        const uint32_t lowest = 1u << leaf;
+        if (subset == lowest)
+        {
+            boxes[subset] = nodes[leaves[size_t(leaf)]].AABB;
+            costs[subset] = 0.0f;
+            continue;
+        }
+        boxes[subset] = mergeBoxes(boxes[subset ^ lowest], nodes[leaves[size_t(leaf)]].AABB);
+
+        // every split is tried once: the part with the lowest leaf becomes the left child
+        const uint32_t others = subset ^ lowest;
+        float bestCost = std::numeric_limits<float>::max();
+        uint32_t bestSplit = lowest;
+        for (uint32_t rest = (others - 1) & others;; rest = (rest - 1) & others)
+        {
+            const uint32_t left = lowest | rest;
+            if (costs[left] + costs[subset ^ left] < bestCost)
+            {
+                bestCost = costs[left] + costs[subset ^ left];
+                bestSplit = left;
+            }
+            if (rest == 0)
+            {
+                break;
+            }
+        }
+        costs[subset] = settings.traversalCost * getSurfaceArea(boxes[subset]) + bestCost;
+        splits[subset] = bestSplit;
+    }
+    // only restructure for a real improvement, rounding differences would make the passes never converge
+    if (!(costs[allLeaves] < currentCost * 0.9999f))
+    {
+        return false;
+    }
+
+    // hand out the inner nodes of the treelet top-down, starting with the root
+    struct InnerNode
+    {
+        uint32_t subset;
+        uint32_t node;
+    };
+    std::array<InnerNode, treeletLeaves> stack;
+    size_t stackSize = 0;
+    int nextInnerNode = 1;
+    stack[stackSize++] = InnerNode{allLeaves, root};
+    while (stackSize > 0)
+    {
+        const InnerNode current = stack[--stackSize];
+        nodes[current.node].AABB = boxes[current.subset];
+        const uint32_t parts[2] = {splits[current.subset], current.subset ^ splits[current.subset]};
+        for (int i = 0; i < 2; i++)
+        {
+            const int leaf = lowestLeaf(parts[i]);
+            if (parts[i] == (1u << leaf))
+            {
+                children[current.node][i] = leaves[size_t(leaf)];
+            }
+            else
+            {
+                const uint32_t child = innerNodes[size_t(nextInnerNode++)];
+                children[current.node][i] = child;
+                stack[stackSize++] = InnerNode{parts[i], child};
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Treelet restructuring post-pass (in the manner of TRBVH) that lowers the SAH cost of a built tree. 
+ * 
+ * Every inner node is the root of a treelet that is given its best topology by restructureTreelet,
+ * bottom-up so that the treelets higher up see the improved subtrees. The treelets of the inner nodes
+ * at one depth are disjoint subtrees, so they are processed in parallel. After a few passes the subtrees
+ * of at most maxLeafPrimitives primitives are collapsed into a leaf where the SAH says that is cheaper
+ * (so the tree may be built with one primitive per leaf, which gives the treelets the most freedom).
+ * The result is stored breadth first again, with the primitives reordered such that every leaf
+ * references a range; it may be deeper than BvhBuildSettings::maxDepth.
+ * 
+ * @param &nodes std::vector reference to the nodes of the tree (breadth first), replaced by the new tree
+ * @param &order std::vector reference to the primitive indices referenced by the leaves, reordered
+ * @param &settings BvhBuildSettings reference with the SAH costs and the maximum number of primitives of a leaf
+ * @return number of treelets whose topology changed
+ */
+size_t restructureTreelets(std::vector<Node> &nodes, std::vector<uint32_t> &order, const BvhBuildSettings &settings)
+{
+    if (nodes.empty() || nodes[0].isLeaf())
+    {
+        return 0;
+    }
+    std::vector<glm::uvec2> children(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (!nodes[i].isLeaf())
+        {
+            children[i] = glm::uvec2(nodes[i].first, nodes[i].first + 1);
+        }
+    }
+    // the inner nodes grouped by their depth in the current topology
+    const auto getInnerNodesByDepth = [&]() {
+        std::vector<std::vector<uint32_t>> depths{{0u}};
+        while (true)
+        {
+            std::vector<uint32_t> next;
+            for (uint32_t node : depths.back())
+            {
+                for (int c = 0; c < 2; c++)
+                {
+                    if (!nodes[children[node][c]].isLeaf())
+                    {
+                        next.push_back(children[node][c]);
+                    }
+                }
+            }
+            if (next.empty())
+            {
+                return depths;
+            }
+            depths.push_back(std::move(next));
+        }
+    };
+
+    size_t restructured = 0;
+    for (int pass = 0; pass < treeletPasses; pass++)
+    {
+        const std::vector<std::vector<uint32_t>> depths = getInnerNodesByDepth();
+        size_t passRestructured = 0;
+        for (auto depth = depths.rbegin(); depth != depths.rend(); ++depth)
+        {
+            const std::vector<uint32_t> &roots = *depth;
+            int depthRestructured = 0;
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic, 64) reduction(+ : depthRestructured)
+#endif
+            for (int i = 0; i < int(roots.size()); i++)
+            {
+                if (restructureTreelet(roots[size_t(i)], nodes, children, settings))
+                {
+                    depthRestructured++;
+                }
+            }
+            passRestructured += size_t(depthRestructured);
+        }
+        restructured += passRestructured;
+        if (passRestructured == 0)
+        {
+            break;
+        }
+    }
+
+    // SAH cost of every subtree (bottom-up), collapsing it into one leaf where that is cheaper
+    std::vector<uint32_t> subtreePrimitives(nodes.size());
+    std::vector<float> subtreeCosts(nodes.size());
+    std::vector<char> collapse(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].isLeaf())
+        {
+            subtreePrimitives[i] = nodes[i].count;
+            subtreeCosts[i] = settings.intersectionCost * float(nodes[i].count) * getSurfaceArea(nodes[i].AABB);
+        }
+    }
+    const std::vector<std::vector<uint32_t>> depths = getInnerNodesByDepth();
+    for (auto depth = depths.rbegin(); depth != depths.rend(); ++depth)
+    {
+        for (uint32_t node : *depth)
+        {
+            const glm::uvec2 nodeChildren = children[node];
+            const float area = getSurfaceArea(nodes[node].AABB);
+            subtreePrimitives[node] = subtreePrimitives[nodeChildren.x] + subtreePrimitives[nodeChildren.y];
+            subtreeCosts[node] = settings.traversalCost * area + subtreeCosts[nodeChildren.x] + subtreeCosts[nodeChildren.y];
+            const float leafCost = settings.intersectionCost * float(subtreePrimitives[node]) * area;
+            if (subtreePrimitives[node] <= std::max(settings.maxLeafPrimitives, 1u) && leafCost <= subtreeCosts[node])
+            {
+                collapse[node] = 1;
+                subtreeCosts[node] = leafCost;
+            }
+        }
+    }
+
+    // store the tree breadth first again and give every leaf its own range of primitives
+    std::vector<Node> ordered;
+    std::vector<uint32_t> source;
+    std::vector<uint32_t> leafOrder;
+    std::vector<uint32_t> stack;
+    ordered.reserve(nodes.size());
+    source.reserve(nodes.size());
+    leafOrder.reserve(order.size());
+    ordered.push_back(nodes[0]);
+    source.push_back(0);
+    for (size_t i = 0; i < ordered.size(); i++)
+    {
+        if (nodes[source[i]].isLeaf() || collapse[source[i]])
+        {
+            const size_t first = leafOrder.size();
+            stack.push_back(source[i]);
+            while (!stack.empty())
+            {
+                const uint32_t node = stack.back();
+                stack.pop_back();
+                if (nodes[node].isLeaf())
+                {
+                    leafOrder.insert(leafOrder.end(), order.begin() + nodes[node].first, order.begin() + nodes[node].first + nodes[node].count);
+                }
+                else
+                {
+                    stack.push_back(children[node].y);
+                    stack.push_back(children[node].x);
+                }
+            }
+            ordered[i].first = uint32_t(first);
+            ordered[i].count = uint32_t(leafOrder.size() - first);
+            continue;
+        }
+        const glm::uvec2 nodeChildren = children[source[i]];
+        ordered[i].first = uint32_t(ordered.size());
+        for (int c = 0; c < 2; c++)
+        {
+            Node child = nodes[nodeChildren[c]];
+            child.level = ordered[i].level + 1;
+            ordered.push_back(child);
+            source.push_back(nodeChildren[c]);
+        }
+    }
+    nodes = std::move(ordered);
+    order = std::move(leafOrder);
+    return restructured;
+}
+
+/**
+ * Measure the shape and quality of the tree. 
+ * 
+ * @return BvhStatistics of the tree over the scene meshes (all zero for an empty tree)
+ */
+BvhStatistics BoundingVolumeHierarchy::statistics() const
+{
+    BvhStatistics result;
+    result.numNodes = nodes.size();
+    result.numReferences = primitives.size();
+    result.sahCost = getSahCost(nodes, m_settings);
+
+    double overlapSum = 0.0;
+    for (const Node &node : nodes)
+    {
+        if (node.isLeaf())
+        {
+            result.numLeaves++;
+            if (result.leafSizeHistogram.size() <= node.count)
+            {
+                result.leafSizeHistogram.resize(node.count + 1);
+            }
+            result.leafSizeHistogram[node.count]++;
+            if (result.leafDepthHistogram.size() <= size_t(node.level))
+            {
+                result.leafDepthHistogram.resize(size_t(node.level) + 1);
+            }
+            result.leafDepthHistogram[size_t(node.level)]++;
+            continue;
+        }
+
+        const AxisAlignedBox &left = nodes[node.first].AABB;
+        const AxisAlignedBox &right = nodes[node.first + 1].AABB;
+        const AxisAlignedBox overlap{glm::max(left.lower, right.lower), glm::min(left.upper, right.upper)};
+        const float nodeArea = getSurfaceArea(node.AABB);
+        if (nodeArea > 0.0f && !isEmpty(overlap))
+        {
+            overlapSum += double(getSurfaceArea(overlap) / nodeArea);
+        }
+    }
+    const size_t numInnerNodes = result.numNodes - result.numLeaves;
+    result.averageSiblingOverlap = numInnerNodes > 0 ? float(overlapSum / double(numInnerNodes)) : 0.0f;
+    return result;
+}
+
+/**
+ * Dump the tree as JSON. 
+ * 
+ * Inner nodes list the indices of their children, leaves the range of their primitives.
+ * 
+ * @param &stream std::ostream reference to write the statistics and the node array to
+ */
+void BoundingVolumeHierarchy::writeJson(std::ostream &stream) const
+{
+    const BvhStatistics stats = statistics();
+    const auto writeArray = [&stream](const std::vector<size_t> &values) {
+        stream << "[";
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            stream << (i > 0 ? ", " : "") << values[i];
+        }
+        stream << "]";
+    };
+    const auto writeVector = [&stream](const glm::vec3 &vector) {
+        stream << "[" << vector.x << ", " << vector.y << ", " << vector.z << "]";
+    };
+
+    stream << "{\n  \"statistics\": {\n"
+           << "    \"nodes\": " << stats.numNodes << ",\n"
+           << "    \"leaves\": " << stats.numLeaves << ",\n"
+           << "    \"references\": " << stats.numReferences << ",\n"
+           << "    \"sah_cost\": " << stats.sahCost << ",\n"
+           << "    \"average_sibling_overlap\": " << stats.averageSiblingOverlap << ",\n"
+           << "    \"leaf_size_histogram\": ";
+    writeArray(stats.leafSizeHistogram);
+    stream << ",\n    \"leaf_depth_histogram\": ";
+    writeArray(stats.leafDepthHistogram);
+    stream << "\n  },\n  \"nodes\": [\n";
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        const Node &node = nodes[i];
+        stream << "    {\"lower\": ";
+        writeVector(node.AABB.lower);
+        stream << ", \"upper\": ";
+        writeVector(node.AABB.upper);
+        stream << ", \"depth\": " << node.level;
+        if (node.isLeaf())
+        {
+            stream << ", \"first\": " << node.first << ", \"count\": " << node.count << "}";
+        }
+        else
+        {
+            stream << ", \"left\": " << node.first << ", \"right\": " << node.first + 1 << "}";
+        }
+        stream << (i + 1 < nodes.size() ? ",\n" : "\n");
+    }
+    stream << "  ]\n}\n";
+}
+
+// Layout of the files written by save() (native endianness):
+//   BvhFileHeader | Node[numNodes] | BvhPrimitive[numPrimitives]
+static constexpr char bvhFileMagic[8] = {'C', 'G', 'B', 'V', 'H', '\0', '\0', '\0'};
+static constexpr uint32_t bvhFileVersion = 1;
+
+struct BvhFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t padding;
+    uint64_t key;
+    uint64_t numNodes;
+    uint64_t numPrimitives;
+};
+
+static_assert(std::is_trivially_copyable_v<Node> && sizeof(Node) == 9 * sizeof(uint32_t));
+static_assert(std::is_trivially_copyable_v<BvhPrimitive> && sizeof(BvhPrimitive) == 2 * sizeof(uint32_t));
+
+/**
+ * Hash the scene geometry and the build settings (64-bit FNV-1a). 
+ * 
+ * @return the key under which the tree of this scene is saved
+ */
+uint64_t BoundingVolumeHierarchy::cacheKey() const
+{
+    uint64_t hash = 14695981039346656037ull;
+    const auto hashBytes = [&hash](const void *pData, size_t size) {
+        const auto *pBytes = static_cast<const unsigned char *>(pData);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= pBytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+
+    hashBytes(&bvhFileVersion, sizeof(bvhFileVersion));
+    hashBytes(&m_settings.splitMethod, sizeof(m_settings.splitMethod));
+    hashBytes(&m_settings.maxLeafPrimitives, sizeof(m_settings.maxLeafPrimitives));
+    hashBytes(&m_settings.maxDepth, sizeof(m_settings.maxDepth));
+    if (m_settings.splitMethod != BvhSplitMethod::Median)
+    {
+        hashBytes(&m_settings.traversalCost, sizeof(m_settings.traversalCost));
+        hashBytes(&m_settings.intersectionCost, sizeof(m_settings.intersectionCost));
+    }
+    if (m_settings.splitMethod == BvhSplitMethod::SpatialSah)
+    {
+        hashBytes(&m_settings.spatialSplitBudget, sizeof(m_settings.spatialSplitBudget));
+    }
+    hashBytes(&m_settings.restructureTreelets, sizeof(m_settings.restructureTreelets));
+    if (m_settings.restructureTreelets)
+    {
+        hashBytes(&m_settings.traversalCost, sizeof(m_settings.traversalCost));
+        hashBytes(&m_settings.intersectionCost, sizeof(m_settings.intersectionCost));
+    }
+    for (const Mesh &mesh : m_meshes)
+    {
+        const uint64_t sizes[2] = {mesh.positions.size(), mesh.triangles.size()};
+        hashBytes(sizes, sizeof(sizes));
+        hashBytes(mesh.positions.data(), mesh.positions.size() * sizeof(glm::vec3));
+        hashBytes(mesh.triangles.data(), mesh.triangles.size() * sizeof(Triangle));
+    }
+    return hash;
+}
+
+/**
+ * Write the tree to a file. 
+ * 
+ * The file is written next to its final location first and then renamed, so a reader never
+ * sees a partially written file. Failing to write is not fatal (e.g. a read-only directory).
+ * 
+ * @param &file path of the file to write
+ */
+void BoundingVolumeHierarchy::save(const std::filesystem::path &file) const
+{
+    BvhFileHeader header{};
+    std::memcpy(header.magic, bvhFileMagic, sizeof(bvhFileMagic));
+    header.version = bvhFileVersion;
+    header.key = cacheKey();
+    header.numNodes = nodes.size();
+    header.numPrimitives = primitives.size();
+
+    std::error_code error;
+    std::filesystem::create_directories(file.parent_path(), error);
+    std::filesystem::path tmpFile = file;
+    tmpFile += ".tmp";
+    {
+        std::ofstream stream{tmpFile, std::ios::binary};
+        stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char *>(nodes.data()), std::streamsize(nodes.size() * sizeof(Node)));
+        stream.write(reinterpret_cast<const char *>(primitives.data()), std::streamsize(primitives.size() * sizeof(BvhPrimitive)));
+        if (!stream)
+        {
+            std::cerr << "Could not write BVH file " << file << std::endl;
+            stream.close();
+            std::filesystem::remove(tmpFile, error);
+            return;
+        }
+    }
+    std::filesystem::rename(tmpFile, file, error);
+    if (error)
+    {
+        std::filesystem::remove(tmpFile, error);
+    }
+}
+
+/**
+ * Use a tree written by save() without copying it. 
+ * 
+ * @param &file path of the file to load
+ * @param key the cache key of the current scene and settings
+ * @return true if the file exists and was written for the same key, false otherwise
+ */
+bool BoundingVolumeHierarchy::loadFromFile(const std::filesystem::path &file, uint64_t key)
+{
+    std::shared_ptr<MappedFile> pMappedFile = MappedFile::open(file);
+    if (!pMappedFile)
+    {
+        return false;
+    }
+
+    const gsl::span<const std::byte> data = pMappedFile->data();
+    BvhFileHeader header;
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, bvhFileMagic, sizeof(bvhFileMagic)) != 0 || header.version != bvhFileVersion || header.key != key || header.numNodes == 0
+        || data.size() != sizeof(header) + header.numNodes * sizeof(Node) + header.numPrimitives * sizeof(BvhPrimitive))
+    {
+        return false;
+    }
 
-    // split the meshes for the 2 child nodes
-    // note: the middle element is always assigned to the left child
-    std::vector<Mesh> left(meshesCopy.begin(), meshesCopy.begin() + meshesCopy.size() / 2);
-    std::vector<Mesh> right(meshesCopy.begin() + meshesCopy.size() / 2, meshesCopy.end());
-    leftChild = left;
-    rightChild = right;
+    const std::byte *pNodes = data.data() + sizeof(header);
+    const std::byte *pPrimitives = pNodes + header.numNodes * sizeof(Node);
+    nodes = gsl::span<const Node>(reinterpret_cast<const Node *>(pNodes), header.numNodes);
+    primitives = gsl::span<const BvhPrimitive>(reinterpret_cast<const BvhPrimitive *>(pPrimitives), header.numPrimitives);
+    m_pMappedFile = std::move(pMappedFile);
+    m_builtSahCost = getSahCost(nodes, m_settings);
+    return true;
 }
 
 /**
- * Split a mesh into two meshes for a node with a single mesh. 
- *
- * When a node contains a single mesh, this mesh must be split into two new
- * meshes by sorting and splitting the meshe's triangles. 
- *
- * @param &leftChild std::vector reference of the mesh to add to the left child of this node
- * @param &rightChild std::vector reference of the mesh to add to the right child of this node
- * @param &onlyMesh Mesh reference to the parent mesh
- * @param longestAxis int determining the axis which will be split
+ * Encode a normal as two 16-bit values with the octahedral mapping. 
+ * 
+ * The unit sphere is projected onto the octahedron |x| + |y| + |z| = 1 and the lower half (z < 0) is
+ * folded over the upper half, which maps every direction onto the square [-1, 1]^2.
+ * 
+ * @param &normal the normal to encode, does not need to be normalized
+ * @return x in the lower and y in the upper 16 bits, both as signed normalized integers
  */
-void getChildMeshesOneMesh(std::vector<Mesh> &leftChild, std::vector<Mesh> &rightChild, Mesh &onlyMesh, int longestAxis)
+uint32_t encodeOctahedralNormal(const glm::vec3 &normal)
 {
-    // COPY of the triangles - we will be sorting them in sortTrianglesByCentres
-    std::vector<Triangle> triangles = onlyMesh.triangles;
-    std::vector<Vertex> &allVertices = onlyMesh.vertices;
-    sortTrianglesByCentres(triangles, onlyMesh, longestAxis);
-
-    // split the triangles for the 2 child nodes
-    // note: the middle element is always assigned to the left child
-    std::vector<Triangle> leftTriangles(triangles.begin(), triangles.begin() + triangles.size() / 2);
-    std::vector<Triangle> rightTriangles(triangles.begin() + triangles.size() / 2, triangles.end());
-
-    // create meshes from the triangles that were split and append them to the vector references
-    leftChild.push_back(Mesh{allVertices, leftTriangles, onlyMesh.material});
-    rightChild.push_back(Mesh{allVertices, rightTriangles, onlyMesh.material});
+    const float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    glm::vec2 p = sum > 0.0f ? glm::vec2(normal.x, normal.y) / sum : glm::vec2(0.0f);
+    if (normal.z < 0.0f)
+    {
+        p = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    const auto toSnorm16 = [](float value) { return uint32_t(uint16_t(int16_t(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f)))); };
+    return toSnorm16(p.x) | (toSnorm16(p.y) << 16);
 }
 
 /**
- * Give the number of levels of the bvh tree.
+ * Decode a normal encoded by encodeOctahedralNormal. 
  * 
- * @return int number of levels
+ * @param encoded the encoded normal
+ * @return the unit length normal
  */
-int BoundingVolumeHierarchy::numLevels() const
+glm::vec3 decodeOctahedralNormal(uint32_t encoded)
 {
-    int maxLevel = 0;
-    for (const Node &n : nodes) {
-        if (n.level > maxLevel) {
-            maxLevel = n.level;
-        }
+    const glm::vec2 p{float(int16_t(encoded & 0xffff)) / 32767.0f, float(int16_t(encoded >> 16)) / 32767.0f};
+    glm::vec3 normal{p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y)};
+    if (normal.z < 0.0f)
+    {
+        normal.x = (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+        normal.y = (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
     }
+    return glm::normalize(normal);
+}
 
-    return maxLevel + 1; // even with only one node at level 0 there is 1 level
+glm::vec3 QuantizedGeometry::normal(uint32_t vertex) const
+{
+    return decodeOctahedralNormal(normals[vertex]);
+}
+
+glm::uvec3 QuantizedGeometry::primitiveVertices(uint32_t primitive) const
+{
+    // The last leaf that starts at or before the primitive contains it.
+    const auto leaf = std::upper_bound(leafFirstVertex.begin(), leafFirstVertex.end(), primitive,
+                                       [](uint32_t value, const glm::uvec2 &entry) { return value < entry.x; });
+    return triangle(primitive) + std::prev(leaf)->y;
 }
 
 /**
- * Create a bounding box from meshes. 
- * 
- * Traverse all the meshes, all their triangles and the three vertices of each triangle
- * to determine the min and max values for each coordinate.
+ * Create the quantized copy of the geometry (see QuantizedGeometry). 
  * 
- * @param &meshes std::vector reference to the meshes of a node
- * @return an AABB for the inputted meshes
+ * For every leaf the vertices used by its triangles are collected (each vertex once), quantized and
+ * appended to the vertex arrays; the triangles are then stored as indices into this list.
  */
-AxisAlignedBox getBoundingBoxFromMeshes(std::vector<Mesh> &meshes)
+void BoundingVolumeHierarchy::buildQuantizedGeometry()
 {
-    // the vertex of the first triangle of the first mesh
-    float firstTriangleVertex = meshes[0].triangles[0].x;
-
-    // min and max values for each coordinate will
-    // initially be the coordinates of the first point
-    float min_x, max_x, min_y, max_y, min_z, max_z;
-    min_x = max_x = meshes[0].vertices[firstTriangleVertex].p.x;
-    min_y = max_y = meshes[0].vertices[firstTriangleVertex].p.y;
-    min_z = max_z = meshes[0].vertices[firstTriangleVertex].p.z;
+    m_quantizedGeometry = QuantizedGeometry{};
+    if (nodes.empty())
+    {
+        return;
+    }
 
-    for (Mesh &mesh : meshes)
+    QuantizedGeometry &geometry = m_quantizedGeometry;
+    const AxisAlignedBox &bounds = nodes[0].AABB;
+    const glm::vec3 extent = bounds.upper - bounds.lower;
+    geometry.origin = bounds.lower;
+    geometry.scale = extent / 65535.0f;
+    geometry.firstVertex.resize(nodes.size());
+
+    const gsl::span<const Mesh> meshes = m_meshes;
+    std::vector<glm::uvec3> triangles(primitives.size());
+    size_t maxLeafVertices = 0;
+    // Vertices of the current leaf as (mesh index << 32 | vertex index), sorted.
+    std::vector<uint64_t> leafVertices;
+    for (size_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++)
     {
-        std::vector<Triangle> &meshTriangles = mesh.triangles;
-        for (Triangle &t : meshTriangles)
+        const Node &node = nodes[nodeIndex];
+        if (!node.isLeaf())
+        {
+            continue;
+        }
+        const gsl::span<const BvhPrimitive> leafPrimitives = primitives.subspan(node.first, node.count);
+
+        leafVertices.clear();
+        for (const BvhPrimitive &primitive : leafPrimitives)
         {
-            // traverse the three vertices of a triangle
+            const Triangle &triangle = meshes[primitive.mesh].triangles[primitive.triangle];
             for (int i = 0; i < 3; i++)
             {
-                Vertex &current = mesh.vertices[(i == 0) ? t.x : ((i == 1) ? t.y : t.z)];
-                glm::vec3 &p = current.p;
-                min_x = (p.x < min_x) ? p.x : min_x;
-                min_y = (p.y < min_y) ? p.y : min_y;
-                min_z = (p.z < min_z) ? p.z : min_z;
+                leafVertices.push_back(uint64_t(primitive.mesh) << 32 | triangle[i]);
+            }
+        }
+        std::sort(leafVertices.begin(), leafVertices.end());
+        leafVertices.erase(std::unique(leafVertices.begin(), leafVertices.end()), leafVertices.end());
 
-                max_x = (p.x > max_x) ? p.x : max_x;
-                max_y = (p.y > max_y) ? p.y : max_y;
-                max_z = (p.z > max_z) ? p.z : max_z;
+        geometry.firstVertex[nodeIndex] = uint32_t(geometry.positions.size());
+        geometry.leafFirstVertex.push_back(glm::uvec2(node.first, geometry.firstVertex[nodeIndex]));
+        maxLeafVertices = std::max(maxLeafVertices, leafVertices.size());
+        for (const uint64_t vertex : leafVertices)
+        {
+            const Mesh &mesh = meshes[vertex >> 32];
+            const uint32_t index = uint32_t(vertex);
+            glm::u16vec3 quantized;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                const float relative = extent[axis] > 0.0f ? (mesh.positions[index][axis] - bounds.lower[axis]) / extent[axis] : 0.0f;
+                quantized[axis] = uint16_t(std::lround(std::clamp(relative, 0.0f, 1.0f) * 65535.0f));
             }
+            geometry.positions.push_back(quantized);
+            geometry.normals.push_back(encodeOctahedralNormal(mesh.normals[index]));
         }
-    }
-    return AxisAlignedBox{glm::vec3{min_x, min_y, min_z}, glm::vec3{max_x, max_y, max_z}};
-}
 
-/**
- * Create two subnodes for this node iff it is not a leaf.
- * 
- * The function differentiates between a node with a single mesh
- * and a node with multiple meshes to be able to split the meshes
- * and triangles accordingly.
- * 
- * @param &node Node reference to the node from which we are getting
- * AND to which we are adding the children
- */
-void BoundingVolumeHierarchy::getSubNodes(Node &node, Node &leftNode, Node &rightNode)
-{
-    // determine the longest axis by which we will be splitting
-    // by taking the bounding box from the parent node
-    glm::vec3 mins = node.AABB.lower;
-    glm::vec3 maxs = node.AABB.upper;
-    float x = maxs.x - mins.x;
-    float y = maxs.y - mins.y;
-    float z = maxs.z - mins.z;
-    int longestAxis = (x > y) ? ((x > z) ? 0 : 2) : ((y > z) ? 1 : 2);
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            const BvhPrimitive &primitive = primitives[i];
+            const Triangle &triangle = meshes[primitive.mesh].triangles[primitive.triangle];
+            for (int j = 0; j < 3; j++)
+            {
+                const auto it = std::lower_bound(leafVertices.begin(), leafVertices.end(), uint64_t(primitive.mesh) << 32 | triangle[j]);
+                triangles[i][j] = uint32_t(it - leafVertices.begin());
+            }
+        }
+    }
 
-    // Create the fields that will be passed by reference to
-    // and modified by other functions
-    std::vector<Mesh> leftChild, rightChild;
-    AxisAlignedBox AABB_left, AABB_right;
+    std::sort(geometry.leafFirstVertex.begin(), geometry.leafFirstVertex.end(),
+              [](const glm::uvec2 &lhs, const glm::uvec2 &rhs) { return lhs.x < rhs.x; });
 
-    if (node.meshes.size() > 1)
+    if (maxLeafVertices > 65536)
     {
-        //std::cout << node.meshes.size() << std::endl;
-
-        // divide the meshes into groups
-        //std::cout << node.meshes.size() << std::endl;
-        //std::cout << right.size() << " " << rightChild.size() << std::endl;
-
-        // leftChild and rightChild are passed by reference
-        getChildMeshesMultipleMeshes(leftChild, rightChild, node.meshes, longestAxis);
-        //std::cout << node.meshes.size() << " " << leftChild.size() << " " << rightChild.size() << std::endl;
+        geometry.triangles32 = std::move(triangles);
     }
     else
     {
-        //std::cout << "hi " << std::endl;
-
-        // leftChild, rightChild and onlyMesh are all passed by reference
-        Mesh onlyMesh = node.meshes[0];
-        getChildMeshesOneMesh(leftChild, rightChild, onlyMesh, longestAxis);
+        geometry.triangles16.reserve(triangles.size());
+        for (const glm::uvec3 &triangle : triangles)
+        {
+            geometry.triangles16.push_back(glm::u16vec3(triangle));
+        }
     }
 
-    AABB_left = getBoundingBoxFromMeshes(leftChild);
-    AABB_right = getBoundingBoxFromMeshes(rightChild);
-
-    bool areLeaf = (node.level + 1 == maxDepth - 1);
-    bool leftIsLeaf = areLeaf || (leftChild.size() == 1 && leftChild[0].triangles.size() == 1);
-    bool rightIsLeaf = areLeaf || (rightChild.size() == 1 && rightChild[0].triangles.size() == 1);
-
-    leftNode = Node{leftIsLeaf, node.level + 1, AABB_left, {}, leftChild};
-    rightNode = Node{rightIsLeaf, node.level + 1, AABB_right, {}, rightChild};
-
-    //std::vector<Node> children;
-    //children.push_back(Node{leftIsLeaf, node.level + 1, AABB_left, {}, leftChild});
-    //children.push_back(Node{rightIsLeaf, node.level + 1, AABB_right, {}, rightChild});
-    //node.subTree = children;
+    // Padding every box (not only the leaves) by the same amount keeps the children inside their parents.
+    const glm::vec3 padding = 0.5f * geometry.scale;
+    geometry.nodes.assign(nodes.begin(), nodes.end());
+    for (Node &node : geometry.nodes)
+    {
+        node.AABB.lower -= padding;
+        node.AABB.upper += padding;
+    }
 }
 
-/**
- * Recursive function creating the whole tree. 
- * 
- * In one call, the function will add the node to the vector of nodes
- * belonging to this class, get the subnodes of this node and call itself
- * for the two children created (iff it is not a leaf) 
- * --> in the foreach loop, the node must be a reference!!
- * 
- * @param &node Node reference to a node from an incomplete tree
- */
-void BoundingVolumeHierarchy::createTree(Node root)
+gsl::span<const Node> BoundingVolumeHierarchy::traversalNodes() const
 {
-    Node currentNode = root;
-    nodes.push_back(root);
-    int currentIndex = 0;
-
-    // stop once we reach the end of the std::vector and the node is a leaf
-    while (!((nodes.size() == currentIndex + 1) && currentNode.isLeaf))
+    if (m_geometryFormat == GeometryFormat::Quantized)
     {
-        if (!currentNode.isLeaf)
-        {
-            Node leftNode;
-            Node rightNode;
-            getSubNodes(currentNode, leftNode, rightNode);
-
-            int lastIndex = nodes.size();
-            nodes[currentIndex].indices.push_back(lastIndex);
-            lastIndex++;
-            nodes[currentIndex].indices.push_back(lastIndex);
-
-            nodes.push_back(leftNode);
-            nodes.push_back(rightNode);
-
-            //std::cout << "current level: " << currentNode.level
-            //          << ", left child's level: " << nodes[nodes[currentIndex].indices[0]].level
-            //          << ", right child's level: " << nodes[nodes[currentIndex].indices[1]].level << std::endl;
-        }
-        currentIndex++;
-        currentNode = nodes[currentIndex];
+        return m_quantizedGeometry.nodes;
     }
+    return nodes;
+}
 
-    //// ending condition is when the node is leaf.
-    //if (node.isLeaf)
-    //{
-    //    //setTriangleIndices(node);
-    //    return;
-    //}
-    //else
-    //{
-    //    Node leftNode, rightNode;
-    //    getSubNodes(nodes, currentIndex, leftNode, rightNode);
-
-    //    // make the recursive call
-    //    createTree(leftNode);
-    //    createTree(rightNode);
-    //}
+void BoundingVolumeHierarchy::setGeometryFormat(GeometryFormat format)
+{
+    if (format == GeometryFormat::Quantized && m_quantizedGeometry.firstVertex.size() != nodes.size())
+    {
+        buildQuantizedGeometry();
+    }
+    m_geometryFormat = format;
+    for (BoundingVolumeHierarchy &meshHierarchy : m_meshHierarchies)
+    {
+        meshHierarchy.setGeometryFormat(format);
+    }
 }
 
-Node BoundingVolumeHierarchy::getLeftChild(Node &node)
+const BvhBuildStatistics &BoundingVolumeHierarchy::buildStatistics() const
 {
-    return Node();
+    return m_buildStatistics;
 }
 
-Node BoundingVolumeHierarchy::getRightChild(Node &node)
+GeometryFormat BoundingVolumeHierarchy::geometryFormat() const
 {
-    return Node();
+    return m_geometryFormat;
 }
 
-void BoundingVolumeHierarchy::setTriangleIndices(Node &node)
+size_t BoundingVolumeHierarchy::geometryBytes() const
 {
+    size_t bytes = primitives.size_bytes();
+    if (m_geometryFormat == GeometryFormat::Quantized)
+    {
+        const QuantizedGeometry &geometry = m_quantizedGeometry;
+        bytes += geometry.firstVertex.size() * sizeof(uint32_t) + geometry.leafFirstVertex.size() * sizeof(glm::uvec2) + geometry.positions.size() * sizeof(glm::u16vec3) + geometry.normals.size() * sizeof(uint32_t) +
+                 geometry.triangles16.size() * sizeof(glm::u16vec3) + geometry.triangles32.size() * sizeof(glm::uvec3);
+    }
+    else
+    {
+        for (const Mesh &mesh : m_meshes)
+        {
+            bytes += (mesh.positions.size() + mesh.normals.size()) * sizeof(glm::vec3) + mesh.triangles.size() * sizeof(Triangle);
+        }
+    }
+    // Every instanced mesh is only stored once, however many instances there are.
+    for (const BoundingVolumeHierarchy &meshHierarchy : m_meshHierarchies)
+    {
+        bytes += meshHierarchy.geometryBytes();
+    }
+    bytes += m_instances.size() * sizeof(BvhInstance) + m_instanceOrder.size() * sizeof(uint32_t);
+    return bytes;
 }
 
 /**
@@ -413,17 +1983,14 @@ void BoundingVolumeHierarchy::setTriangleIndices(Node &node)
 AxisAlignedBox getRootBoundingBox(std::vector<Mesh> &meshes)
 {
     float min_x, max_x, min_y, max_y, min_z, max_z;
-    min_x = max_x = meshes[0].vertices[0].p.x;
-    min_y = max_y = meshes[0].vertices[0].p.y;
-    min_z = max_z = meshes[0].vertices[0].p.z;
+    min_x = max_x = meshes[0].positions[0].x;
+    min_y = max_y = meshes[0].positions[0].y;
+    min_z = max_z = meshes[0].positions[0].z;
 
     for (Mesh &mesh : meshes)
     {
-        std::vector<Vertex> &vertices = mesh.vertices;
-
-        for (Vertex &vertex : vertices)
+        for (const glm::vec3 &p : mesh.positions)
         {
-            glm::vec3 &p = vertex.p;
             min_x = (p.x < min_x) ? p.x : min_x;
             min_y = (p.y < min_y) ? p.y : min_y;
             min_z = (p.z < min_z) ? p.z : min_z;
@@ -437,30 +2004,28 @@ AxisAlignedBox getRootBoundingBox(std::vector<Mesh> &meshes)
 }
 
 /**
- * !Not used and probably not working! Recursively get all bounding boxes at a certain level (e.g. 0 = only the root AABB). 
+ * Recursively get all nodes at a certain level (e.g. 0 = only the root). 
  * 
- * Breadth-first search through a tree.
+ * Depth-first search through a tree.
  * 
  * @param &node Node reference to a node in the tree
- * @param &result std::vector reference to the resulting vector of AABBs
+ * @param &result std::vector reference to the resulting vector of nodes
  * @param level int of the level we want to retrieve
  */
-void BoundingVolumeHierarchy::getNodesAtLevel(Node &node, std::vector<Node> &result, int level)
+void BoundingVolumeHierarchy::getNodesAtLevel(const Node &node, std::vector<Node> &result, int level) const
 {
     if (node.level == level)
     {
         result.push_back(node);
         return;
     }
-    if (node.isLeaf)
+    if (node.isLeaf())
     {
         return;
     }
 
-    for (int &childIndex : node.indices)
-    {
-        getNodesAtLevel(nodes[childIndex], result, level);
-    }
+    getNodesAtLevel(nodes[node.first], result, level);
+    getNodesAtLevel(nodes[node.first + 1], result, level);
 }
 
 // Use this function to visualize your BVH. This can be useful for debugging. Use the functions in
@@ -479,13 +2044,18 @@ void BoundingVolumeHierarchy::debugDraw(int level)
     glm::vec3 green = glm::vec3(0.05f, 1.0f, 0.05f);
     glm::vec3 blue = glm::vec3(0.05f, 0.05f, 1.0f);
 
+    if (nodes.empty())
+    {
+        return;
+    }
+
     std::vector<Node> result;
-    Node &root = nodes[0];
+    const Node &root = nodes[0];
     getNodesAtLevel(root, result, level);
 
     for (Node n : result)
     {
-        if (n.isLeaf)
+        if (n.isLeaf())
         {
             drawAABB(n.AABB, DrawMode::Filled, blue, 0.8f);
         }
@@ -530,24 +2100,49 @@ void BoundingVolumeHierarchy::debugDraw(int level)
  * @param &ray reference to the currently shot ray
  * @param &hitInfo reference to HitInfo
  * @param &current reference to the node we are currently at
+ * @param &context the nodes, primitives and meshes of the bvh and the optional TraversalCost to update
  * @return intersected bool stating whether some triangle was intersected or not
  */
-bool intersectLeaf(Ray &ray, HitInfo &hitInfo, const Node &current)
+bool intersectLeaf(Ray &ray, HitInfo &hitInfo, const Node &current, const TraversalContext &context)
 {
     bool hit = false;
-    for (const auto &mesh : current.meshes)
+    if (context.pQuantized)
     {
-        for (const auto &tri : mesh.triangles)
+        // Decode the positions of the leaf's own vertex list.
+        const QuantizedGeometry &geometry = *context.pQuantized;
+        const uint32_t firstVertex = geometry.firstVertex[size_t(&current - context.nodes.data())];
+        for (uint32_t i = current.first; i < current.first + current.count; i++)
         {
-            const auto& v0 = mesh.vertices[tri[0]];
-            const auto& v1 = mesh.vertices[tri[1]];
-            const auto& v2 = mesh.vertices[tri[2]];
-            if (intersectRayWithTriangle(v0.p, v1.p, v2.p, ray, hitInfo, v0.n, v1.n, v2.n))
+            const glm::uvec3 tri = geometry.triangle(i) + firstVertex;
+            RAY_STATS_COUNT(TriangleTests);
+            if (context.pCost)
+                context.pCost->trianglesTested++;
+            if (intersectRayWithTriangle(geometry.position(tri[0]), geometry.position(tri[1]), geometry.position(tri[2]), ray, hitInfo.barycentric))
             {
-                hitInfo.material = mesh.material;
+                hitInfo.t = ray.t;
+                hitInfo.primitive = i;
+                hitInfo.instance = HitInfo::noInstance;
                 hit = true;
             }
         }
+        return hit;
+    }
+
+    for (uint32_t i = current.first; i < current.first + current.count; i++)
+    {
+        const BvhPrimitive &primitive = context.primitives[i];
+        const Mesh &mesh = context.meshes[primitive.mesh];
+        const Triangle &tri = mesh.triangles[primitive.triangle];
+        RAY_STATS_COUNT(TriangleTests);
+        if (context.pCost)
+            context.pCost->trianglesTested++;
+        if (intersectRayWithTriangle(mesh.positions[tri[0]], mesh.positions[tri[1]], mesh.positions[tri[2]], ray, hitInfo.barycentric))
+        {
+            hitInfo.t = ray.t;
+            hitInfo.primitive = i;
+            hitInfo.instance = HitInfo::noInstance;
+            hit = true;
+        }
     }
     return hit;
 }
@@ -570,8 +2165,8 @@ bool boxesOverlap(const AxisAlignedBox &box1, const AxisAlignedBox &box2)
 }
 
 bool intersectChildrenHierarchically(Ray& ray, HitInfo& hitInfo, const Node& firstIntersectedChild,
-    const Node& secondIntersectedChild, float &tFirst, float &tSecond, const std::vector<Node>& nodes) {
-    bool hitFirst = intersectRecursive(ray, hitInfo, firstIntersectedChild, nodes);
+    const Node& secondIntersectedChild, float &tFirst, float &tSecond, const TraversalContext &context) {
+    bool hitFirst = intersectRecursive(ray, hitInfo, firstIntersectedChild, context);
 
     if (tSecond < 0) { // we didn't intersect the second box at all - we can only intersect triangles in the first box
         return hitFirst;
@@ -585,12 +2180,12 @@ bool intersectChildrenHierarchically(Ray& ray, HitInfo& hitInfo, const Node& fir
         }
         else // the ray hit a triangle after touching the right box - we must also check the right box
         {
-            return hitFirst | intersectRecursive(ray, hitInfo, secondIntersectedChild, nodes); // NOT a conditional or!!!
+            return hitFirst | intersectRecursive(ray, hitInfo, secondIntersectedChild, context); // NOT a conditional or!!!
         }
     }
     else
     { // we can only intersect something in the second box that was intersected
-        return intersectRecursive(ray, hitInfo, secondIntersectedChild, nodes);
+        return intersectRecursive(ray, hitInfo, secondIntersectedChild, context);
     }
 }
 
@@ -609,7 +2204,7 @@ bool intersectChildrenHierarchically(Ray& ray, HitInfo& hitInfo, const Node& fir
  * @return true if the ray intersected some triangle, false otherwise
  */
 bool intersectRayThatStartsOutsideBoxes(Ray &ray, HitInfo &hitInfo,
-                                        const Node &leftChild, const Node &rightChild, float &tLeft, float &tRight, const std::vector<Node> &nodes)
+                                        const Node &leftChild, const Node &rightChild, float &tLeft, float &tRight, const TraversalContext &context)
 {
     if (tLeft < 0 && tRight < 0)
     { // neither of the children was intersected
@@ -617,19 +2212,19 @@ bool intersectRayThatStartsOutsideBoxes(Ray &ray, HitInfo &hitInfo,
     }
     else if (tLeft < 0)
     { // only the right child was intersected
-        return intersectRecursive(ray, hitInfo, rightChild, nodes);
+        return intersectRecursive(ray, hitInfo, rightChild, context);
     }
     else if (tRight < 0)
     { // only the left child was intersected
-        return intersectRecursive(ray, hitInfo, leftChild, nodes);
+        return intersectRecursive(ray, hitInfo, leftChild, context);
     }
     else
     { // both boxes were intersected
         if (tLeft < tRight) {
-            intersectChildrenHierarchically(ray, hitInfo, leftChild, rightChild, tLeft, tRight, nodes);
+            return intersectChildrenHierarchically(ray, hitInfo, leftChild, rightChild, tLeft, tRight, context);
         }
         else {
-            intersectChildrenHierarchically(ray, hitInfo, rightChild, leftChild, tRight, tLeft, nodes);
+            return intersectChildrenHierarchically(ray, hitInfo, rightChild, leftChild, tRight, tLeft, context);
         }
     }
 }
@@ -677,26 +2272,26 @@ bool startsInBox(Ray &ray, const AxisAlignedBox &box)
  * @return true if the ray intersected some triangle, false otherwise
  */
 bool intersectDeeper(Ray &ray, HitInfo &hitInfo,
-                     const Node &leftChild, const Node &rightChild, float &tLeft, float &tRight, const std::vector<Node> &nodes)
+                     const Node &leftChild, const Node &rightChild, float &tLeft, float &tRight, const TraversalContext &context)
 {
     bool rayInLeftBox = startsInBox(ray, leftChild.AABB);
     bool rayInRightBox = startsInBox(ray, rightChild.AABB);
 
     if (rayInLeftBox && rayInRightBox)
     { // the ray is inside both boxes (they overlap)
-        return intersectRecursive(ray, hitInfo, leftChild, nodes) | intersectRecursive(ray, hitInfo, rightChild, nodes);
+        return intersectRecursive(ray, hitInfo, leftChild, context) | intersectRecursive(ray, hitInfo, rightChild, context);
     }
     else if (rayInLeftBox)
     { // the ray is only inside the left box
-        return intersectChildrenHierarchically(ray, hitInfo, leftChild, rightChild, tLeft, tRight, nodes);
+        return intersectChildrenHierarchically(ray, hitInfo, leftChild, rightChild, tLeft, tRight, context);
     }
     else if (rayInRightBox)
     { // the ray is only inside the right box
-        return intersectChildrenHierarchically(ray, hitInfo, rightChild, leftChild, tRight, tLeft, nodes);
+        return intersectChildrenHierarchically(ray, hitInfo, rightChild, leftChild, tRight, tLeft, context);
     }
     else
     {
-        return intersectRayThatStartsOutsideBoxes(ray, hitInfo, leftChild, rightChild, tLeft, tRight, nodes);
+        return intersectRayThatStartsOutsideBoxes(ray, hitInfo, leftChild, rightChild, tLeft, tRight, context);
     }
 }
 
@@ -712,12 +2307,13 @@ bool intersectDeeper(Ray &ray, HitInfo &hitInfo,
  * 
  * @return true if the ray intersected a triangle in any of the children, false otherwise
  */
-bool intersectNonLeaf(Ray &ray, HitInfo &hitInfo, const Node &current, const std::vector<Node> &nodes)
+bool intersectNonLeaf(Ray &ray, HitInfo &hitInfo, const Node &current, const TraversalContext &context)
 {
     float originalT = ray.t; // CANNOT be a reference!!
+    RAY_STATS_ADD(BoxTests, 2);
 
     float tLeft = -1.0f;
-    const Node &leftChild = nodes[current.indices[0]];
+    const Node &leftChild = context.nodes[current.first];
     if (intersectRayWithShape(leftChild.AABB, ray))
     { // intersecting to get the ray length
         tLeft = ray.t;
@@ -725,14 +2321,14 @@ bool intersectNonLeaf(Ray &ray, HitInfo &hitInfo, const Node &current, const std
     }
 
     float tRight = -1.0f;
-    const Node &rightChild = nodes[current.indices[1]];
+    const Node &rightChild = context.nodes[current.first + 1];
     if (intersectRayWithShape(rightChild.AABB, ray))
     { // intersecting to get the ray length
         tRight = ray.t;
         ray.t = originalT;
     }
 
-    return intersectDeeper(ray, hitInfo, leftChild, rightChild, tLeft, tRight, nodes);
+    return intersectDeeper(ray, hitInfo, leftChild, rightChild, tLeft, tRight, context);
 }
 
 /**
@@ -745,16 +2341,18 @@ bool intersectNonLeaf(Ray &ray, HitInfo &hitInfo, const Node &current, const std
  * @param &current reference to the node we are currently at
  * @return intersected bool stating whether some triangle was intersected or not
  */
-bool intersectRecursive(Ray &ray, HitInfo &hitInfo, const Node &current, const std::vector<Node> &nodes)
+bool intersectRecursive(Ray &ray, HitInfo &hitInfo, const Node &current, const TraversalContext &context)
 {
     AxisAlignedBox AABB = current.AABB;
+    if (context.pCost)
+        context.pCost->nodesVisited++;
 
-    if (current.isLeaf)
+    if (current.isLeaf())
     {
-        return intersectLeaf(ray, hitInfo, current);
+        return intersectLeaf(ray, hitInfo, current, context);
     }
 
-    return intersectNonLeaf(ray, hitInfo, current, nodes);
+    return intersectNonLeaf(ray, hitInfo, current, context);
 }
 
 //bool intersectLevel(Ray& ray, HitInfo &hitInfo, const Node& current, int level) {
@@ -828,15 +2426,16 @@ bool intersectRecursive(Ray &ray, HitInfo &hitInfo, const Node &current, const s
  * @param &root Node reference to the root node
  * @return intersected bool stating whether the root AABB was intersected or not
  */
-bool intersectDataStructure(Ray &ray, HitInfo &hitInfo, const Node &root, const std::vector<Node> &nodes)
+bool intersectDataStructure(Ray &ray, HitInfo &hitInfo, const Node &root, const TraversalContext &context)
 {
     AxisAlignedBox AABB = root.AABB;
 
     float originalT = ray.t; // CANNOT be a reference
+    RAY_STATS_COUNT(BoxTests);
     if (startsInBox(ray, AABB) || intersectRayWithShape(AABB, ray))
     {
         ray.t = originalT;
-        bool hit = intersectRecursive(ray, hitInfo, root, nodes);
+        bool hit = intersectRecursive(ray, hitInfo, root, context);
         return hit;
     }
 
@@ -848,6 +2447,11 @@ bool intersectDataStructure(Ray &ray, HitInfo &hitInfo, const Node &root, const
 // by a bounding volume hierarchy acceleration structure as described in the assignment. You can change any
 // file you like, including bounding_volume_hierarchy.h .
 bool BoundingVolumeHierarchy::intersect(Ray &ray, HitInfo &hitInfo) const
+{
+    return intersect(ray, hitInfo, nullptr);
+}
+
+bool BoundingVolumeHierarchy::intersect(Ray &ray, HitInfo &hitInfo, TraversalCost *pCost) const
 {
     // THE BVH DATA STRUCTURE HAS BEEN TESTED TO BE CORRECT
     bool hit = false;
@@ -867,19 +2471,404 @@ bool BoundingVolumeHierarchy::intersect(Ray &ray, HitInfo &hitInfo) const
     //    }
     //}
     // Intersect with spheres.
-    if (!m_pScene->meshes.empty())
+    if (!nodes.empty())
     {
         //std::cout << "Intersecting, nodes size: " << nodes.size() << std::endl;
-        const Node &root = nodes[0];
-        hit = intersectDataStructure(ray, hitInfo, root, nodes);
+        const bool quantized = m_geometryFormat == GeometryFormat::Quantized;
+        const TraversalContext context{traversalNodes(), primitives, m_meshes, quantized ? &m_quantizedGeometry : nullptr, pCost};
+        const Node &root = context.nodes[0];
+        hit = intersectDataStructure(ray, hitInfo, root, context);
     }
     //hit = intersectLevel(ray, hitInfo, root, 7);
     //hit = intersectDirty(ray, hitInfo, root);
-    for (const auto &sphere : m_pScene->spheres)
-        hit |= intersectRayWithShape(sphere, ray, hitInfo);
+    hit |= intersectSpheresAndInstances(ray, hitInfo, pCost);
+    return hit;
+}
+
+/**
+ * Intersect the ray with the spheres and the instances of the scene (everything but the tree over the meshes). 
+ * 
+ * @param &ray Ray reference to the currently shot ray
+ * @param &hitInfo HitInfo reference of the current ray
+ * @param *pCost optional TraversalCost to update
+ * @return intersected bool stating whether a sphere or instance was hit closer than ray.t
+ */
+bool BoundingVolumeHierarchy::intersectSpheresAndInstances(Ray &ray, HitInfo &hitInfo, TraversalCost *pCost) const
+{
+    bool hit = false;
+    RAY_STATS_ADD(SphereTests, m_spheres.size());
+    if (pCost)
+        pCost->spheresTested += int(m_spheres.size());
+    for (uint32_t i = 0; i < m_spheres.size(); i++)
+    {
+        if (intersectRayWithShape(m_spheres[i], ray, hitInfo))
+        {
+            hitInfo.primitive = HitInfo::sphereFlag | i;
+            hitInfo.instance = HitInfo::noInstance;
+            hit = true;
+        }
+    }
+    if (!m_instanceNodes.empty())
+    {
+        hit |= intersectInstances(ray, hitInfo, pCost);
+    }
+    return hit;
+}
+
+/**
+ * Ray in the object space of an instance. 
+ * 
+ * The direction is not normalized, so that a t along it is the same as the t along the world space ray.
+ * 
+ * @param &ray Ray in world space
+ * @param &instance BvhInstance to transform the ray to
+ * @return objectRay Ray in the object space of the instance
+ */
+static Ray toObjectSpace(const Ray &ray, const BvhInstance &instance)
+{
+    return Ray{glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.0f)), glm::mat3(instance.worldToObject) * ray.direction, ray.t};
+}
+
+/**
+ * Intersect the ray with the instances, using the top-level tree over their world space boxes. 
+ * 
+ * In the leaves the ray is transformed to the object space of every instance and traced through the
+ * hierarchy of its mesh. The closer child is visited first and nodes further than the closest hit are skipped.
+ * 
+ * @param &ray Ray reference to the currently shot ray
+ * @param &hitInfo HitInfo reference of the current ray
+ * @param *pCost optional TraversalCost to update
+ * @return intersected bool stating whether some instance was hit closer than ray.t
+ */
+bool BoundingVolumeHierarchy::intersectInstances(Ray &ray, HitInfo &hitInfo, TraversalCost *pCost) const
+{
+    // Returns the distance to the box (0 if the ray starts in it), or -1 if it is missed or further than ray.t.
+    const auto boxDistance = [&](const AxisAlignedBox &box) {
+        RAY_STATS_COUNT(BoxTests);
+        if (pCost)
+            pCost->nodesVisited++;
+        Ray boxRay = ray;
+        if (startsInBox(boxRay, box))
+            return 0.0f;
+        return intersectRayWithShape(box, boxRay) ? boxRay.t : -1.0f;
+    };
+
+    bool hit = false;
+    if (boxDistance(m_instanceNodes[0].AABB) < 0.0f)
+    {
+        return false;
+    }
+    std::vector<std::pair<uint32_t, float>> stack{{0u, 0.0f}};
+    while (!stack.empty())
+    {
+        const auto [nodeIndex, distance] = stack.back();
+        stack.pop_back();
+        if (distance > ray.t)
+        {
+            continue;
+        }
+
+        const Node &node = m_instanceNodes[nodeIndex];
+        if (node.isLeaf())
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                const uint32_t instanceIndex = m_instanceOrder[i];
+                const BvhInstance &instance = m_instances[instanceIndex];
+                Ray objectRay = toObjectSpace(ray, instance);
+                if (m_meshHierarchies[instance.mesh].intersect(objectRay, hitInfo, pCost))
+                {
+                    ray.t = objectRay.t;
+                    hitInfo.instance = instanceIndex;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        const float leftDistance = boxDistance(m_instanceNodes[node.first].AABB);
+        const float rightDistance = boxDistance(m_instanceNodes[node.first + 1].AABB);
+        // push the further child first, so that the closer one is visited first
+        if (leftDistance >= 0.0f && rightDistance >= 0.0f && leftDistance < rightDistance)
+        {
+            stack.emplace_back(node.first + 1, rightDistance);
+            stack.emplace_back(node.first, leftDistance);
+            continue;
+        }
+        if (leftDistance >= 0.0f)
+        {
+            stack.emplace_back(node.first, leftDistance);
+        }
+        if (rightDistance >= 0.0f)
+        {
+            stack.emplace_back(node.first + 1, rightDistance);
+        }
+    }
     return hit;
 }
 
+// The exit distance of a ray is scaled up a little in the packet box tests, so that rounding never culls a box
+// that the single ray traversal would enter.
+static constexpr float packetBoxSlack = 1.0f + 1e-5f;
+
+/**
+ * The rays of a packet in structure of arrays layout, so that the loops over the rays of a packet can
+ * use one SIMD lane per ray. The directions are stored as their reciprocals for the slab tests.
+ */
+struct PacketRays
+{
+    std::array<float, maxRayPacketSize> originX;
+    std::array<float, maxRayPacketSize> originY;
+    std::array<float, maxRayPacketSize> originZ;
+    std::array<float, maxRayPacketSize> inverseDirectionX;
+    std::array<float, maxRayPacketSize> inverseDirectionY;
+    std::array<float, maxRayPacketSize> inverseDirectionZ;
+    std::array<float, maxRayPacketSize> t;
+    size_t count;
+    // Bounds of the origins and the reciprocal directions over the whole packet (for packetMayHitBox).
+    glm::vec3 originLower;
+    glm::vec3 originUpper;
+    glm::vec3 inverseDirectionLower;
+    glm::vec3 inverseDirectionUpper;
+};
+
+/**
+ * Slab test of a box against a range of the rays of a packet. 
+ * 
+ * @param &packet PacketRays reference to the rays
+ * @param &box AxisAlignedBox reference to the box
+ * @param begin index of the first ray to test
+ * @param end index after the last ray to test
+ * @return bit mask of the rays that enter the box closer than their current t
+ */
+static uint64_t packetBoxMask(const PacketRays &packet, const AxisAlignedBox &box, size_t begin, size_t end)
+{
+    uint64_t mask = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        const float tX0 = (box.lower.x - packet.originX[i]) * packet.inverseDirectionX[i];
+        const float tX1 = (box.upper.x - packet.originX[i]) * packet.inverseDirectionX[i];
+        const float tY0 = (box.lower.y - packet.originY[i]) * packet.inverseDirectionY[i];
+        const float tY1 = (box.upper.y - packet.originY[i]) * packet.inverseDirectionY[i];
+        const float tZ0 = (box.lower.z - packet.originZ[i]) * packet.inverseDirectionZ[i];
+        const float tZ1 = (box.upper.z - packet.originZ[i]) * packet.inverseDirectionZ[i];
+        const float tIn = std::max(std::max(std::min(tX0, tX1), std::min(tY0, tY1)), std::max(std::min(tZ0, tZ1), 0.0f));
+        const float tOut = std::min(std::min(std::max(tX0, tX1), std::max(tY0, tY1)), std::max(tZ0, tZ1));
+        mask |= uint64_t(tIn <= tOut * packetBoxSlack && tIn < packet.t[i]) << i;
+    }
+    return mask;
+}
+
+/**
+ * Interval arithmetic test of a box against a whole packet. 
+ * 
+ * The directions of all rays of the packet lie in the same octant, so they all enter the slab of an axis
+ * through the same plane. With the bounds of the origins and reciprocal directions over the packet this
+ * gives a lower bound of the entry distance and an upper bound of the exit distance of every ray. If the
+ * bounds do not overlap, no ray of the packet hits the box.
+ * 
+ * @param &packet PacketRays reference to the rays
+ * @param &box AxisAlignedBox reference to the box
+ * @param maxT largest t of the rays of the packet that are still tested
+ * @return false if no ray of the packet can hit the box closer than maxT
+ */
+static bool packetMayHitBox(const PacketRays &packet, const AxisAlignedBox &box, float maxT)
+{
+    float tIn = 0.0f;
+    float tOut = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const bool positive = packet.inverseDirectionLower[axis] > 0.0f;
+        const float nearPlane = positive ? box.lower[axis] : box.upper[axis];
+        const float farPlane = positive ? box.upper[axis] : box.lower[axis];
+        const float inverseLower = packet.inverseDirectionLower[axis];
+        const float inverseUpper = packet.inverseDirectionUpper[axis];
+        // (plane - origin) * inverse direction takes its extremes at the corners of the two intervals
+        const float nearLower = nearPlane - packet.originUpper[axis];
+        const float nearUpper = nearPlane - packet.originLower[axis];
+        const float farLower = farPlane - packet.originUpper[axis];
+        const float farUpper = farPlane - packet.originLower[axis];
+        tIn = std::max(tIn, std::min(std::min(nearLower * inverseLower, nearLower * inverseUpper), std::min(nearUpper * inverseLower, nearUpper * inverseUpper)));
+        tOut = std::min(tOut, std::max(std::max(farLower * inverseLower, farLower * inverseUpper), std::max(farUpper * inverseLower, farUpper * inverseUpper)));
+    }
+    return tIn <= tOut * packetBoxSlack && tIn < maxT;
+}
+
+/**
+ * Intersect a packet of rays with the tree over the scene meshes, then every ray with the spheres and instances. 
+ * 
+ * The packet is traversed with the index of its first active ray: a node is entered if that ray hits its
+ * box. If it misses, the interval arithmetic test of packetMayHitBox culls the node for the whole packet
+ * at once, and only if that fails the other rays are tested one by one (in SIMD friendly loops) to find the
+ * new first active ray. In a leaf the rays that hit its box are tested against its primitives. A subtree
+ * in which only the last ray of the packet is still active is finished with the single ray traversal, and
+ * packets whose directions do not lie in one octant (e.g. reflected rays) are traced ray by ray.
+ * 
+ * @param rays span of at most maxRayPacketSize rays, their t is updated like by intersect()
+ * @param hitInfos span of the HitInfo of every ray
+ * @param *pCost optional TraversalCost to update; the nodes visited by the packet are counted once
+ * @return bit mask of the rays that hit something closer than their t
+ */
+uint64_t BoundingVolumeHierarchy::intersectPacket(gsl::span<Ray> rays, gsl::span<HitInfo> hitInfos, TraversalCost *pCost) const
+{
+    if (rays.size() > maxRayPacketSize || hitInfos.size() != rays.size())
+    {
+        std::cerr << "A ray packet has at most " << maxRayPacketSize << " rays and a HitInfo for every ray" << std::endl;
+        throw std::exception();
+    }
+
+    uint64_t hits = 0;
+    bool sameOctant = true;
+    for (const Ray &ray : rays)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sameOctant &= std::signbit(ray.direction[axis]) == std::signbit(rays[0].direction[axis]);
+        }
+    }
+    if (!sameOctant || nodes.empty())
+    {
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            hits |= uint64_t(intersect(rays[i], hitInfos[i], pCost)) << i;
+        }
+        return hits;
+    }
+
+    PacketRays packet;
+    packet.count = rays.size();
+    packet.originLower = packet.originUpper = rays[0].origin;
+    packet.inverseDirectionLower = glm::vec3(std::numeric_limits<float>::max());
+    packet.inverseDirectionUpper = glm::vec3(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        // a zero component becomes a huge value of the same sign instead of an infinity, which would give NaNs
+        glm::vec3 inverseDirection;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float direction = rays[i].direction[axis];
+            inverseDirection[axis] = direction == 0.0f ? std::copysign(1e30f, direction) : 1.0f / direction;
+        }
+        packet.originX[i] = rays[i].origin.x;
+        packet.originY[i] = rays[i].origin.y;
+        packet.originZ[i] = rays[i].origin.z;
+        packet.inverseDirectionX[i] = inverseDirection.x;
+        packet.inverseDirectionY[i] = inverseDirection.y;
+        packet.inverseDirectionZ[i] = inverseDirection.z;
+        packet.t[i] = rays[i].t;
+        packet.originLower = glm::min(packet.originLower, rays[i].origin);
+        packet.originUpper = glm::max(packet.originUpper, rays[i].origin);
+        packet.inverseDirectionLower = glm::min(packet.inverseDirectionLower, inverseDirection);
+        packet.inverseDirectionUpper = glm::max(packet.inverseDirectionUpper, inverseDirection);
+    }
+
+    const bool quantized = m_geometryFormat == GeometryFormat::Quantized;
+    const gsl::span<const Node> packetNodes = traversalNodes();
+    const TraversalContext context{packetNodes, primitives, m_meshes, quantized ? &m_quantizedGeometry : nullptr, pCost};
+    // (node, first active ray) pairs
+    std::vector<std::pair<uint32_t, size_t>> stack{{0u, 0}};
+    while (!stack.empty())
+    {
+        auto [nodeIndex, first] = stack.back();
+        stack.pop_back();
+        const Node &node = packetNodes[nodeIndex];
+        if (pCost)
+            pCost->nodesVisited++;
+
+        RAY_STATS_COUNT(BoxTests);
+        if (packetBoxMask(packet, node.AABB, first, first + 1) == 0)
+        {
+            float maxT = 0.0f;
+            for (size_t i = first + 1; i < packet.count; i++)
+            {
+                maxT = std::max(maxT, packet.t[i]);
+            }
+            if (first + 1 == packet.count || !packetMayHitBox(packet, node.AABB, maxT))
+            {
+                continue;
+            }
+            const uint64_t mask = packetBoxMask(packet, node.AABB, first + 1, packet.count);
+            if (mask == 0)
+            {
+                continue;
+            }
+            while ((mask >> first & 1) == 0)
+            {
+                first++;
+            }
+        }
+
+        if (node.isLeaf())
+        {
+            const uint64_t mask = packetBoxMask(packet, node.AABB, first, packet.count);
+            for (size_t i = first; i < packet.count; i++)
+            {
+                if ((mask >> i & 1) != 0 && intersectLeaf(rays[i], hitInfos[i], node, context))
+                {
+                    hits |= uint64_t(1) << i;
+                    packet.t[i] = rays[i].t;
+                }
+            }
+            continue;
+        }
+        if (first + 1 == packet.count)
+        {
+            // the packet has diverged to a single ray
+            if (intersectRecursive(rays[first], hitInfos[first], node, context))
+            {
+                hits |= uint64_t(1) << first;
+                packet.t[first] = rays[first].t;
+            }
+            continue;
+        }
+
+        // visit the child in the direction of the rays first (they all have the same direction signs)
+        const Node &left = packetNodes[node.first];
+        const Node &right = packetNodes[node.first + 1];
+        const glm::vec3 centerOffset = (right.AABB.lower + right.AABB.upper) - (left.AABB.lower + left.AABB.upper);
+        const bool rightFirst = glm::dot(centerOffset, rays[first].direction) < 0.0f;
+        stack.emplace_back(rightFirst ? node.first : node.first + 1, first);
+        stack.emplace_back(rightFirst ? node.first + 1 : node.first, first);
+    }
+
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        hits |= uint64_t(intersectSpheresAndInstances(rays[i], hitInfos[i], pCost)) << i;
+    }
+    return hits;
+}
+
+SurfacePoint BoundingVolumeHierarchy::resolveHit(const Ray &ray, const HitInfo &hitInfo) const
+{
+    if (hitInfo.instance != HitInfo::noInstance)
+    {
+        // resolve in object space and transform the normal back to world space
+        const BvhInstance &instance = m_instances[hitInfo.instance];
+        HitInfo objectHitInfo = hitInfo;
+        objectHitInfo.instance = HitInfo::noInstance;
+        const SurfacePoint surface = m_meshHierarchies[instance.mesh].resolveHit(toObjectSpace(ray, instance), objectHitInfo);
+        return SurfacePoint{glm::normalize(instance.normalToWorld * surface.normal), surface.materialId};
+    }
+    if (hitInfo.isSphere())
+    {
+        const Sphere &sphere = m_spheres[hitInfo.primitive & ~HitInfo::sphereFlag];
+        return SurfacePoint{glm::normalize(ray.origin + ray.direction * hitInfo.t - sphere.center), sphere.materialId};
+    }
+
+    const BvhPrimitive &primitive = primitives[hitInfo.primitive];
+    const Mesh &mesh = m_meshes[primitive.mesh];
+    if (m_geometryFormat == GeometryFormat::Quantized)
+    {
+        const QuantizedGeometry &geometry = m_quantizedGeometry;
+        const glm::uvec3 tri = geometry.primitiveVertices(hitInfo.primitive);
+        const glm::vec3 normal = interpolateTriangleNormal(geometry.position(tri[0]), geometry.position(tri[1]), geometry.position(tri[2]),
+                                                           geometry.normal(tri[0]), geometry.normal(tri[1]), geometry.normal(tri[2]),
+                                                           hitInfo.barycentric, ray);
+        return SurfacePoint{normal, mesh.materialId};
+    }
+    return SurfacePoint{interpolateTriangleNormal(mesh, mesh.triangles[primitive.triangle], hitInfo.barycentric, ray), mesh.materialId};
+}
+
 //void _max_(float x, float y, float z, bool (&arr)[3])
 //{
 //    if (x < y)
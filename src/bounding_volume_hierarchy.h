@@ -1,33 +1,232 @@
 #pragma once
+#include "disable_all_warnings.h"
+#include "mapped_file.h"
 #include "ray_tracing.h"
 #include "scene.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/type_precision.hpp>
+#include <glm/mat3x3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <memory>
 
+class BuildArena;
+struct BuildPrimitives;
+
+// The nodes are stored in one flat array (breadth first, the root at index 0). Nodes only contain
+// plain data so that the array can be written to disk and used directly from a memory mapped file.
 struct Node
 {
-    bool isLeaf;
-    int level;
     AxisAlignedBox AABB;
-    std::vector<int> indices;
-    std::vector<Mesh> meshes;
+    int level;
+    // Inner node: index of the left child, the right child is stored right after it.
+    // Leaf: index of the first primitive of this leaf in the primitive array.
+    uint32_t first;
+    // Number of primitives in a leaf, 0 for inner nodes.
+    uint32_t count;
+
+    bool isLeaf() const { return count != 0; }
+};
+
+// A triangle referenced by a leaf: the scene mesh it belongs to and its index in that mesh.
+struct BvhPrimitive
+{
+    uint32_t mesh;
+    uint32_t triangle;
+};
+
+// Vertex and triangle data read by BoundingVolumeHierarchy::intersect.
+enum class GeometryFormat
+{
+    Full,     // The scene meshes: 32-bit float positions and normals, 32-bit vertex indices.
+    Quantized // QuantizedGeometry: 16-bit positions, octahedral encoded normals, 16-bit vertex indices.
+};
+
+// Compact copy of the scene triangles in BVH leaf order (see GeometryFormat::Quantized). Every leaf has
+// its own list of the vertices used by its triangles so that the triangles can use 16-bit indices into it.
+// Positions are stored on a 16-bit grid spanning the root AABB, which means that a vertex shared by two
+// leaves decodes to the same point in both (no cracks). Normals are octahedral encoded in 2x16 bits.
+struct QuantizedGeometry
+{
+    glm::vec3 origin{0.0f};
+    glm::vec3 scale{0.0f};
+    // Index of the first vertex of a leaf, one entry per node (unused for inner nodes).
+    std::vector<uint32_t> firstVertex;
+    // (first primitive, first vertex) of every leaf sorted by first primitive, to find the vertex list of a
+    // primitive when a hit is resolved (the traversal knows the leaf and uses firstVertex instead).
+    std::vector<glm::uvec2> leafFirstVertex;
+    std::vector<glm::u16vec3> positions;
+    std::vector<uint32_t> normals;
+    // Vertex indices relative to the first vertex of the leaf, in the order of the primitive array. Only
+    // if a leaf uses more than 65536 vertices triangles32 is used instead of triangles16.
+    std::vector<glm::u16vec3> triangles16;
+    std::vector<glm::uvec3> triangles32;
+    // Copy of the nodes with every box grown by half a quantization step, which the traversal uses instead of
+    // the float boxes: a decoded vertex can lie up to half a step outside the box of its (float) triangle.
+    std::vector<Node> nodes;
+
+    glm::vec3 position(uint32_t vertex) const { return origin + glm::vec3(positions[vertex]) * scale; }
+    glm::vec3 normal(uint32_t vertex) const;
+    glm::uvec3 triangle(uint32_t primitive) const
+    {
+        return triangles32.empty() ? glm::uvec3(triangles16[primitive]) : triangles32[primitive];
+    }
+    // Vertex indices of a primitive into positions and normals.
+    glm::uvec3 primitiveVertices(uint32_t primitive) const;
+};
+
+// Instance of Scene::instances as used by the traversal.
+struct BvhInstance
+{
+    glm::mat4 worldToObject;
+    // Transforms object space normals to world space (inverse transpose of the object to world transform).
+    glm::mat3 normalToWorld;
+    // Index into Scene::instancedMeshes.
+    uint32_t mesh;
+};
+
+// How the primitives of a node are divided over its two children.
+enum class BvhSplitMethod
+{
+    // Split at the median centroid along the longest axis (keeping the primitives of a mesh together).
+    Median = 0,
+    // Binned surface area heuristic over the primitive centroids (object splits).
+    ObjectSah = 1,
+    // Object splits plus spatial splits that clip the triangles at the split plane and reference them from
+    // both children (SBVH). Reduces the overlap of sibling boxes for large or long and thin triangles.
+    SpatialSah = 2
+};
+
+struct BvhBuildSettings
+{
+    BvhSplitMethod splitMethod = BvhSplitMethod::Median;
+    // Nodes with more primitives than this are always split. The SAH builds may also split smaller nodes
+    // if that is cheaper; the median build does not.
+    uint32_t maxLeafPrimitives = 4;
+    // Safety limit: the nodes at this depth (the root has depth 0) become leaves whatever their size.
+    int maxDepth = 48;
+    // Relative costs of a traversal step and of a primitive intersection test in the surface area heuristic.
+    float traversalCost = 1.0f;
+    float intersectionCost = 1.0f;
+    // SpatialSah: the number of primitive references may grow by this fraction of the number of triangles.
+    float spatialSplitBudget = 0.3f;
+    // Post-pass after any split method that reorganizes small treelets (7 leaves) into the topology with the
+    // lowest SAH cost and then collapses subtrees of up to maxLeafPrimitives into leaves where that is cheaper
+    // (TRBVH); the median build then splits down to single primitives. Costs some build time for faster
+    // traversal, e.g. when many frames are rendered.
+    bool restructureTreelets = false;
+};
+
+// Cost of building the hierarchy in memory (all zero if it was loaded from a file).
+struct BvhBuildStatistics
+{
+    float milliseconds = 0.0f;
+    // Scratch memory of the build, which is served by a BuildArena instead of individual heap allocations.
+    size_t arenaPeakBytes = 0;
+    size_t arenaBlocks = 0;
+    // Spatial splits made and primitive references added by them (BvhSplitMethod::SpatialSah).
+    size_t spatialSplits = 0;
+    size_t duplicatedReferences = 0;
+    // Treelets that got a new topology and the time this took (BvhBuildSettings::restructureTreelets).
+    size_t restructuredTreelets = 0;
+    float restructureMilliseconds = 0.0f;
+};
+
+// Shape and quality of the tree over the scene meshes, see BoundingVolumeHierarchy::statistics().
+struct BvhStatistics
+{
+    size_t numNodes = 0;
+    size_t numLeaves = 0;
+    // Primitives referenced by the leaves (more than the number of triangles after spatial splits).
+    size_t numReferences = 0;
+    // Number of leaves with i primitives at index i.
+    std::vector<size_t> leafSizeHistogram;
+    // Number of leaves at depth i (the root has depth 0).
+    std::vector<size_t> leafDepthHistogram;
+    // Expected cost of tracing a ray through the root box according to the surface area heuristic.
+    float sahCost = 0.0f;
+    // Surface area of the overlap of the boxes of the two children of an inner node relative to the surface
+    // area of the node, averaged over all inner nodes. 0 means the children never overlap.
+    float averageSiblingOverlap = 0.0f;
+};
+
+// Result of BoundingVolumeHierarchy::refit().
+struct BvhRefitStatistics
+{
+    float milliseconds = 0.0f;
+    // SAH cost of the refitted tree(s) relative to the cost right after the build (the largest ratio over the
+    // tree of the meshes, the tree of the instances and the trees of the instanced meshes). Refitting keeps the
+    // topology, so this grows as the geometry moves away from where it was built; rebuild when it is too large.
+    // After spatial splits the leaves get the boxes of whole triangles again, so the ratio starts above 1.
+    float sahCostRatio = 1.0f;
 };
 
+// Work done by a single BoundingVolumeHierarchy::intersect call.
+struct TraversalCost
+{
+    int nodesVisited = 0;
+    int trianglesTested = 0;
+    int spheresTested = 0;
+};
+
+// Largest number of rays that BoundingVolumeHierarchy::intersectPacket traces together (an 8x8 pixel tile).
+static constexpr size_t maxRayPacketSize = 64;
+
 class BoundingVolumeHierarchy
 {
 
 private:
-    Scene *m_pScene;
-    int maxDepth;
+    // Only set for the hierarchy of a whole scene (not for the bottom-level hierarchy of an instanced mesh).
+    Scene *m_pScene = nullptr;
+    gsl::span<const Mesh> m_meshes;
+    gsl::span<const Sphere> m_spheres;
+    BvhBuildSettings m_settings;
+
+    // Either views into the vectors below (built in memory) or into m_pMappedFile (loaded from disk).
+    gsl::span<const Node> nodes;
+    gsl::span<const BvhPrimitive> primitives;
+    std::vector<Node> m_nodeStorage;
+    std::vector<BvhPrimitive> m_primitiveStorage;
+    std::shared_ptr<MappedFile> m_pMappedFile;
+
+    GeometryFormat m_geometryFormat = GeometryFormat::Full;
+    QuantizedGeometry m_quantizedGeometry;
+    BvhBuildStatistics m_buildStatistics;
+    // SAH cost of the trees when they were built or loaded, to which refit() compares.
+    float m_builtSahCost = 0.0f;
+    float m_builtInstanceSahCost = 0.0f;
+
+    // Two-level part for Scene::instances: a bottom-level hierarchy of every instanced mesh (in object space)
+    // and a top-level tree over the world space bounds of the instances. Its leaves reference ranges of
+    // m_instanceOrder, which holds indices into m_instances.
+    std::vector<BoundingVolumeHierarchy> m_meshHierarchies;
+    std::vector<BvhInstance> m_instances;
+    std::vector<Node> m_instanceNodes;
+    std::vector<uint32_t> m_instanceOrder;
+
+    // Bottom-level hierarchy of a single instanced mesh.
+    BoundingVolumeHierarchy(const Mesh &mesh, const BvhBuildSettings &settings, const std::filesystem::path *pCacheDirectory);
+    void buildOrLoad(const std::filesystem::path *pCacheDirectory);
+    void buildInstances(const std::filesystem::path *pCacheDirectory);
+    float refitMeshes();
+    float refitInstances();
+    bool intersectInstances(Ray &ray, HitInfo &hitInfo, TraversalCost *pCost) const;
+    bool intersectSpheresAndInstances(Ray &ray, HitInfo &hitInfo, TraversalCost *pCost) const;
 
-    std::vector<Node> nodes;
     //Node root;
-    void getSubNodes(Node &node, Node &leftNode, Node &rightNode);
-    void createTree(Node root);
+    void build();
+    void getSubNodes(const Node &node, Node &leftNode, Node &rightNode, const BuildPrimitives &input, gsl::span<uint32_t> order, BuildArena &arena);
+    void createTree(Node root, const BuildPrimitives &input, gsl::span<uint32_t> order, BuildArena &arena, std::vector<Node> &nodeStorage);
+    std::vector<uint32_t> createSahTree(const BuildPrimitives &input, BuildArena &arena);
+    bool loadFromFile(const std::filesystem::path &file, uint64_t key);
+    void buildQuantizedGeometry();
+    // Nodes to traverse for the current geometry format (see QuantizedGeometry::nodes).
+    gsl::span<const Node> traversalNodes() const;
 
-    Node getLeftChild(Node &node);
-    Node getRightChild(Node &node);
-    void setTriangleIndices(Node &node);
-    void getNodesAtLevel(Node &node, std::vector<Node> &result, int level);
+    void getNodesAtLevel(const Node &node, std::vector<Node> &result, int level) const;
 
     //bool intersectRayThatStartsOutsideBoxes(Ray& ray, HitInfo& hitInfo, const Node& leftChild,
     //    const Node& rightChild, float& tLeft, float& tRight);
@@ -36,16 +235,57 @@ private:
     //bool intersectRecursive(Ray& ray, HitInfo& hitInfo, const Node& current);
     //bool intersectDataStructure(Ray& ray, HitInfo& hitInfo, const Node& root);
 public:
-    BoundingVolumeHierarchy(Scene *pScene);
+    BoundingVolumeHierarchy(Scene *pScene, const BvhBuildSettings &settings = {});
+    // Loads the hierarchy from cacheDirectory if it was built for the same geometry and build settings
+    // before, otherwise builds it and stores it there for the next time.
+    BoundingVolumeHierarchy(Scene *pScene, const std::filesystem::path &cacheDirectory, const BvhBuildSettings &settings = {});
+
+    // The node and primitive arrays may point into the owned vectors, so copying is not allowed.
+    BoundingVolumeHierarchy(const BoundingVolumeHierarchy &) = delete;
+    BoundingVolumeHierarchy(BoundingVolumeHierarchy &&) = default;
+    BoundingVolumeHierarchy &operator=(const BoundingVolumeHierarchy &) = delete;
+    BoundingVolumeHierarchy &operator=(BoundingVolumeHierarchy &&) = default;
+
+    // Hash of everything the hierarchy depends on (scene geometry and build settings); used to name
+    // and validate the files written by save().
+    uint64_t cacheKey() const;
+    // Write the flattened node array and the primitive ordering to a file.
+    void save(const std::filesystem::path &file) const;
+    const BvhBuildStatistics &buildStatistics() const;
+
+    // Recompute the boxes of all nodes from the current vertex positions of the scene meshes and instanced
+    // meshes and the current instance transforms, keeping the tree topology (and the primitive order). Much
+    // cheaper than a rebuild, so it can be called every frame for animated geometry; the number or order of
+    // meshes, triangles and instances must not change since the build. The leaf boxes are computed from whole
+    // triangles, so a refit undoes the clipping of spatial splits (BvhSplitMethod::SpatialSah) and loosens the tree.
+    BvhRefitStatistics refit();
+
+    // Select the vertex format used by intersect(). The quantized copy is created when it is first selected.
+    void setGeometryFormat(GeometryFormat format);
+    GeometryFormat geometryFormat() const;
+    // Bytes of vertex, triangle and primitive data that intersect() reads in the current format.
+    size_t geometryBytes() const;
 
     // Use this function to visualize your BVH. This can be useful for debugging.
     void debugDraw(int level);
     int numLevels() const;
+    // Node and leaf counts, histograms and quality metrics of the tree, e.g. to tune the build settings per scene.
+    BvhStatistics statistics() const;
+    // Write the statistics and all nodes (box, depth and children or primitive range) as a JSON object.
+    void writeJson(std::ostream &stream) const;
 
     // Return true if something is hit, returns false otherwise.
     // Only find hits if they are closer than t stored in the ray and the intersection
     // is on the correct side of the origin (the new t >= 0).
     bool intersect(Ray &ray, HitInfo &hitInfo) const;
+    // Same as above but also counts the nodes visited and primitives tested (e.g. for the traversal cost heatmap).
+    bool intersect(Ray &ray, HitInfo &hitInfo, TraversalCost *pCost) const;
+    // Same as intersect() for a packet of at most maxRayPacketSize coherent rays, e.g. the primary rays of a 4x4
+    // or 8x8 pixel tile, that share the traversal of the tree. Incoherent packets fall back to tracing every
+    // ray on its own. Returns a bit mask of the rays that hit something (bit i for rays[i]).
+    uint64_t intersectPacket(gsl::span<Ray> rays, gsl::span<HitInfo> hitInfos, TraversalCost *pCost = nullptr) const;
+    // Look up the normal and material of a hit found by intersect(). Only call this for rays that are shaded.
+    SurfacePoint resolveHit(const Ray &ray, const HitInfo &hitInfo) const;
 
     // void addToNodes(const Node &node)
     // {
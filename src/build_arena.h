@@ -0,0 +1,109 @@
+#pragma once
+#include "disable_all_warnings.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <gsl-lite/gsl-lite.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for the short-lived arrays used while building a data structure. Memory is taken from
+// large blocks (a new block is only requested from the heap when the current one is full) and is handed
+// back all at once: with rewind() to a previous mark() for scratch arrays of a single step, or with reset()
+// after the whole build. Only meant for trivially destructible types; destructors are never run.
+class BuildArena {
+public:
+    struct Marker {
+        size_t block;
+        size_t offset;
+    };
+
+    explicit BuildArena(size_t blockSize = size_t(1) << 20)
+        : m_blockSize(blockSize)
+    {
+    }
+
+    BuildArena(const BuildArena&) = delete;
+    BuildArena& operator=(const BuildArena&) = delete;
+
+    // Array of count value initialized elements, valid until the arena is rewound past it or reset.
+    template <typename T>
+    gsl::span<T> allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>);
+        if (count == 0)
+            return {};
+        T* pData = static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+        std::uninitialized_value_construct_n(pData, count);
+        return { pData, count };
+    }
+
+    Marker mark() const { return { m_currentBlock, m_offset }; }
+    void rewind(const Marker& marker)
+    {
+        m_currentBlock = marker.block;
+        m_offset = marker.offset;
+        m_usedBytes = m_blocks.empty() ? 0 : m_blockStart[marker.block] + marker.offset;
+    }
+    // Make all memory available again; the blocks are kept for the next build.
+    void reset() { rewind(Marker { 0, 0 }); }
+
+    // Largest amount of memory that was in use at the same time.
+    size_t peakBytes() const { return m_peakBytes; }
+    // Number of blocks requested from the heap.
+    size_t numBlocks() const { return m_numBlocksAllocated; }
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> pData;
+        size_t size;
+    };
+
+    void* allocateBytes(size_t size, size_t alignment)
+    {
+        while (true) {
+            if (m_currentBlock < m_blocks.size()) {
+                const Block& block = m_blocks[m_currentBlock];
+                const size_t offset = (m_offset + alignment - 1) / alignment * alignment;
+                if (offset + size <= block.size) {
+                    m_offset = offset + size;
+                    m_usedBytes = m_blockStart[m_currentBlock] + m_offset;
+                    m_peakBytes = std::max(m_peakBytes, m_usedBytes);
+                    return block.pData.get() + offset;
+                }
+                // Does not fit: continue in the next block (if it exists and is large enough).
+                if (m_currentBlock + 1 < m_blocks.size() && m_blocks[m_currentBlock + 1].size >= size + alignment) {
+                    m_currentBlock++;
+                    m_offset = 0;
+                    continue;
+                }
+                // Blocks after the current one are too small for this request; drop them.
+                m_blocks.resize(m_currentBlock + 1);
+                m_blockStart.resize(m_currentBlock + 1);
+            }
+
+            // operator new[] returns memory aligned for any fundamental type.
+            const size_t blockSize = std::max(m_blockSize, size + alignment);
+            const size_t blockStart = m_blocks.empty() ? 0 : m_blockStart.back() + m_blocks.back().size;
+            m_blocks.push_back(Block { std::unique_ptr<std::byte[]>(new std::byte[blockSize]), blockSize });
+            m_numBlocksAllocated++;
+            m_blockStart.push_back(blockStart);
+            m_currentBlock = m_blocks.size() - 1;
+            m_offset = 0;
+        }
+    }
+
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    // Sum of the sizes of the blocks before each block, to track the memory in use.
+    std::vector<size_t> m_blockStart;
+    size_t m_currentBlock { 0 };
+    size_t m_offset { 0 };
+    size_t m_usedBytes { 0 };
+    size_t m_peakBytes { 0 };
+    size_t m_numBlocksAllocated { 0 };
+};
@@ -0,0 +1,88 @@
+#include "camera.h"
+#include "disable_all_warnings.h"
+#include "sampling.h"
+#include "trackball.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+CameraFrame::CameraFrame(const Trackball& camera, const glm::ivec2& resolution, const ThinLens& lens)
+    : m_origin(camera.position())
+    , m_forward(camera.forward())
+    , m_resolution(resolution)
+    , m_apertureRadius(std::max(lens.apertureRadius, 0.0f))
+    , m_focusDistance(lens.focusDistance)
+{
+    const float halfScreenPlaneHeight = std::tan(camera.fieldOfView() / 2.0f);
+    const float halfScreenPlaneWidth = camera.aspectRatio() * halfScreenPlaneHeight;
+    // NOTE: Trackball::left() points to the right of the screen, so the x coordinate is flipped (as in Trackball::generateRay).
+    m_right = -halfScreenPlaneWidth * camera.left();
+    m_up = halfScreenPlaneHeight * camera.up();
+    m_lensRight = -m_apertureRadius * camera.left();
+    m_lensUp = m_apertureRadius * camera.up();
+}
+
+glm::vec2 CameraFrame::normalizedPixelPos(int x, int y, const glm::vec2& offset) const
+{
+    return { (float(x) + offset.x) / float(m_resolution.x) * 2.0f - 1.0f, (float(y) + offset.y) / float(m_resolution.y) * 2.0f - 1.0f };
+}
+
+glm::vec2 CameraFrame::pixelLensSample(int x, int y) const
+{
+    return randomSample(uint32_t(y * m_resolution.x + x));
+}
+
+Ray CameraFrame::generateRay(const glm::vec2& normalizedPixelPos, const glm::vec2& lensSample) const
+{
+    // Has unit length along the view direction (m_forward is normalized).
+    const glm::vec3 direction = m_forward + normalizedPixelPos.x * m_right + normalizedPixelPos.y * m_up;
+    if (!hasDepthOfField())
+        return Ray { m_origin, glm::normalize(direction), std::numeric_limits<float>::max() };
+
+    const glm::vec3 focusPoint = m_origin + m_focusDistance * direction;
+    const glm::vec2 lensPosition = concentricDiskSample(lensSample);
+    const glm::vec3 lensPoint = m_origin + lensPosition.x * m_lensRight + lensPosition.y * m_lensUp;
+    return Ray { lensPoint, glm::normalize(focusPoint - lensPoint), std::numeric_limits<float>::max() };
+}
+
+Ray CameraFrame::pixelRay(int x, int y, const glm::vec2& offset) const
+{
+    return generateRay(normalizedPixelPos(x, y, offset), pixelLensSample(x, y));
+}
+
+Ray CameraFrame::pixelRay(int x, int y, const glm::vec2& offset, const glm::vec2& lensSample) const
+{
+    return generateRay(normalizedPixelPos(x, y, offset), lensSample);
+}
+
+void CameraFrame::generateRays(const ScreenTile& tile, gsl::span<Ray> rays) const
+{
+    const int width = tile.end.x - tile.begin.x;
+    const int height = tile.end.y - tile.begin.y;
+    if (hasDepthOfField()) {
+        // The lens sampling does not vectorize; generate the rays one by one.
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++)
+                rays[size_t(y * width + x)] = pixelRay(tile.begin.x + x, tile.begin.y + y);
+        }
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+        const float screenY = float(tile.begin.y + y) / float(m_resolution.y) * 2.0f - 1.0f;
+        const glm::vec3 rowCenter = m_forward + screenY * m_up;
+        const size_t row = size_t(y * width);
+        // Plain arithmetic on the components so that the compiler can vectorize the loop.
+        for (int x = 0; x < width; x++) {
+            const float screenX = float(tile.begin.x + x) / float(m_resolution.x) * 2.0f - 1.0f;
+            const float directionX = rowCenter.x + screenX * m_right.x;
+            const float directionY = rowCenter.y + screenX * m_right.y;
+            const float directionZ = rowCenter.z + screenX * m_right.z;
+            const float inverseLength = 1.0f / std::sqrt(directionX * directionX + directionY * directionY + directionZ * directionZ);
+            rays[row + size_t(x)] = Ray { m_origin, glm::vec3(directionX * inverseLength, directionY * inverseLength, directionZ * inverseLength), std::numeric_limits<float>::max() };
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "disable_all_warnings.h"
+#include "ray.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <gsl-lite/gsl-lite.hpp>
+DISABLE_WARNINGS_POP()
+
+class Trackball;
+
+// Thin lens model for depth of field: a camera ray starts at a point on a disk-shaped lens and passes through the
+// point on the plane in focus that the pinhole ray of its pixel would hit. With a zero aperture the camera is a pinhole.
+struct ThinLens {
+    float apertureRadius { 0.0f };
+    // Distance from the camera to the plane in focus, along the view direction.
+    float focusDistance { 3.0f };
+};
+
+// Rectangle of pixels, from begin up to (not including) end.
+struct ScreenTile {
+    glm::ivec2 begin;
+    glm::ivec2 end;
+};
+
+// Snapshot of the camera for generating the rays of one frame. Everything that Trackball::generateRay computes per
+// ray (the field of view, the aspect ratio of the window and the rotation) is computed once when the frame is taken,
+// so a CameraFrame can be shared by all render threads and never touches the Window.
+//
+// With depth of field every ray samples its own lens position, given as a sample in [0, 1)^2 (see sampling.h), so
+// the lens is integrated by the samples that are taken per pixel anyway (anti aliasing) instead of by extra renders.
+// Functions without a lens sample use a random position that is fixed per pixel.
+class CameraFrame {
+public:
+    CameraFrame(const Trackball& camera, const glm::ivec2& resolution, const ThinLens& lens = {});
+
+    // Ray through a point on the screen in normalized coordinates ((-1, -1) at the bottom left, (+1, +1) at the top right).
+    Ray generateRay(const glm::vec2& normalizedPixelPos, const glm::vec2& lensSample) const;
+    // Ray through pixel (x, y) plus offset (in pixels), using the same pixel to screen mapping as the renderer.
+    Ray pixelRay(int x, int y, const glm::vec2& offset = glm::vec2(0.0f)) const;
+    Ray pixelRay(int x, int y, const glm::vec2& offset, const glm::vec2& lensSample) const;
+    // Rays through all pixels of the tile, row by row, written to the first width * height elements of rays (which
+    // must be large enough). They are written directly into the caller's packet or queue, so they are not copied again.
+    void generateRays(const ScreenTile& tile, gsl::span<Ray> rays) const;
+
+    glm::ivec2 resolution() const { return m_resolution; }
+    bool hasDepthOfField() const { return m_apertureRadius > 0.0f; }
+
+private:
+    glm::vec2 normalizedPixelPos(int x, int y, const glm::vec2& offset) const;
+    glm::vec2 pixelLensSample(int x, int y) const;
+
+    glm::vec3 m_origin;
+    glm::vec3 m_forward;
+    // Half the width and height of the image plane at distance 1 in front of the camera, along the screen axes.
+    glm::vec3 m_right;
+    glm::vec3 m_up;
+    glm::ivec2 m_resolution;
+
+    float m_apertureRadius;
+    float m_focusDistance;
+    // Radius of the lens along the screen axes.
+    glm::vec3 m_lensRight;
+    glm::vec3 m_lensUp;
+};
@@ -35,16 +35,15 @@ static void setMaterial(const Material& material)
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, glm::value_ptr(zero));
 }
 
-void drawMesh(const Mesh& mesh)
+void drawMesh(const Mesh& mesh, const Material& material)
 {
-    setMaterial(mesh.material);
+    setMaterial(material);
 
     glBegin(GL_TRIANGLES);
     for (const auto& triangleIndex : mesh.triangles) {
         for (int i = 0; i < 3; i++) {
-            const auto& vertex = mesh.vertices[triangleIndex[i]];
-            glNormal3fv(glm::value_ptr(vertex.n)); // Normal.
-            glVertex3fv(glm::value_ptr(vertex.p)); // Position.
+            glNormal3fv(glm::value_ptr(mesh.normals[triangleIndex[i]])); // Normal.
+            glVertex3fv(glm::value_ptr(mesh.positions[triangleIndex[i]])); // Position.
         }
     }
     glEnd();
@@ -62,10 +61,10 @@ static void drawSphereInternal(const glm::vec3& center, float radius)
     glPopMatrix();
 }
 
-void drawSphere(const Sphere& sphere)
+void drawSphere(const Sphere& sphere, const Material& material)
 {
     glPushAttrib(GL_ALL_ATTRIB_BITS);
-    setMaterial(sphere.material);
+    setMaterial(material);
     drawSphereInternal(sphere.center, sphere.radius);
     glPopAttrib();
 }
@@ -149,9 +148,21 @@ void drawAABB(const AxisAlignedBox& box, DrawMode drawMode, const glm::vec3& col
 void drawScene(const Scene& scene)
 {
     for (const auto& mesh : scene.meshes)
-        drawMesh(mesh);
+        drawMesh(mesh, scene.materials[mesh.materialId]);
     for (const auto& sphere : scene.spheres)
-        drawSphere(sphere);
+        drawSphere(sphere, scene.materials[sphere.materialId]);
+
+    // The instance transforms may scale, so let OpenGL renormalize the transformed normals.
+    glPushAttrib(GL_ENABLE_BIT);
+    glEnable(GL_NORMALIZE);
+    for (const auto& instance : scene.instances) {
+        const Mesh& mesh = scene.instancedMeshes[instance.mesh];
+        glPushMatrix();
+        glMultMatrixf(glm::value_ptr(instance.transform));
+        drawMesh(mesh, scene.materials[mesh.materialId]);
+        glPopMatrix();
+    }
+    glPopAttrib();
     //for (const auto& box : scene.boxes)
     //	drawShape(box);
 }
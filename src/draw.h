@@ -8,8 +8,8 @@ enum class DrawMode {
     Wireframe
 };
 
-void drawMesh(const Mesh& mesh);
-void drawSphere(const Sphere& sphere);
+void drawMesh(const Mesh& mesh, const Material& material);
+void drawSphere(const Sphere& sphere, const Material& material);
 void drawSphere(const glm::vec3& center, float radius, const glm::vec3& color = glm::vec3(1.0f));
 void drawAABB(const AxisAlignedBox& box, DrawMode drawMode = DrawMode::Filled, const glm::vec3& color = glm::vec3(1.0f), float transparency = 1.0f);
 
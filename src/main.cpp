@@ -2,7 +2,9 @@
 #include "disable_all_warnings.h"
 #include "draw.h"
 #include "image.h"
+#include "ray_statistics.h"
 #include "ray_tracing.h"
+#include "render.h"
 #include "screen.h"
 #include "trackball.h"
 #include "window.h"
@@ -13,10 +15,12 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec4.hpp>
 #include <imgui.h>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 #include <optional>
 #include <random>
 #include <string>
@@ -29,696 +33,28 @@ DISABLE_WARNINGS_POP()
 constexpr glm::ivec2 windowResolution{800, 800};
 const std::filesystem::path dataPath{DATA_DIR};
 const std::filesystem::path outputPath{OUTPUT_DIR};
-
-bool bloom = false;
-bool blur = false;
-bool antiAliasing = false;
+// Built BVHs are stored here and reused when the same scene is loaded again.
+const std::filesystem::path bvhCachePath{dataPath / "bvh_cache"};
+
+RenderSettings renderSettings;
+MeshLoadSettings meshLoadSettings;
+GeometryFormat geometryFormat = GeometryFormat::Full;
+BvhBuildSettings bvhBuildSettings;
+HeatmapMetric heatmapMetric = HeatmapMetric::NodesAndTriangles;
+SamplingStatistics samplingStatistics;
+RayStatistics frameRayStatistics;
+float frameMilliseconds = 0.0f;
 
 enum class ViewMode
 {
     Rasterization = 0,
-    RayTracing = 1
+    RayTracing = 1,
+    TraversalCost = 2
 };
 
-/**
-@author Alex
-*/
-static glm::vec3 randomUnitVector()
-{
-    std::random_device mch;
-    std::default_random_engine generator(mch());
-    std::normal_distribution<float> distribution(0.0f, 1.0f);
-    float y = distribution(generator);
-    float x = distribution(generator);
-    float s = distribution(generator);
-    /*float y = rand() - RAND_MAX / 2;
-    float x = rand() - RAND_MAX / 2;
-    float s = rand() - RAND_MAX / 2;*/
-    
-    return glm::normalize(glm::vec3(y, x, s));
-}
-
-static glm::vec3 specularOneLight(Ray &ray, const PointLight &light, const glm::vec3 &fromPosToLight, HitInfo &hitInfo)
-{
-    glm::vec3 fromCamToPos = ray.direction;
-    glm::vec3 reflected = glm::normalize(glm::reflect(fromCamToPos, hitInfo.normal));
-
-    // draw the normal
-    //drawRay(Ray{ ray.origin + ray.direction * ray.t, hitInfo.normal, glm::length(fromCamToPos) }, glm::vec3{ 0.0f, 0.0f, 1.0f });
-
-    float specularCos = glm::dot(reflected, fromPosToLight);
-    if (specularCos <= 0)
-    {
-        // the reflection is not counted because the angle is too high
-        //drawRay(Ray{ ray.origin + ray.direction * ray.t, reflected, glm::length(fromCamToPos) }, glm::vec3{ 1.0f, 0.0f, 0.0f });
-        return glm::vec3(0);
-    }
-
-    // Is * Ks * cos(theta)
-    glm::vec3 result = light.color * hitInfo.material.ks * pow(specularCos, hitInfo.material.shininess);
-    // draw the reflection with the specular colour
-    //drawRay(Ray{ ray.origin + ray.direction * ray.t, reflected, glm::length(fromCamToPos) }, result);
-    return result;
-}
-
-static glm::vec3 diffuseOneLight(Ray &ray, const PointLight &light, const glm::vec3 &fromPosToLight, HitInfo &hitInfo)
-{
-    drawRay(Ray{ray.origin + ray.direction * ray.t, hitInfo.normal, 5.0f}, glm::vec3{0.0f, 0.0f, 1.0f});
-    float diffuseCos = glm::dot(fromPosToLight, hitInfo.normal);
-
-    if (diffuseCos <= 0)
-    { // this point is facing away from the light
-        drawRay(Ray{ray.origin + ray.direction * ray.t, fromPosToLight, 5.0f}, glm::vec3{1.0f, 0.0f, 0.0f});
-        return glm::vec3(0);
-    }
-
-    drawRay(Ray{ray.origin + ray.direction * ray.t, fromPosToLight, 5.0f}, glm::vec3{0.0f, 1.0f, 0.0f});
-    // Id * Kd * cos(theta)
-    return light.color * hitInfo.material.kd * diffuseCos;
-}
-/**
-* @author Alex, added bvh to the function signature
-* first for loop
-**/
-
-static bool pointInShadow(glm::vec3 &pointOn, const PointLight &light, const BoundingVolumeHierarchy &bvh)
-{
-    glm::vec3 fromPosToLight = light.position - pointOn;
-    Ray ray{pointOn, glm::normalize(fromPosToLight), std::numeric_limits<float>::max()};
-
-    // set an offset to the ray not to always intersect the object at which we have our point
-    float epsilon = 0.001;
-    ray.origin += epsilon * ray.direction;
-
-    // only check the distance of the intersected object if we intersected something
-    HitInfo shadowRayHitInfo;
-    if (bvh.intersect(ray, shadowRayHitInfo))
-    {
-        //drawRay(ray, glm::vec3(0.0f, 1.0f, 0.0f));
-        // if there is an object between us and the light source, we are in shadow
-        if (ray.t + epsilon >= glm::length(fromPosToLight))
-        {
-            //drawRay(ray, glm::vec3(0.0f, 1.0f, 0.0f));
-            return false;
-        }
-
-        Ray afterHit;
-        afterHit.origin = ray.origin + ray.t * ray.direction;
-        afterHit.direction = ray.direction;
-        afterHit.t = glm::length(fromPosToLight) - ray.t;
-        //drawRay(afterHit, glm::vec3(1.0f, 0.0f, 0.0f));
-        return true;
-    }
-
-    //drawRay(ray, glm::vec3(0.0f, 0.0f, 1.0f));
-    return false;
-}
-
-// static glm::vec3 shading(Ray &ray, HitInfo &hitInfo, const Scene &scene, const BoundingVolumeHierarchy &bvh)
-// {
-//     const std::vector<PointLight> &pointLights = scene.pointLights;
-//     glm::vec3 pointOn = ray.origin + ray.direction * ray.t;
-//     glm::vec3 result(0.0f);
-
-//     for (const PointLight &light : pointLights)
-//     {
-//         const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
-//         if (pointInShadow(pointOn, light, bvh))
-//         {
-//             continue;
-//         }
-
-//         glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, hitInfo);
-//         glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, hitInfo);
-//         result += diffuse;
-//         result += specular;
-//     }
-
-//     return result;
-// }
-
-static glm::vec3 shading(Ray &ray, HitInfo &hitInfo, const Scene &scene, const BoundingVolumeHierarchy &bvh)
-{
-    const std::vector<PointLight> &pointLights = scene.pointLights;
-    const std::vector<SphericalLight> &sphericalLights = scene.sphericalLight;
-    glm::vec3 pointOn = ray.origin + ray.direction * ray.t;
-    glm::vec3 result(0.0f);
-    float softShadowCounter = 0.0f;
-
-    for (const SphericalLight &spherical : sphericalLights)
-    {
-        const PointLight &light = {spherical.position, spherical.color};
-
-        const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
-        glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, hitInfo);
-        glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, hitInfo);
-        softShadowCounter = 0.0f;
-        for (int i = 1; i <= 200; i++)
-        {
-            glm::vec3 randomPointOnSphere = spherical.position + spherical.radius * randomUnitVector();
-            Ray newRay = {pointOn + (float)(0.001) * (glm::normalize(randomPointOnSphere - pointOn)), glm::normalize(randomPointOnSphere - pointOn), length(newRay.origin - randomPointOnSphere)};
-            HitInfo newHitInfo;
-            float lightT = length(newRay.origin - randomPointOnSphere);
-            if (!(bvh.intersect(newRay, newHitInfo)))
-            {
-                softShadowCounter += 1.0f;
-                drawRay(newRay, glm::vec3(1));
-            }
-            else
-            {
-                if (newRay.t > lightT)
-                {
-                    softShadowCounter += 1.0f;
-                    drawRay(newRay, glm::vec3(1));
-                }
-                else
-                {
-                    drawRay(newRay, glm::vec3(1, 0, 0));
-                }
-            }
-        }
-        softShadowCounter = softShadowCounter / 200.0f;
-
-        //const PointLight &light = {spherical.position, spherical.color};
-
-        //const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
-        /**if (pointInShadow(pointOn, light, bvh))
-        {
-            continue;
-        }*/
-
-        //glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, hitInfo);
-        //glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, hitInfo);
-        result += diffuse * softShadowCounter;
-        /**std::cout<<"Result is:"<<"x:"<<result.x <<" "<<"y:"<<result.y << " " <<"z:"<<result.z << std::endl;
-        std::cout <<"Diffuse is:"<<"x:"<< diffuse.x << " " <<"y:"<< diffuse.y << " " <<"z:"<< diffuse.z << std::endl;
-        std::cout <<"Specular is:"<<"x"<< specular.x << " " <<"y:"<< specular.y << " " <<"z:"<< specular.z << std::endl;
-        std::cout << std::endl;*/
-        result += specular * softShadowCounter;
-    }
-
-    for (const PointLight &light : pointLights)
-    {
-        const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
-        if (pointInShadow(pointOn, light, bvh))
-        {
-            continue;
-        }
-
-        glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, hitInfo);
-        glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, hitInfo);
-        result += diffuse;
-        result += specular;
-    }
-
-    return result;
-}
-
-// Recursive Ray tracing methods
-static void trace(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh);
-static void shade(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh, HitInfo &hitInfo);
-
-static void shade(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh, HitInfo &hitInfo)
-{
-    //ComputeDirectLight
-    glm::vec3 directColor = shading(ray, hitInfo, scene, bvh);
-
-    if (hitInfo.material.ks.x <= 0.01f, hitInfo.material.ks.y <= 0.01f, hitInfo.material.ks.z <= 0.01f)
-    {
-        color = directColor;
-        return;
-    }
-    //ComputeReflectedRay
-    glm::vec3 fromCamToPos = ray.direction;
-    glm::vec3 reflected = glm::normalize(glm::reflect(fromCamToPos, hitInfo.normal));
-    Ray reflectedRay = {ray.origin + ray.direction * ray.t, reflected, glm::length(fromCamToPos)};
-    float epsilon = 0.001;
-    reflectedRay.origin += epsilon * reflectedRay.direction;
-    //drawRay(reflectedRay, glm::vec3{1.0f, 0.0f, 0.0f});
-
-    glm::vec3 reflectedColor;
-    trace(level + 1, reflectedRay, reflectedColor, scene, bvh);
-    // std::cout << hitInfo.material.ks.x << std::endl;
-
-    color = directColor + reflectedColor * hitInfo.material.ks;
-}
-static void trace(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh)
-{
-    if (level >= 2)
-    {
-        //std::cout << "end" << std::endl;
-        color = glm::vec3(0.0f);
-        return;
-    }
-    //std::cout << level << std::endl;
-
-    HitInfo hitInfo;
-    if (bvh.intersect(ray, hitInfo))
-    {
-        // Draw a white debug ray.
-        drawRay(ray, glm::vec3(1.0f));
-
-        //std::cout << ray.origin.x << " " << ray.origin.y << " " << ray.origin.z << " " << ray.direction.x << " " << ray.direction.y << " " << ray.direction.z << std::endl;
-
-        // Get the resulting shading
-        glm::vec3 shadingResult = shading(ray, hitInfo, scene, bvh);
-
-        shade(level, ray, color, scene, bvh, hitInfo);
-    }
-    else
-    {
-        // Draw a red debug ray if the ray missed.
-        drawRay(ray, glm::vec3(1.0f, 0.0f, 0.0f));
-        // Set the color of the pixel to black if the ray misses.
-        color = glm::vec3(0.0f);
-    }
-}
-
-// NOTE(Mathijs): separate function to make recursion easier (could also be done with lambda + std::function).
-static glm::vec3 getFinalColor(const Scene &scene, const BoundingVolumeHierarchy &bvh, Ray ray)
-{
-    //std::cout << "called" << std::endl;
-    glm::vec3 color;
-
-    //Bug Example
-    //ray.origin = {0.0268146, 0.313131, 0.523811};
-    //ray.direction = {0.2711, 0.416066, -0.867983};
-
-    trace(0, ray, color, scene, bvh);
-
-    return color;
-}
-// static glm::vec3 getFinalColor(const Scene &scene, const BoundingVolumeHierarchy &bvh, Ray ray)
-// {
-//     HitInfo hitInfo;
-//     if (bvh.intersect(ray, hitInfo))
-//     {
-//         // Draw a white debug ray.
-//         drawRay(ray, glm::vec3(1.0f));
-static void blurEffect(const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh, Screen &screen, std::vector<glm::vec3> &matrixPixels)
-{
-
-    // Trackball cameraNew = camera;
-    // float var_ = 0.01f;
-    // for (size_t i = 0; i < 15; i++)
-    // {
-    //     cameraNew.setLookAt(glm::vec3(var_, 0, 0));
-    //     for (int y = 0; y < windowResolution.y; y++)
-    //     {
-    //         for (int x = 0; x != windowResolution.x; x++)
-    //         {
-    //             // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-    //             const glm::vec2 normalizedPixelPos{
-    //                 float(x) / windowResolution.x * 2.0f - 1.0f,
-    //                 float(y) / windowResolution.y * 2.0f - 1.0f};
-    //             const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-    //             glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-    //             matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-    //         }
-    //     }
-    //     var_ += 0.01f;
-    // }
-
-    Trackball cameraNew = camera;
-    cameraNew.setLookAt(glm::vec3(0.01, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.02, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.03, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.04, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.05, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.06, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.07, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.08, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.09, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.10, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.11, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.12, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.13, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.14, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-        }
-    }
-
-    cameraNew.setLookAt(glm::vec3(0.15, 0, 0));
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-
-            matrixPixels.at(y * windowResolution.x + x) += getFinalColor(scene, bvh, cameraRay);
-            screen.setPixel(x, y, glm::vec3(matrixPixels.at(y * windowResolution.x + x).x / 16, matrixPixels.at(y * windowResolution.x + x).y / 16, matrixPixels.at(y * windowResolution.x + x).z / 16));
-        }
-    }
-}
-
-static void bloomEffect(std::vector<glm::vec3> &matrixPixels, std::vector<glm::vec3> &matrixColorsScreen, Screen &screen, const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh)
-{
-    int counter = 1;
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            counter = 1;
-            for (int i = -10; i < 11; i++)
-            {
-                if (y + i < 0 || y + i > windowResolution.y - 1)
-                    continue;
-                else
-                {
-                    for (int j = -10; j < 11; j++)
-                    {
-                        if (i == 0 && j == 0)
-                            continue;
-                        if (x + j < 0 || x + j > windowResolution.x - 1)
-                            continue;
-                        else
-                        {
-                            matrixColorsScreen.at((y * windowResolution.x) + x) += matrixColorsScreen.at(((y + i) * windowResolution.x) + (x + j));
-                            counter++;
-                        }
-                    }
-                }
-            }
-            matrixColorsScreen.at((y * windowResolution.x) + x) = glm::vec3(matrixColorsScreen.at((y * windowResolution.x) + x).x / counter, matrixColorsScreen.at((y * windowResolution.x) + x).y / counter, matrixColorsScreen.at((y * windowResolution.x) + x).z / counter);
-
-            const glm::vec2 normalizedPixelPos{
-                float(x) / windowResolution.x * 2.0f - 1.0f,
-                float(y) / windowResolution.y * 2.0f - 1.0f};
-            const Ray cameraRay = camera.generateRay(normalizedPixelPos);
-            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
-            if (bloom == true)
-            {
-                screen.setPixel(x, y, matrixColorsScreen.at((y * windowResolution.x) + x) + color);
-                matrixPixels.at(y * windowResolution.x + x) += matrixColorsScreen.at((y * windowResolution.x) + x) + color;
-            }
-        }
-    }
-}
-//         // Get the resulting shading
-//         glm::vec3 shadingResult = shading(ray, hitInfo, scene);
-
-//         // Set the color of the pixel to white if the ray hits.
-//         return shadingResult;
-//     }
-//     else
-//     {
-//         // Draw a red debug ray if the ray missed.
-//         drawRay(ray, glm::vec3(1.0f, 0.0f, 0.0f));
-//         // Set the color of the pixel to black if the ray misses.
-//         return glm::vec3(0.0f);
-//     }
-// }
-
 static void setOpenGLMatrices(const Trackball &camera);
 static void renderOpenGL(const Scene &scene, const Trackball &camera, int selectedLight);
 
-// This is the main rendering function. You are free to change this function in any way (including the function signature).
-static void renderRayTracing(const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh, Screen &screen)
-{
-    std::vector<glm::vec3> matrixColorsScreen(windowResolution.x * windowResolution.y + 1);
-    std::vector<glm::vec3> matrixPixels(windowResolution.x * windowResolution.y + 1);
-
-#ifdef USE_OPENMP
-#pragma omp parallel for
-#endif
-    for (int y = 0; y < windowResolution.y; y++)
-    {
-        for (int x = 0; x != windowResolution.x; x++)
-        {
-            glm::vec3 color;
-            Ray cameraRay;
-
-            if (antiAliasing)
-            {
-                float level = 2.0f;
-                for (int y_continued = y * level; y_continued < 2 + (level * y); y_continued++)
-                {
-                    for (int x_continued = x * level; x_continued < 2 + (level * x); x_continued++)
-                    {
-                        const glm::vec2 normalizedPixelPos{
-                            float(x_continued) / windowResolution.x * (2.0f / level) - 1.0f,
-                            float(y_continued) / windowResolution.y * (2.0f / level) - 1.0f};
-                        const Ray cameraRay = camera.generateRay(normalizedPixelPos);
-                        color = color + getFinalColor(scene, bvh, cameraRay);
-                        if (bloom)
-                        {
-                            matrixPixels.at(y * windowResolution.x + x) = getFinalColor(scene, bvh, cameraRay);
-                            if (color.x + color.y + color.z > 1)
-                                matrixColorsScreen.at(y * windowResolution.x + x) = getFinalColor(scene, bvh, cameraRay);
-                            else
-                                matrixColorsScreen.at(y * windowResolution.x + x) = glm::vec3((0));
-                        }
-                    }
-                }
-                color = color / (level * 2.5f);
-                screen.setPixel(x, y, color);
-            }
-            else
-            {
-                // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
-                const glm::vec2 normalizedPixelPos{
-                    float(x) / windowResolution.x * 2.0f - 1.0f,
-                    float(y) / windowResolution.y * 2.0f - 1.0f};
-                cameraRay = camera.generateRay(normalizedPixelPos);
-                color = getFinalColor(scene, bvh, cameraRay);
-                screen.setPixel(x, y, color);
-
-                if (bloom)
-                {
-                    matrixPixels.at(y * windowResolution.x + x) = getFinalColor(scene, bvh, cameraRay);
-                    if (color.x + color.y + color.z > 1)
-                        matrixColorsScreen.at(y * windowResolution.x + x) = getFinalColor(scene, bvh, cameraRay);
-                    else
-                        matrixColorsScreen.at(y * windowResolution.x + x) = glm::vec3((0));
-                }
-            }
-        }
-    }
-    //mean over pixels 20x20
-    //https://developer.nvidia.com/gpugems/gpugems/part-iv-image-processing/chapter-21-real-time-glow
-
-    if (bloom)
-    {
-        bloomEffect(matrixPixels, matrixColorsScreen, screen, scene, camera, bvh);
-    }
-    if (blur)
-    {
-        blurEffect(scene, camera, bvh, screen, matrixPixels);
-    }
-}
-
 int main(int argc, char **argv)
 {
     Trackball::printHelp();
@@ -732,8 +68,8 @@ int main(int argc, char **argv)
 
     SceneType sceneType{SceneType::SingleTriangle};
     std::optional<Ray> optDebugRay;
-    Scene scene = loadScene(sceneType, dataPath);
-    BoundingVolumeHierarchy bvh{&scene};
+    Scene scene = loadScene(sceneType, dataPath, meshLoadSettings);
+    BoundingVolumeHierarchy bvh{&scene, bvhCachePath, bvhBuildSettings};
 
     int bvhDebugLevel = 0;
     bool debugBVH{false};
@@ -769,12 +105,65 @@ int main(int argc, char **argv)
         // === Setup the UI ===
         ImGui::Begin("Final Project - Part 2");
         {
-            constexpr std::array items{"SingleTriangle", "Cube", "Cornell Box (with mirror)", "Cornell Box (spherical light and mirror)", "Monkey", "Dragon", /* "AABBs",*/ "Spheres", /*"Mixed",*/ "Custom"};
-            if (ImGui::Combo("Scenes", reinterpret_cast<int *>(&sceneType), items.data(), int(items.size())))
+            constexpr std::array items{"SingleTriangle", "Cube", "Cornell Box (with mirror)", "Cornell Box (spherical light and mirror)", "Monkey", "Dragon", /* "AABBs",*/ "Spheres", /*"Mixed",*/ "Crowd", "Custom"};
+            bool reloadScene = ImGui::Combo("Scenes", reinterpret_cast<int *>(&sceneType), items.data(), int(items.size()));
+            constexpr std::array importers{"Assimp", "Native OBJ parser"};
+            reloadScene |= ImGui::Combo("Mesh importer", reinterpret_cast<int *>(&meshLoadSettings.importer), importers.data(), int(importers.size()));
+            constexpr std::array caches{"Disabled", "Read", "Memory mapped"};
+            reloadScene |= ImGui::Combo("Mesh cache", reinterpret_cast<int *>(&meshLoadSettings.cache), caches.data(), int(caches.size()));
+            constexpr std::array splitMethods{"Median", "Object SAH", "Spatial SAH (SBVH)"};
+            bool rebuildBvh = ImGui::Combo("BVH split method", reinterpret_cast<int *>(&bvhBuildSettings.splitMethod), splitMethods.data(), int(splitMethods.size()));
+            // the sliders only rebuild the BVH when they are released
+            int maxLeafPrimitives = int(bvhBuildSettings.maxLeafPrimitives);
+            if (ImGui::SliderInt("Max leaf primitives", &maxLeafPrimitives, 1, 64))
+            {
+                bvhBuildSettings.maxLeafPrimitives = uint32_t(maxLeafPrimitives);
+            }
+            rebuildBvh |= ImGui::IsItemDeactivatedAfterEdit();
+            ImGui::SliderInt("Max BVH depth", &bvhBuildSettings.maxDepth, 1, 64);
+            rebuildBvh |= ImGui::IsItemDeactivatedAfterEdit();
+            rebuildBvh |= ImGui::Checkbox("Restructure treelets", &bvhBuildSettings.restructureTreelets);
+            if (bvhBuildSettings.splitMethod != BvhSplitMethod::Median || bvhBuildSettings.restructureTreelets)
+            {
+                ImGui::SliderFloat("SAH traversal cost", &bvhBuildSettings.traversalCost, 0.1f, 10.0f);
+                rebuildBvh |= ImGui::IsItemDeactivatedAfterEdit();
+            }
+            if (bvhBuildSettings.splitMethod != BvhSplitMethod::Median)
+            {
+                ImGui::SliderFloat("SAH intersection cost", &bvhBuildSettings.intersectionCost, 0.1f, 10.0f);
+                rebuildBvh |= ImGui::IsItemDeactivatedAfterEdit();
+            }
+            if (bvhBuildSettings.splitMethod == BvhSplitMethod::SpatialSah)
+            {
+                ImGui::SliderFloat("Spatial split budget", &bvhBuildSettings.spatialSplitBudget, 0.0f, 1.0f);
+                rebuildBvh |= ImGui::IsItemDeactivatedAfterEdit();
+            }
+            if (reloadScene)
             {
                 optDebugRay.reset();
-                scene = loadScene(sceneType, dataPath);
-                bvh = BoundingVolumeHierarchy(&scene);
+                using clock = std::chrono::high_resolution_clock;
+                const auto start = clock::now();
+                scene = loadScene(sceneType, dataPath, meshLoadSettings);
+                std::cout << "Time to load scene: " << std::chrono::duration<float, std::milli>(clock::now() - start).count() << " milliseconds" << std::endl;
+            }
+            if (reloadScene || rebuildBvh)
+            {
+                bvh = BoundingVolumeHierarchy(&scene, bvhCachePath, bvhBuildSettings);
+                bvh.setGeometryFormat(geometryFormat);
+                if (const BvhBuildStatistics &statistics = bvh.buildStatistics(); statistics.milliseconds > 0.0f)
+                {
+                    std::cout << "Time to build BVH: " << statistics.milliseconds << " milliseconds (" << statistics.arenaPeakBytes / 1024
+                              << " KB of scratch memory in " << statistics.arenaBlocks << " arena blocks";
+                    if (statistics.spatialSplits > 0)
+                    {
+                        std::cout << ", " << statistics.spatialSplits << " spatial splits adding " << statistics.duplicatedReferences << " references";
+                    }
+                    if (bvhBuildSettings.restructureTreelets)
+                    {
+                        std::cout << ", " << statistics.restructuredTreelets << " treelets restructured in " << statistics.restructureMilliseconds << " ms";
+                    }
+                    std::cout << ")" << std::endl;
+                }
                 if (optDebugRay)
                 {
                     HitInfo dummy{};
@@ -783,20 +172,68 @@ int main(int argc, char **argv)
             }
         }
         {
-            constexpr std::array items{"Rasterization", "Ray Traced"};
+            constexpr std::array items{"Rasterization", "Ray Traced", "BVH Traversal Cost"};
             ImGui::Combo("View mode", reinterpret_cast<int *>(&viewMode), items.data(), int(items.size()));
         }
+        {
+            constexpr std::array items{"Full (32-bit floats)", "Quantized (16-bit)"};
+            if (ImGui::Combo("Geometry format", reinterpret_cast<int *>(&geometryFormat), items.data(), int(items.size())))
+            {
+                bvh.setGeometryFormat(geometryFormat);
+                std::cout << "Geometry read by the BVH traversal: " << bvh.geometryBytes() / 1024 << " KB" << std::endl;
+            }
+        }
+        if (viewMode == ViewMode::TraversalCost)
+        {
+            constexpr std::array items{"Nodes + triangles", "Nodes visited", "Triangles tested"};
+            ImGui::Combo("Heatmap metric", reinterpret_cast<int *>(&heatmapMetric), items.data(), int(items.size()));
+        }
         if (ImGui::Button("Render to file"))
         {
+            if (viewMode == ViewMode::TraversalCost)
+            {
+                const auto [maxCost, averageCost] = renderTraversalCost(scene, camera, bvh, screen, heatmapMetric);
+                std::cout << "Traversal cost per primary ray: max " << maxCost << ", average " << averageCost << std::endl;
+                screen.writeBitmapToFile(outputPath / "traversal_cost.bmp");
+            }
+            else
             {
                 using clock = std::chrono::high_resolution_clock;
+                resetRayStatistics();
                 const auto start = clock::now();
-                renderRayTracing(scene, camera, bvh, screen);
+                samplingStatistics = renderRayTracing(scene, camera, bvh, screen, renderSettings);
                 const auto end = clock::now();
-                std::cout << "Time to render image: " << std::chrono::duration<float, std::milli>(end - start).count() << " milliseconds" << std::endl;
+                frameMilliseconds = std::chrono::duration<float, std::milli>(end - start).count();
+                frameRayStatistics = collectRayStatistics();
+                std::cout << "Time to render image: " << frameMilliseconds << " milliseconds" << std::endl;
+                printRayStatistics(std::cout, frameRayStatistics, frameMilliseconds);
+                if (renderSettings.adaptiveAntiAliasing)
+                {
+                    std::cout << "Adaptive anti aliasing: " << samplingStatistics.raysSpent << " camera rays ("
+                              << samplingStatistics.refinedPixels << " pixels refined), uniform supersampling: "
+                              << samplingStatistics.raysUniform << " camera rays" << std::endl;
+                }
+                screen.writeBitmapToFile(outputPath / "render.bmp");
+            }
+        }
+        if (frameMilliseconds > 0.0f)
+        {
+            ImGui::Text("Time to render image: %.1f milliseconds", double(frameMilliseconds));
+#ifdef USE_RAY_STATISTICS
+            const double seconds = double(frameMilliseconds) / 1000.0;
+            for (const RayCounter counter : {RayCounter::PrimaryRays, RayCounter::ShadowRays, RayCounter::ReflectionRays})
+            {
+                ImGui::Text("%s: %llu (%.2f Mrays/s)", rayCounterName(counter), static_cast<unsigned long long>(frameRayStatistics[counter]),
+                            double(frameRayStatistics[counter]) / seconds * 1e-6);
+            }
+            ImGui::Text("All rays: %.2f Mrays/s", double(frameRayStatistics.totalRays()) / seconds * 1e-6);
+            for (const RayCounter counter : {RayCounter::BoxTests, RayCounter::TriangleTests, RayCounter::SphereTests})
+            {
+                ImGui::Text("%s: %llu", rayCounterName(counter), static_cast<unsigned long long>(frameRayStatistics[counter]));
             }
-            screen.writeBitmapToFile(outputPath / "render.bmp");
+#endif
         }
+
         ImGui::Spacing();
         ImGui::Separator();
         ImGui::Text("Debugging");
@@ -875,11 +312,46 @@ int main(int argc, char **argv)
             selectedLight = 0;
         }
 
-        (ImGui::Checkbox("Add Anti Aliasing", &antiAliasing));
+        (ImGui::Checkbox("Add Anti Aliasing", &renderSettings.antiAliasing));
 
-        (ImGui::Checkbox("Add bloom", &bloom));
+        (ImGui::Checkbox("Adaptive Anti Aliasing", &renderSettings.adaptiveAntiAliasing));
+        if (renderSettings.adaptiveAntiAliasing)
+        {
+            ImGui::SliderInt("Max samples per pixel", &renderSettings.adaptiveSampling.maxSamplesPerPixel, 2, 64);
+            ImGui::SliderFloat("Contrast threshold", &renderSettings.adaptiveSampling.contrastThreshold, 0.0f, 0.5f);
+            if (samplingStatistics.raysUniform > 0)
+            {
+                ImGui::Text("Camera rays: %llu (uniform: %llu, %.1f%%)", static_cast<unsigned long long>(samplingStatistics.raysSpent),
+                            static_cast<unsigned long long>(samplingStatistics.raysUniform),
+                            100.0 * double(samplingStatistics.raysSpent) / double(samplingStatistics.raysUniform));
+            }
+        }
 
-        (ImGui::Checkbox("Add motion blur", &blur));
+        if (!renderSettings.antiAliasing && !renderSettings.adaptiveAntiAliasing)
+        {
+            ImGui::Checkbox("Wavefront rendering", &renderSettings.wavefront);
+            if (renderSettings.wavefront)
+                ImGui::Checkbox("Sort secondary rays", &renderSettings.sortSecondaryRays);
+        }
+        if (!renderSettings.antiAliasing && !renderSettings.adaptiveAntiAliasing && !renderSettings.wavefront)
+        {
+            constexpr std::array items{"Off (single rays)", "4x4 pixels", "8x8 pixels"};
+            int packetMode = renderSettings.rayPacketSize / 4;
+            if (ImGui::Combo("Primary ray packets", &packetMode, items.data(), int(items.size())))
+            {
+                renderSettings.rayPacketSize = packetMode * 4;
+            }
+        }
+
+        ImGui::SliderFloat("Aperture radius", &renderSettings.lens.apertureRadius, 0.0f, 0.2f);
+        if (renderSettings.lens.apertureRadius > 0.0f)
+        {
+            ImGui::SliderFloat("Focus distance", &renderSettings.lens.focusDistance, 0.1f, 10.0f);
+        }
+
+        (ImGui::Checkbox("Add bloom", &renderSettings.bloom));
+
+        (ImGui::Checkbox("Add motion blur", &renderSettings.blur));
 
         // Clear screen.
         glClearDepth(1.0f);
@@ -906,12 +378,24 @@ int main(int argc, char **argv)
         break;
         case ViewMode::RayTracing:
         {
+            using clock = std::chrono::high_resolution_clock;
             screen.clear(glm::vec3(0.0f));
-            renderRayTracing(scene, camera, bvh, screen);
+            resetRayStatistics();
+            const auto start = clock::now();
+            samplingStatistics = renderRayTracing(scene, camera, bvh, screen, renderSettings);
+            frameMilliseconds = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+            frameRayStatistics = collectRayStatistics();
             screen.setPixel(0, 0, glm::vec3(1.0f));
             screen.draw(); // Takes the image generated using ray tracing and outputs it to the screen using OpenGL.
         }
         break;
+        case ViewMode::TraversalCost:
+        {
+            screen.clear(glm::vec3(0.0f));
+            renderTraversalCost(scene, camera, bvh, screen, heatmapMetric);
+            screen.draw();
+        }
+        break;
         default:
             break;
         };
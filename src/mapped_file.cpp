@@ -0,0 +1,80 @@
+#include "mapped_file.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& file)
+{
+    HANDLE fileHandle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    std::shared_ptr<MappedFile> pResult { new MappedFile() };
+    pResult->m_fileHandle = fileHandle;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0)
+        return nullptr;
+    pResult->m_mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!pResult->m_mappingHandle)
+        return nullptr;
+    pResult->m_pData = static_cast<std::byte*>(MapViewOfFile(pResult->m_mappingHandle, FILE_MAP_COPY, 0, 0, 0));
+    if (!pResult->m_pData)
+        return nullptr;
+    pResult->m_size = size_t(size.QuadPart);
+    return pResult;
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_pData)
+        UnmapViewOfFile(m_pData);
+    if (m_mappingHandle)
+        CloseHandle(m_mappingHandle);
+    if (m_fileHandle)
+        CloseHandle(m_fileHandle);
+}
+#else
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& file)
+{
+    const int fileDescriptor = ::open(file.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+        return nullptr;
+
+    struct stat fileStatus;
+    if (fstat(fileDescriptor, &fileStatus) != 0 || fileStatus.st_size == 0) {
+        close(fileDescriptor);
+        return nullptr;
+    }
+
+    // The mapping stays valid after closing the file descriptor.
+    void* pData = mmap(nullptr, size_t(fileStatus.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (pData == MAP_FAILED)
+        return nullptr;
+
+    std::shared_ptr<MappedFile> pResult { new MappedFile() };
+    pResult->m_pData = static_cast<std::byte*>(pData);
+    pResult->m_size = size_t(fileStatus.st_size);
+    return pResult;
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_pData)
+        munmap(m_pData, m_size);
+}
+#endif
+
+gsl::span<std::byte> MappedFile::data() const
+{
+    return { m_pData, m_size };
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "disable_all_warnings.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <gsl-lite/gsl-lite.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+// A whole file mapped into memory. The mapping is private (copy-on-write): writes through data() are
+// visible to this process only and never reach the file. Pages are read lazily when first touched.
+class MappedFile {
+public:
+    // Returns nullptr (without printing anything) if the file does not exist or cannot be mapped.
+    static std::shared_ptr<MappedFile> open(const std::filesystem::path& file);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    gsl::span<std::byte> data() const;
+
+private:
+    MappedFile() = default;
+
+    std::byte* m_pData { nullptr };
+    size_t m_size { 0 };
+#ifdef _WIN32
+    void* m_fileHandle { nullptr };
+    void* m_mappingHandle { nullptr };
+#endif
+};
@@ -1,5 +1,7 @@
 #include "mesh.h"
 #include "disable_all_warnings.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
 // Disable compiler warnings in third-party code (which we cannot change).
 DISABLE_WARNINGS_PUSH()
 #include <assimp/Importer.hpp>
@@ -13,12 +15,19 @@ DISABLE_WARNINGS_PUSH()
 DISABLE_WARNINGS_POP()
 #include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <exception>
+#include <fstream>
 #include <iostream>
 #include <numeric>
 #include <stack>
 #include <string>
+#include <system_error>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
 
 static glm::mat4 assimpMatrix(const aiMatrix4x4& m)
 {
@@ -54,13 +63,209 @@ static glm::vec3 assimpVec(const aiColor3D& c)
 }
 
 static void centerAndScaleToUnitMesh(gsl::span<Mesh> meshes);
+static Model loadMeshAssimp(const std::filesystem::path& file, bool centerAndNormamlize);
 
-std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNormamlize)
+// Binary mesh cache, stored next to the source file. The cache holds the meshes exactly as loadMesh
+// returns them (after normalization) and is only used when the size and modification time of the
+// source file match the ones it was created from. Layout (native endianness):
+//   MeshCacheHeader | Material[numMaterials] | MeshCacheEntry[numMeshes]
+//   | per mesh: vec3 positions[numVertices] vec3 normals[numVertices] Triangle[numTriangles]
+static constexpr char meshCacheMagic[8] = { 'C', 'G', 'M', 'E', 'S', 'H', '\0', '\0' };
+static constexpr uint32_t meshCacheVersion = 4;
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t normalized;
+    uint32_t importer;
+    uint32_t numMaterials;
+    uint64_t sourceSize;
+    int64_t sourceModificationTime;
+    uint64_t numMeshes;
+};
+
+struct MeshCacheEntry {
+    uint32_t materialId;
+    uint32_t padding;
+    uint64_t numVertices;
+    uint64_t numTriangles;
+};
+
+static_assert(std::is_trivially_copyable_v<glm::vec3> && sizeof(glm::vec3) == 3 * sizeof(float));
+static_assert(std::is_trivially_copyable_v<Triangle> && sizeof(Triangle) == 3 * sizeof(uint32_t));
+static_assert(std::is_trivially_copyable_v<Material> && sizeof(Material) == 8 * sizeof(float));
+
+static std::filesystem::path meshCachePath(const std::filesystem::path& file, bool centerAndNormamlize)
+{
+    std::filesystem::path cacheFile = file;
+    cacheFile += centerAndNormamlize ? ".normalized.meshcache" : ".meshcache";
+    return cacheFile;
+}
+
+// Header that a valid cache of the given source file must start with.
+static MeshCacheHeader expectedMeshCacheHeader(const std::filesystem::path& file, bool centerAndNormamlize, MeshImporter importer)
+{
+    MeshCacheHeader header {};
+    std::memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+    header.version = meshCacheVersion;
+    header.normalized = centerAndNormamlize;
+    header.importer = uint32_t(importer);
+    header.sourceSize = std::filesystem::file_size(file);
+    header.sourceModificationTime = std::filesystem::last_write_time(file).time_since_epoch().count();
+    return header;
+}
+
+// Returns false (and leaves meshes untouched) if the cache is missing, stale or corrupt.
+static bool readMeshCache(const std::filesystem::path& cacheFile, const MeshCacheHeader& expectedHeader, MeshCache cache, Model& model)
+{
+    std::shared_ptr<MappedFile> pMappedFile;
+    std::vector<std::byte> buffer;
+    gsl::span<std::byte> bytes;
+    if (cache == MeshCache::Mapped) {
+        // Only the pages that are accessed later on are actually read from disk.
+        pMappedFile = MappedFile::open(cacheFile);
+        if (!pMappedFile)
+            return false;
+        bytes = pMappedFile->data();
+    } else {
+        // Read the whole file at once and decode from memory.
+        std::error_code error;
+        const uintmax_t fileSize = std::filesystem::file_size(cacheFile, error);
+        if (error)
+            return false;
+        buffer.resize(fileSize);
+        std::ifstream stream { cacheFile, std::ios::binary };
+        if (!stream.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(buffer.size())))
+            return false;
+        bytes = buffer;
+    }
+    if (bytes.size() < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::memcmp(header.magic, expectedHeader.magic, sizeof(header.magic)) != 0 || header.version != expectedHeader.version
+        || header.normalized != expectedHeader.normalized || header.importer != expectedHeader.importer || header.sourceSize != expectedHeader.sourceSize
+        || header.sourceModificationTime != expectedHeader.sourceModificationTime)
+        return false;
+
+    size_t offset = sizeof(MeshCacheHeader);
+    if (header.numMaterials > (bytes.size() - offset) / sizeof(Material))
+        return false;
+    std::vector<Material> materials(header.numMaterials);
+    if (!materials.empty())
+        std::memcpy(materials.data(), bytes.data() + offset, materials.size() * sizeof(Material));
+    offset += materials.size() * sizeof(Material);
+
+    if (header.numMeshes > (bytes.size() - offset) / sizeof(MeshCacheEntry))
+        return false;
+    std::vector<MeshCacheEntry> entries(header.numMeshes);
+    if (!entries.empty())
+        std::memcpy(entries.data(), bytes.data() + offset, entries.size() * sizeof(MeshCacheEntry));
+    offset += entries.size() * sizeof(MeshCacheEntry);
+
+    std::vector<Mesh> out(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        // Divide instead of multiplying the counts from the file, which could wrap around for a corrupt cache.
+        if (entries[i].numVertices > (bytes.size() - offset) / (2 * sizeof(glm::vec3)))
+            return false;
+        const size_t attributeBytes = entries[i].numVertices * sizeof(glm::vec3);
+        if (entries[i].numTriangles > (bytes.size() - offset - 2 * attributeBytes) / sizeof(Triangle))
+            return false;
+        const size_t triangleBytes = entries[i].numTriangles * sizeof(Triangle);
+
+        // The offsets are multiples of 4 bytes and the file is mapped at a page boundary, so the
+        // pointers are suitably aligned.
+        glm::vec3* pPositions = reinterpret_cast<glm::vec3*>(bytes.data() + offset);
+        glm::vec3* pNormals = reinterpret_cast<glm::vec3*>(bytes.data() + offset + attributeBytes);
+        Triangle* pTriangles = reinterpret_cast<Triangle*>(bytes.data() + offset + 2 * attributeBytes);
+        if (entries[i].materialId >= materials.size())
+            return false;
+        out[i].materialId = entries[i].materialId;
+        if (pMappedFile) {
+            out[i].positions = MeshBuffer<glm::vec3>(pMappedFile, pPositions, entries[i].numVertices);
+            out[i].normals = MeshBuffer<glm::vec3>(pMappedFile, pNormals, entries[i].numVertices);
+            out[i].triangles = MeshBuffer<Triangle>(pMappedFile, pTriangles, entries[i].numTriangles);
+        } else {
+            out[i].positions = MeshBuffer<glm::vec3>(pPositions, pPositions + entries[i].numVertices);
+            out[i].normals = MeshBuffer<glm::vec3>(pNormals, pNormals + entries[i].numVertices);
+            out[i].triangles = MeshBuffer<Triangle>(pTriangles, pTriangles + entries[i].numTriangles);
+        }
+        offset += 2 * attributeBytes + triangleBytes;
+    }
+
+    model = Model { std::move(out), std::move(materials) };
+    return true;
+}
+
+static void writeMeshCache(const std::filesystem::path& cacheFile, MeshCacheHeader header, const Model& model)
+{
+    const std::vector<Mesh>& meshes = model.meshes;
+    header.numMaterials = uint32_t(model.materials.size());
+    header.numMeshes = meshes.size();
+    // Write to a temporary file first so that an interrupted write never leaves a truncated cache behind.
+    std::filesystem::path tmpFile = cacheFile;
+    tmpFile += ".tmp";
+    {
+        std::ofstream stream { tmpFile, std::ios::binary };
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(model.materials.data()), std::streamsize(model.materials.size() * sizeof(Material)));
+        for (const Mesh& mesh : meshes) {
+            const MeshCacheEntry entry { mesh.materialId, 0, mesh.positions.size(), mesh.triangles.size() };
+            stream.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        }
+        for (const Mesh& mesh : meshes) {
+            stream.write(reinterpret_cast<const char*>(mesh.positions.data()), std::streamsize(mesh.positions.size() * sizeof(glm::vec3)));
+            stream.write(reinterpret_cast<const char*>(mesh.normals.data()), std::streamsize(mesh.normals.size() * sizeof(glm::vec3)));
+            stream.write(reinterpret_cast<const char*>(mesh.triangles.data()), std::streamsize(mesh.triangles.size() * sizeof(Triangle)));
+        }
+        if (!stream) {
+            // Not fatal (e.g. read-only data directory), the mesh will simply be imported again next time.
+            std::cerr << "Could not write mesh cache " << cacheFile << std::endl;
+            stream.close();
+            std::filesystem::remove(tmpFile);
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpFile, cacheFile, error);
+    if (error)
+        std::filesystem::remove(tmpFile, error);
+}
+
+static Model importMesh(const std::filesystem::path& file, bool centerAndNormamlize, MeshImporter importer)
+{
+    if (importer == MeshImporter::Native && file.extension() == ".obj") {
+        Model out = loadObj(file);
+        if (centerAndNormamlize)
+            centerAndScaleToUnitMesh(out.meshes);
+        return out;
+    }
+    return loadMeshAssimp(file, centerAndNormamlize);
+}
+
+Model loadMesh(const std::filesystem::path& file, bool centerAndNormamlize, const MeshLoadSettings& settings)
 {
     if (!std::filesystem::exists(file)) {
         std::cerr << "File " << file << " does not exist." << std::endl;
         throw std::exception();
     }
+    if (settings.cache == MeshCache::Disabled)
+        return importMesh(file, centerAndNormamlize, settings.importer);
+
+    const std::filesystem::path cacheFile = meshCachePath(file, centerAndNormamlize);
+    const MeshCacheHeader header = expectedMeshCacheHeader(file, centerAndNormamlize, settings.importer);
+    Model out;
+    if (readMeshCache(cacheFile, header, settings.cache, out))
+        return out;
+
+    out = importMesh(file, centerAndNormamlize, settings.importer);
+    writeMeshCache(cacheFile, header, out);
+    return out;
+}
+
+static Model loadMeshAssimp(const std::filesystem::path& file, bool centerAndNormamlize)
+{
 
     Assimp::Importer importer;
     const aiScene* pAssimpScene = importer.ReadFile(file.string().c_str(), aiProcess_GenNormals | aiProcess_Triangulate);
@@ -70,7 +275,9 @@ std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNorm
         throw std::exception();
     }
 
-    std::vector<Mesh> out;
+    Model out;
+    // Index into out.materials of every Assimp material that is used by at least one mesh.
+    std::unordered_map<unsigned, uint32_t> materialIds;
 
     std::stack<std::tuple<aiNode*, glm::mat4>> stack;
     stack.push({ pAssimpScene->mRootNode, assimpMatrix(pAssimpScene->mRootNode->mTransformation) });
@@ -90,6 +297,9 @@ std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNorm
 
             // Process triangles in sub mesh.
             Mesh mesh;
+            mesh.triangles.reserve(pAssimpMesh->mNumFaces);
+            mesh.positions.reserve(pAssimpMesh->mNumVertices);
+            mesh.normals.reserve(pAssimpMesh->mNumVertices);
             for (unsigned j = 0; j < pAssimpMesh->mNumFaces; j++) {
                 const aiFace& face = pAssimpMesh->mFaces[j];
                 if (face.mNumIndices != 3) {
@@ -102,9 +312,14 @@ std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNorm
 
             // Process vertices in sub mesh.
             for (unsigned j = 0; j < pAssimpMesh->mNumVertices; j++) {
-                const glm::vec3 pos = matrix * glm::vec4(assimpVec(pAssimpMesh->mVertices[j]), 1.0f);
-                const glm::vec3 normal = normalMatrix * assimpVec(pAssimpMesh->mNormals[j]);
-                mesh.vertices.push_back(Vertex { pos, normal });
+                mesh.positions.push_back(matrix * glm::vec4(assimpVec(pAssimpMesh->mVertices[j]), 1.0f));
+                mesh.normals.push_back(normalMatrix * assimpVec(pAssimpMesh->mNormals[j]));
+            }
+
+            if (auto iter = materialIds.find(pAssimpMesh->mMaterialIndex); iter != std::end(materialIds)) {
+                mesh.materialId = iter->second;
+                out.meshes.emplace_back(std::move(mesh));
+                continue;
             }
 
             // Read the material, more info can be found here:
@@ -121,11 +336,15 @@ std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNorm
                 return value;
             };
 
-            mesh.material.kd = getMaterialColor(AI_MATKEY_COLOR_DIFFUSE);
-            mesh.material.ks = getMaterialColor(AI_MATKEY_COLOR_SPECULAR);
-            mesh.material.shininess = getMaterialFloat(AI_MATKEY_SHININESS);
-            mesh.material.transparency = getMaterialFloat(AI_MATKEY_OPACITY);
-            out.emplace_back(std::move(mesh));
+            Material material;
+            material.kd = getMaterialColor(AI_MATKEY_COLOR_DIFFUSE);
+            material.ks = getMaterialColor(AI_MATKEY_COLOR_SPECULAR);
+            material.shininess = getMaterialFloat(AI_MATKEY_SHININESS);
+            material.transparency = getMaterialFloat(AI_MATKEY_OPACITY);
+            mesh.materialId = uint32_t(out.materials.size());
+            materialIds[pAssimpMesh->mMaterialIndex] = mesh.materialId;
+            out.materials.push_back(material);
+            out.meshes.emplace_back(std::move(mesh));
         }
 
         for (unsigned i = 0; i < node->mNumChildren; i++) {
@@ -135,7 +354,7 @@ std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool centerAndNorm
     importer.FreeScene();
 
     if (centerAndNormamlize)
-        centerAndScaleToUnitMesh(out);
+        centerAndScaleToUnitMesh(out.meshes);
 
     return out;
 }
@@ -144,7 +363,7 @@ static void centerAndScaleToUnitMesh(gsl::span<Mesh> meshes)
 {
     std::vector<glm::vec3> positions;
     for (const auto& mesh : meshes)
-        std::transform(std::begin(mesh.vertices), std::end(mesh.vertices), std::back_inserter(positions), [](const Vertex& v) { return v.p; });
+        positions.insert(std::end(positions), std::begin(mesh.positions), std::end(mesh.positions));
     const glm::vec3 center = std::accumulate(std::begin(positions), std::end(positions), glm::vec3(0.0f)) / static_cast<float>(positions.size());
     float maxD = 0.0f;
     for (const glm::vec3& p : positions)
@@ -157,10 +376,7 @@ static void centerAndScaleToUnitMesh(gsl::span<Mesh> meshes)
 		[=](const Vertex& v) { return glm::length(v.pos - center); });*/
 
     for (auto& mesh : meshes) {
-        std::transform(std::begin(mesh.vertices), std::end(mesh.vertices), std::begin(mesh.vertices),
-            [=](Vertex v) {
-                v.p = (v.p - center) / maxD;
-                return v;
-            });
+        std::transform(std::begin(mesh.positions), std::end(mesh.positions), std::begin(mesh.positions),
+            [=](const glm::vec3& p) { return (p - center) / maxD; });
     }
 }
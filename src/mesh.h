@@ -1,5 +1,6 @@
 #pragma once
 #include "disable_all_warnings.h"
+#include "mesh_buffer.h"
 // Suppress warnings in third-party code.
 DISABLE_WARNINGS_PUSH()
 #include <glm/vec2.hpp>
@@ -9,11 +10,6 @@ DISABLE_WARNINGS_POP()
 #include <filesystem>
 #include <vector>
 
-struct Vertex {
-    glm::vec3 p; // Position.
-    glm::vec3 n; // Normal.
-};
-
 struct Material {
     glm::vec3 kd; // Diffuse color.
     glm::vec3 ks { 0.0f };
@@ -25,13 +21,42 @@ struct Material {
 using Triangle = glm::uvec3;
 
 struct Mesh {
-    // Vertices contain the vertex positions and normals of the mesh.
-    std::vector<Vertex> vertices;
+    // Vertex attributes are stored as separate arrays (structure of arrays) so that the BVH build and the
+    // intersection tests, which only need positions, do not pull normals into the cache.
+    MeshBuffer<glm::vec3> positions;
+    // Normals has the same size as positions; normals[i] is the normal of vertex i.
+    MeshBuffer<glm::vec3> normals;
     // Triangles are the indices of the vertices involved in a triangle.
     // A triangle, thus, contains a triplet of values corresponding to the 3 vertices of a triangle.
-    std::vector<Triangle> triangles;
+    MeshBuffer<Triangle> triangles;
+
+    // Index into the material table (Model::materials, Scene::materials).
+    uint32_t materialId { 0 };
+};
+
+// The meshes of a model file and the materials they use.
+struct Model {
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials;
+};
+
+// Which code parses the model file.
+enum class MeshImporter {
+    Assimp,
+    Native // Built-in multithreaded OBJ parser (see obj_loader.h); other file types still use Assimp.
+};
+
+// How loadMesh uses the binary cache ("<file>.meshcache") that it stores next to the model file.
+enum class MeshCache {
+    Disabled, // Always import the file with Assimp.
+    Read, // Read the cache into memory.
+    Mapped // Vertices and triangles are views into the memory mapped cache; only the pages that are used get loaded.
+};
 
-    Material material;
+struct MeshLoadSettings {
+    MeshImporter importer { MeshImporter::Assimp };
+    MeshCache cache { MeshCache::Mapped };
 };
 
-[[nodiscard]] std::vector<Mesh> loadMesh(const std::filesystem::path& file, bool normalize = false);
+// Loads all meshes of a model file, or takes them from the cache if it was created from the same file by the same importer.
+[[nodiscard]] Model loadMesh(const std::filesystem::path& file, bool normalize = false, const MeshLoadSettings& settings = {});
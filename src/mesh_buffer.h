@@ -0,0 +1,162 @@
+#pragma once
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Array of vertices or triangles of a mesh. Behaves like a std::vector, but can also be a view into a
+// memory mapped file (see loadMesh) so that large meshes are used in place instead of being copied.
+//
+// Elements of a view may be modified (the mapping is copy-on-write). Operations that change the size
+// first copy the view into memory owned by the buffer; copying a buffer always creates owned memory.
+template <typename T>
+class MeshBuffer {
+public:
+    static_assert(std::is_trivially_copyable_v<T>);
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    MeshBuffer() = default;
+    MeshBuffer(std::vector<T> values)
+        : m_storage(std::move(values))
+    {
+        syncWithStorage();
+    }
+    MeshBuffer(std::initializer_list<T> values)
+        : m_storage(values)
+    {
+        syncWithStorage();
+    }
+    template <typename InputIt>
+    MeshBuffer(InputIt first, InputIt last)
+        : m_storage(first, last)
+    {
+        syncWithStorage();
+    }
+    // View of size elements starting at pData, which points into pMappedFile.
+    MeshBuffer(std::shared_ptr<MappedFile> pMappedFile, T* pData, size_t size)
+        : m_pMappedFile(std::move(pMappedFile))
+        , m_pData(pData)
+        , m_size(size)
+    {
+    }
+
+    MeshBuffer(const MeshBuffer& other)
+        : m_storage(other.begin(), other.end())
+    {
+        syncWithStorage();
+    }
+    MeshBuffer(MeshBuffer&& other) noexcept
+        : m_storage(std::move(other.m_storage))
+        , m_pMappedFile(std::move(other.m_pMappedFile))
+        , m_pData(other.m_pData)
+        , m_size(other.m_size)
+    {
+        other.m_storage.clear();
+        other.syncWithStorage();
+    }
+    MeshBuffer& operator=(const MeshBuffer& other)
+    {
+        if (this != &other)
+            *this = MeshBuffer(other);
+        return *this;
+    }
+    MeshBuffer& operator=(MeshBuffer&& other) noexcept
+    {
+        m_storage = std::move(other.m_storage);
+        m_pMappedFile = std::move(other.m_pMappedFile);
+        m_pData = other.m_pData;
+        m_size = other.m_size;
+        other.m_storage.clear();
+        other.syncWithStorage();
+        return *this;
+    }
+
+    // True if the elements live in a memory mapped file.
+    bool isMapped() const { return m_pMappedFile != nullptr; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T* data() { return m_pData; }
+    const T* data() const { return m_pData; }
+    T& operator[](size_t i) { return m_pData[i]; }
+    const T& operator[](size_t i) const { return m_pData[i]; }
+    T& front() { return m_pData[0]; }
+    const T& front() const { return m_pData[0]; }
+    T& back() { return m_pData[m_size - 1]; }
+    const T& back() const { return m_pData[m_size - 1]; }
+
+    iterator begin() { return m_pData; }
+    iterator end() { return m_pData + m_size; }
+    const_iterator begin() const { return m_pData; }
+    const_iterator end() const { return m_pData + m_size; }
+
+    void push_back(const T& value)
+    {
+        detach();
+        m_storage.push_back(value);
+        syncWithStorage();
+    }
+    template <typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        detach();
+        m_storage.emplace_back(std::forward<Args>(args)...);
+        syncWithStorage();
+        return back();
+    }
+    template <typename InputIt>
+    iterator insert(const_iterator position, InputIt first, InputIt last)
+    {
+        const size_t offset = size_t(position - begin());
+        detach();
+        m_storage.insert(std::begin(m_storage) + offset, first, last);
+        syncWithStorage();
+        return begin() + offset;
+    }
+    void reserve(size_t capacity)
+    {
+        detach();
+        m_storage.reserve(capacity);
+        syncWithStorage();
+    }
+    void resize(size_t size)
+    {
+        detach();
+        m_storage.resize(size);
+        syncWithStorage();
+    }
+    void clear()
+    {
+        m_pMappedFile.reset();
+        m_storage.clear();
+        syncWithStorage();
+    }
+
+private:
+    // Turn a view into owned memory.
+    void detach()
+    {
+        if (!m_pMappedFile)
+            return;
+        m_storage.assign(m_pData, m_pData + m_size);
+        m_pMappedFile.reset();
+        syncWithStorage();
+    }
+    void syncWithStorage()
+    {
+        m_pData = m_storage.data();
+        m_size = m_storage.size();
+    }
+
+    std::vector<T> m_storage;
+    std::shared_ptr<MappedFile> m_pMappedFile;
+    // Either m_storage.data() or a pointer into m_pMappedFile.
+    T* m_pData { nullptr };
+    size_t m_size { 0 };
+};
@@ -0,0 +1,526 @@
+#include "obj_loader.h"
+#include "disable_all_warnings.h"
+#include "mapped_file.h"
+// Disable compiler warnings in third-party code (which we cannot change).
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+// Size of the chunks that are parsed in parallel. The split does not depend on the number of threads,
+// so the result is always the same.
+constexpr size_t chunkSize = size_t(1) << 20;
+
+// Indices as written in the file: 1-based, negative values are relative to the end of the list, 0 = absent.
+struct Corner {
+    int32_t position;
+    int32_t normal;
+};
+
+struct Face {
+    uint32_t firstCorner;
+    uint32_t numCorners;
+    // Number of positions / normals that were defined earlier in the same chunk (for relative indices).
+    uint32_t positionsBefore;
+    uint32_t normalsBefore;
+};
+
+// Statements that change the state of the parser, in the order they appear.
+struct Statement {
+    enum class Type {
+        Object,
+        Group,
+        UseMaterial,
+        MaterialLibrary
+    };
+    Type type;
+    size_t faceIndex; // Number of faces in the chunk before this statement.
+    std::string name;
+};
+
+struct Chunk {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<Corner> corners;
+    std::vector<Face> faces;
+    std::vector<Statement> statements;
+};
+
+struct FaceReference {
+    uint32_t chunk;
+    uint32_t face;
+};
+
+struct ObjMesh {
+    std::optional<std::string> material;
+    std::vector<FaceReference> faces;
+};
+
+struct ObjObject {
+    std::string name;
+    std::vector<ObjMesh> meshes;
+};
+
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* skipSpaces(const char* p, const char* pEnd)
+{
+    while (p != pEnd && isSpace(*p))
+        p++;
+    return p;
+}
+
+// Rest of the line without surrounding white space.
+std::string_view restOfLine(const char* p, const char* pEnd)
+{
+    p = skipSpaces(p, pEnd);
+    while (pEnd != p && isSpace(pEnd[-1]))
+        pEnd--;
+    return { p, size_t(pEnd - p) };
+}
+
+const char* parseFloat(const char* p, const char* pEnd, float& value)
+{
+    p = skipSpaces(p, pEnd);
+    if (p != pEnd && *p == '+')
+        p++;
+#ifdef __cpp_lib_to_chars
+    const auto [pNext, error] = std::from_chars(p, pEnd, value);
+    if (error != std::errc()) {
+        value = 0.0f;
+        return p;
+    }
+    return pNext;
+#else
+    // No std::from_chars for floating point (libstdc++ before GCC 11, older libc++). strtof needs a null terminated
+    // string, which the text of the mapped file is not, so the number is copied first.
+    std::array<char, 64> buffer;
+    size_t length = 0;
+    while (p + length != pEnd && length + 1 < buffer.size() && !isSpace(p[length])) {
+        buffer[length] = p[length];
+        length++;
+    }
+    buffer[length] = '\0';
+    char* pParsedEnd = nullptr;
+    value = std::strtof(buffer.data(), &pParsedEnd);
+    if (pParsedEnd == buffer.data()) {
+        value = 0.0f;
+        return p;
+    }
+    return p + (pParsedEnd - buffer.data());
+#endif
+}
+
+glm::vec3 parseVec3(const char* p, const char* pEnd)
+{
+    glm::vec3 result { 0.0f };
+    p = parseFloat(p, pEnd, result.x);
+    p = parseFloat(p, pEnd, result.y);
+    parseFloat(p, pEnd, result.z);
+    return result;
+}
+
+const char* parseIndex(const char* p, const char* pEnd, int32_t& value)
+{
+    const auto [pNext, error] = std::from_chars(p, pEnd, value);
+    if (error != std::errc())
+        value = 0;
+    return pNext;
+}
+
+// Parse "f v1 v2 v3 ..." where each corner is "v", "v/vt", "v//vn" or "v/vt/vn".
+void parseFace(const char* p, const char* pEnd, Chunk& chunk)
+{
+    Face face { uint32_t(chunk.corners.size()), 0, uint32_t(chunk.positions.size()), uint32_t(chunk.normals.size()) };
+    while (true) {
+        p = skipSpaces(p, pEnd);
+        if (p == pEnd)
+            break;
+
+        Corner corner { 0, 0 };
+        p = parseIndex(p, pEnd, corner.position);
+        if (p != pEnd && *p == '/') {
+            int32_t textureCoordinate;
+            p = parseIndex(p + 1, pEnd, textureCoordinate);
+            if (p != pEnd && *p == '/')
+                p = parseIndex(p + 1, pEnd, corner.normal);
+        }
+        // Skip whatever could not be parsed.
+        while (p != pEnd && !isSpace(*p))
+            p++;
+
+        if (corner.position != 0) {
+            chunk.corners.push_back(corner);
+            face.numCorners++;
+        }
+    }
+
+    if (face.numCorners >= 3)
+        chunk.faces.push_back(face);
+    else
+        chunk.corners.resize(face.firstCorner);
+}
+
+void parseChunk(std::string_view text, Chunk& chunk)
+{
+    const char* p = text.data();
+    const char* pTextEnd = text.data() + text.size();
+    while (p != pTextEnd) {
+        const char* pLineEnd = std::find(p, pTextEnd, '\n');
+        const char* pNext = pLineEnd == pTextEnd ? pTextEnd : pLineEnd + 1;
+        p = skipSpaces(p, pLineEnd);
+
+        const char* pKeywordEnd = p;
+        while (pKeywordEnd != pLineEnd && !isSpace(*pKeywordEnd))
+            pKeywordEnd++;
+        const std::string_view keyword { p, size_t(pKeywordEnd - p) };
+
+        const auto addStatement = [&](Statement::Type type) {
+            chunk.statements.push_back({ type, chunk.faces.size(), std::string(restOfLine(pKeywordEnd, pLineEnd)) });
+        };
+        if (keyword == "v")
+            chunk.positions.push_back(parseVec3(pKeywordEnd, pLineEnd));
+        else if (keyword == "vn")
+            chunk.normals.push_back(parseVec3(pKeywordEnd, pLineEnd));
+        else if (keyword == "f")
+            parseFace(pKeywordEnd, pLineEnd, chunk);
+        else if (keyword == "o")
+            addStatement(Statement::Type::Object);
+        else if (keyword == "g")
+            addStatement(Statement::Type::Group);
+        else if (keyword == "usemtl")
+            addStatement(Statement::Type::UseMaterial);
+        else if (keyword == "mtllib")
+            addStatement(Statement::Type::MaterialLibrary);
+        // Everything else (comments, texture coordinates, smoothing groups, ...) is ignored.
+
+        p = pNext;
+    }
+}
+
+// Default values of a material, the same as Assimp uses.
+Material defaultMaterial()
+{
+    Material material;
+    material.kd = glm::vec3(0.6f);
+    material.ks = glm::vec3(0.0f);
+    material.shininess = 0.0f;
+    material.transparency = 1.0f;
+    return material;
+}
+
+void loadMaterialLibrary(const std::filesystem::path& file, std::unordered_map<std::string, Material>& materials)
+{
+    std::ifstream stream { file, std::ios::binary };
+    if (!stream) {
+        std::cerr << "Material library " << file << " does not exist." << std::endl;
+        return;
+    }
+    const std::string text { std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+
+    Material* pMaterial = nullptr;
+    const char* p = text.data();
+    const char* pTextEnd = text.data() + text.size();
+    while (p != pTextEnd) {
+        const char* pLineEnd = std::find(p, pTextEnd, '\n');
+        const char* pNext = pLineEnd == pTextEnd ? pTextEnd : pLineEnd + 1;
+        p = skipSpaces(p, pLineEnd);
+
+        const char* pKeywordEnd = p;
+        while (pKeywordEnd != pLineEnd && !isSpace(*pKeywordEnd))
+            pKeywordEnd++;
+        const std::string_view keyword { p, size_t(pKeywordEnd - p) };
+
+        if (keyword == "newmtl") {
+            pMaterial = &(materials[std::string(restOfLine(pKeywordEnd, pLineEnd))] = defaultMaterial());
+        } else if (pMaterial) {
+            if (keyword == "Kd")
+                pMaterial->kd = parseVec3(pKeywordEnd, pLineEnd);
+            else if (keyword == "Ks")
+                pMaterial->ks = parseVec3(pKeywordEnd, pLineEnd);
+            else if (keyword == "Ns")
+                parseFloat(pKeywordEnd, pLineEnd, pMaterial->shininess);
+            else if (keyword == "d")
+                parseFloat(pKeywordEnd, pLineEnd, pMaterial->transparency);
+            else if (keyword == "Tr") {
+                float transmission;
+                parseFloat(pKeywordEnd, pLineEnd, transmission);
+                pMaterial->transparency = 1.0f - transmission;
+            }
+        }
+
+        p = pNext;
+    }
+}
+
+// Replays the statements and faces of all chunks in file order, grouping the faces into objects and
+// meshes the same way Assimp's OBJ importer does.
+class ObjectBuilder {
+public:
+    void statement(const Statement& statement)
+    {
+        switch (statement.type) {
+        case Statement::Type::Object: {
+            // Continue an existing object with the same name.
+            const auto it = std::find_if(std::begin(m_objects), std::end(m_objects), [&](const ObjObject& object) { return object.name == statement.name; });
+            if (it == std::end(m_objects))
+                createObject(statement.name);
+            else
+                m_currentObject = size_t(std::distance(std::begin(m_objects), it));
+        } break;
+        case Statement::Type::Group: {
+            if (statement.name != m_activeGroup) {
+                m_activeGroup = statement.name;
+                createObject(statement.name);
+            }
+        } break;
+        case Statement::Type::UseMaterial: {
+            if (statement.name == m_currentMaterial)
+                break;
+            m_currentMaterial = statement.name;
+            if (!m_currentObject)
+                break;
+            // A mesh has a single material; faces before the first usemtl take the new material.
+            ObjMesh& mesh = m_objects[*m_currentObject].meshes.back();
+            if (mesh.material && !mesh.faces.empty())
+                m_objects[*m_currentObject].meshes.push_back({ m_currentMaterial, {} });
+            else
+                mesh.material = m_currentMaterial;
+        } break;
+        case Statement::Type::MaterialLibrary: {
+            m_materialLibraries.push_back(statement.name);
+        } break;
+        };
+    }
+
+    void face(FaceReference face)
+    {
+        if (!m_currentObject)
+            createObject("defaultobject");
+        m_objects[*m_currentObject].meshes.back().faces.push_back(face);
+    }
+
+    std::vector<ObjObject>& objects() { return m_objects; }
+    const std::vector<std::string>& materialLibraries() const { return m_materialLibraries; }
+
+private:
+    void createObject(const std::string& name)
+    {
+        m_objects.push_back({ name, { ObjMesh { m_currentMaterial, {} } } });
+        m_currentObject = m_objects.size() - 1;
+    }
+
+    std::vector<ObjObject> m_objects;
+    std::optional<size_t> m_currentObject;
+    std::optional<std::string> m_currentMaterial;
+    std::string m_activeGroup;
+    std::vector<std::string> m_materialLibraries;
+};
+
+}
+
+Model loadObj(const std::filesystem::path& file)
+{
+    const std::shared_ptr<MappedFile> pMappedFile = MappedFile::open(file);
+    if (!pMappedFile) {
+        std::cerr << "File " << file << " does not exist or is empty." << std::endl;
+        throw std::exception();
+    }
+    const std::string_view text { reinterpret_cast<const char*>(pMappedFile->data().data()), pMappedFile->data().size() };
+
+    // Split the file into chunks that end at a line break.
+    std::vector<std::string_view> chunkTexts;
+    for (size_t begin = 0; begin < text.size();) {
+        size_t end = std::min(begin + chunkSize, text.size());
+        end = std::min(text.find('\n', end), text.size());
+        end = std::min(end + 1, text.size());
+        chunkTexts.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+
+    std::vector<Chunk> chunks(chunkTexts.size());
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = 0; i < int(chunks.size()); i++)
+        parseChunk(chunkTexts[size_t(i)], chunks[size_t(i)]);
+
+    // Concatenate the vertex data of all chunks.
+    std::vector<size_t> positionBase(chunks.size() + 1, 0), normalBase(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        positionBase[i + 1] = positionBase[i] + chunks[i].positions.size();
+        normalBase[i + 1] = normalBase[i] + chunks[i].normals.size();
+    }
+    std::vector<glm::vec3> positions(positionBase.back()), normals(normalBase.back());
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < int(chunks.size()); i++) {
+        std::copy(std::begin(chunks[size_t(i)].positions), std::end(chunks[size_t(i)].positions), std::begin(positions) + std::ptrdiff_t(positionBase[size_t(i)]));
+        std::copy(std::begin(chunks[size_t(i)].normals), std::end(chunks[size_t(i)].normals), std::begin(normals) + std::ptrdiff_t(normalBase[size_t(i)]));
+    }
+
+    // Group the faces into objects and meshes.
+    ObjectBuilder builder;
+    for (uint32_t chunkIndex = 0; chunkIndex < chunks.size(); chunkIndex++) {
+        const Chunk& chunk = chunks[chunkIndex];
+        auto statement = std::begin(chunk.statements);
+        for (uint32_t faceIndex = 0; faceIndex <= chunk.faces.size(); faceIndex++) {
+            for (; statement != std::end(chunk.statements) && statement->faceIndex == faceIndex; statement++)
+                builder.statement(*statement);
+            if (faceIndex < chunk.faces.size())
+                builder.face({ chunkIndex, faceIndex });
+        }
+    }
+
+    std::unordered_map<std::string, Material> materials;
+    for (const std::string& materialLibrary : builder.materialLibraries())
+        loadMaterialLibrary(file.parent_path() / materialLibrary, materials);
+
+    // Assimp puts every object in a child node of the root and loadMesh visits them in reverse order.
+    std::vector<const ObjMesh*> objMeshes;
+    for (auto object = std::rbegin(builder.objects()); object != std::rend(builder.objects()); object++) {
+        for (const ObjMesh& objMesh : object->meshes) {
+            if (!objMesh.faces.empty())
+                objMeshes.push_back(&objMesh);
+        }
+    }
+
+    // Resolve an index from the file into the concatenated arrays; -1 if absent.
+    const auto resolve = [](int32_t index, size_t base, uint32_t before, size_t size) -> int64_t {
+        if (index == 0)
+            return -1;
+        const int64_t result = index > 0 ? int64_t(index) - 1 : int64_t(base) + int64_t(before) + int64_t(index);
+        if (result < 0 || result >= int64_t(size)) {
+            std::cerr << "Face refers to a vertex that does not exist" << std::endl;
+            throw std::exception();
+        }
+        return result;
+    };
+
+    Model out;
+    out.meshes.resize(objMeshes.size());
+    // Material IDs by name; meshes without (or with an unknown) material share the default material.
+    std::unordered_map<std::string, uint32_t> materialIds;
+    std::optional<uint32_t> defaultMaterialId;
+    for (size_t meshIndex = 0; meshIndex < objMeshes.size(); meshIndex++) {
+        const ObjMesh& objMesh = *objMeshes[meshIndex];
+        const auto material = objMesh.material ? materials.find(*objMesh.material) : std::end(materials);
+        if (material == std::end(materials)) {
+            if (!defaultMaterialId) {
+                defaultMaterialId = uint32_t(out.materials.size());
+                out.materials.push_back(defaultMaterial());
+            }
+            out.meshes[meshIndex].materialId = *defaultMaterialId;
+        } else {
+            const auto [id, inserted] = materialIds.try_emplace(material->first, uint32_t(out.materials.size()));
+            if (inserted)
+                out.materials.push_back(material->second);
+            out.meshes[meshIndex].materialId = id->second;
+        }
+    }
+
+    bool invalidIndex = false;
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int meshIndex = 0; meshIndex < int(out.meshes.size()); meshIndex++) {
+        const ObjMesh& objMesh = *objMeshes[size_t(meshIndex)];
+        Mesh& mesh = out.meshes[size_t(meshIndex)];
+
+        size_t numCorners = 0, numTriangles = 0;
+        for (const auto& [chunkIndex, faceIndex] : objMesh.faces) {
+            numCorners += chunks[chunkIndex].faces[faceIndex].numCorners;
+            numTriangles += chunks[chunkIndex].faces[faceIndex].numCorners - 2;
+        }
+        mesh.positions.reserve(numCorners);
+        mesh.normals.reserve(numCorners);
+        mesh.triangles.reserve(numTriangles);
+
+        bool hasNormals = false;
+        try {
+            for (const auto& [chunkIndex, faceIndex] : objMesh.faces) {
+                const Chunk& chunk = chunks[chunkIndex];
+                const Face& face = chunk.faces[faceIndex];
+
+                // Every corner of every face becomes a vertex of its own, like in Assimp.
+                const uint32_t first = uint32_t(mesh.positions.size());
+                for (uint32_t i = 0; i < face.numCorners; i++) {
+                    const Corner& corner = chunk.corners[face.firstCorner + i];
+                    const int64_t position = resolve(corner.position, positionBase[chunkIndex], face.positionsBefore, positions.size());
+                    const int64_t normal = resolve(corner.normal, normalBase[chunkIndex], face.normalsBefore, normals.size());
+                    hasNormals |= normal >= 0;
+                    mesh.positions.push_back(positions[size_t(position)]);
+                    mesh.normals.push_back(normal >= 0 ? normals[size_t(normal)] : glm::vec3(0.0f));
+                }
+
+                if (face.numCorners == 4) {
+                    // Split a quad at a concave corner if there is one (same as Assimp's triangulation).
+                    uint32_t start = 0;
+                    for (uint32_t i = 0; i < 4; i++) {
+                        const glm::vec3& v = mesh.positions[first + i];
+                        const glm::vec3 left = glm::normalize(mesh.positions[first + (i + 3) % 4] - v);
+                        const glm::vec3 diagonal = glm::normalize(mesh.positions[first + (i + 2) % 4] - v);
+                        const glm::vec3 right = glm::normalize(mesh.positions[first + (i + 1) % 4] - v);
+                        if (std::acos(glm::dot(left, diagonal)) + std::acos(glm::dot(right, diagonal)) > glm::pi<float>()) {
+                            start = i;
+                            break;
+                        }
+                    }
+                    mesh.triangles.emplace_back(first + start, first + (start + 1) % 4, first + (start + 2) % 4);
+                    mesh.triangles.emplace_back(first + start, first + (start + 2) % 4, first + (start + 3) % 4);
+                } else {
+                    for (uint32_t i = 1; i + 1 < face.numCorners; i++)
+                        mesh.triangles.emplace_back(first, first + i, first + i + 1);
+                }
+            }
+        } catch (const std::exception&) {
+#ifdef USE_OPENMP
+#pragma omp atomic write
+#endif
+            invalidIndex = true;
+        }
+
+        // aiProcess_GenNormals: flat face normals for meshes without normals.
+        if (!hasNormals) {
+            for (const Triangle& triangle : mesh.triangles) {
+                const glm::vec3 cross = glm::cross(mesh.positions[triangle[1]] - mesh.positions[triangle[0]], mesh.positions[triangle[2]] - mesh.positions[triangle[0]]);
+                const float length = glm::length(cross);
+                const glm::vec3 normal = length > 0.0f ? cross / length : glm::vec3(0.0f);
+                for (int i = 0; i < 3; i++)
+                    mesh.normals[triangle[i]] = normal;
+            }
+        }
+    }
+    if (invalidIndex) {
+        std::cerr << "Failed to load mesh file " << file << std::endl;
+        throw std::exception();
+    }
+
+    return out;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "mesh.h"
+#include <filesystem>
+#include <vector>
+
+// Built-in Wavefront OBJ (+ MTL) importer, an alternative to Assimp for the files in the data directory.
+//
+// The file is split into chunks at line boundaries which are parsed in parallel; the chunks are then
+// stitched together and the meshes are built in parallel. The result matches what loadMesh produces with
+// Assimp (aiProcess_GenNormals | aiProcess_Triangulate): one mesh per object and run of faces with the
+// same material, the vertices of every face corner are unique, quads are split along the same diagonal and
+// meshes without normals get flat face normals. Polygons with more than 4 corners are triangulated as a fan.
+// The material table only contains the materials that are used (plus a default material if needed).
+[[nodiscard]] Model loadObj(const std::filesystem::path& file);
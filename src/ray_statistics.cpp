@@ -0,0 +1,103 @@
+#include "ray_statistics.h"
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#ifdef USE_RAY_STATISTICS
+namespace {
+std::mutex registryMutex;
+std::vector<detail::ThreadRayStatistics*> registry;
+// Counts of threads that exited since the last reset.
+RayStatistics retiredStatistics;
+}
+
+detail::ThreadRayStatistics::ThreadRayStatistics()
+{
+    std::lock_guard lock { registryMutex };
+    registry.push_back(this);
+}
+
+detail::ThreadRayStatistics::~ThreadRayStatistics()
+{
+    std::lock_guard lock { registryMutex };
+    retiredStatistics += statistics;
+    registry.erase(std::remove(std::begin(registry), std::end(registry), this), std::end(registry));
+}
+#endif
+
+RayStatistics& RayStatistics::operator+=(const RayStatistics& other)
+{
+    for (size_t i = 0; i < counts.size(); i++)
+        counts[i] += other.counts[i];
+    return *this;
+}
+
+uint64_t RayStatistics::totalRays() const
+{
+    return (*this)[RayCounter::PrimaryRays] + (*this)[RayCounter::ShadowRays] + (*this)[RayCounter::ReflectionRays];
+}
+
+const char* rayCounterName(RayCounter counter)
+{
+    switch (counter) {
+    case RayCounter::PrimaryRays:
+        return "Primary rays";
+    case RayCounter::ShadowRays:
+        return "Shadow rays";
+    case RayCounter::ReflectionRays:
+        return "Reflection rays";
+    case RayCounter::BoxTests:
+        return "Box tests";
+    case RayCounter::TriangleTests:
+        return "Triangle tests";
+    case RayCounter::SphereTests:
+        return "Sphere tests";
+    default:
+        return "";
+    }
+}
+
+void resetRayStatistics()
+{
+#ifdef USE_RAY_STATISTICS
+    std::lock_guard lock { registryMutex };
+    retiredStatistics = RayStatistics {};
+    for (detail::ThreadRayStatistics* pThreadStatistics : registry)
+        pThreadStatistics->statistics = RayStatistics {};
+#endif
+}
+
+RayStatistics collectRayStatistics()
+{
+    RayStatistics result;
+#ifdef USE_RAY_STATISTICS
+    std::lock_guard lock { registryMutex };
+    result = retiredStatistics;
+    for (const detail::ThreadRayStatistics* pThreadStatistics : registry)
+        result += pThreadStatistics->statistics;
+#endif
+    return result;
+}
+
+void printRayStatistics(std::ostream& stream, const RayStatistics& statistics, float milliseconds)
+{
+#ifdef USE_RAY_STATISTICS
+    const double seconds = std::max(double(milliseconds), 1e-3) / 1000.0;
+    for (size_t i = 0; i < statistics.counts.size(); i++) {
+        const auto counter = RayCounter(i);
+        stream << "  " << std::left << std::setw(16) << rayCounterName(counter) << std::right << std::setw(12) << statistics[counter];
+        if (counter == RayCounter::PrimaryRays || counter == RayCounter::ShadowRays || counter == RayCounter::ReflectionRays)
+            stream << "  (" << std::fixed << std::setprecision(2) << double(statistics[counter]) / seconds * 1e-6 << " Mrays/s)";
+        stream << std::endl;
+    }
+    stream << "  " << std::left << std::setw(16) << "All rays" << std::right << std::setw(12) << statistics.totalRays()
+           << "  (" << std::fixed << std::setprecision(2) << double(statistics.totalRays()) / seconds * 1e-6 << " Mrays/s)" << std::endl;
+    stream.unsetf(std::ios_base::floatfield);
+#else
+    (void)statistics;
+    (void)milliseconds;
+    stream << "  Ray statistics were disabled at compile time (ENABLE_RAY_STATISTICS=OFF)" << std::endl;
+#endif
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+
+// Low-overhead ray and intersection counters. Every thread increments its own counters (no atomics);
+// collectRayStatistics() sums them up after a frame has been rendered. Configure with
+// -DENABLE_RAY_STATISTICS=OFF to compile all counting out.
+enum class RayCounter {
+    PrimaryRays,
+    ShadowRays,
+    ReflectionRays,
+    BoxTests,
+    TriangleTests,
+    SphereTests,
+    NumCounters
+};
+
+struct RayStatistics {
+    std::array<uint64_t, size_t(RayCounter::NumCounters)> counts {};
+
+    uint64_t operator[](RayCounter counter) const { return counts[size_t(counter)]; }
+    uint64_t& operator[](RayCounter counter) { return counts[size_t(counter)]; }
+    RayStatistics& operator+=(const RayStatistics& other);
+    uint64_t totalRays() const;
+};
+
+const char* rayCounterName(RayCounter counter);
+
+// Set the counters of all threads back to zero. Call when no rays are being traced (e.g. at the start of a frame).
+void resetRayStatistics();
+// Sum of the counters of all threads since the last reset. Call when no rays are being traced.
+RayStatistics collectRayStatistics();
+// Print counts and Mrays/s per ray type for a frame that took the given amount of time.
+void printRayStatistics(std::ostream& stream, const RayStatistics& statistics, float milliseconds);
+
+#ifdef USE_RAY_STATISTICS
+namespace detail {
+// Registers itself on construction so that the counters of every thread can be aggregated.
+struct ThreadRayStatistics {
+    ThreadRayStatistics();
+    ~ThreadRayStatistics();
+    RayStatistics statistics;
+};
+inline thread_local ThreadRayStatistics threadRayStatistics;
+}
+#define RAY_STATS_COUNT(counter) (++detail::threadRayStatistics.statistics.counts[size_t(RayCounter::counter)])
+#define RAY_STATS_ADD(counter, amount) (detail::threadRayStatistics.statistics.counts[size_t(RayCounter::counter)] += (amount))
+#else
+#define RAY_STATS_COUNT(counter) ((void)0)
+#define RAY_STATS_ADD(counter, amount) ((void)0)
+#endif
@@ -81,29 +81,20 @@ Plane trianglePlane(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v
     return plane;
 }
 
-/// Input: the three vertices of the triangle
-/// Output: if intersects then modify the hit parameter ray.t and return true, otherwise return false
-bool intersectRayWithTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, Ray &ray, HitInfo &hitInfo, const glm::vec3 &n1, const glm::vec3 &n2, const glm::vec3 &n3)
+/// Input: the three vertex positions of the triangle
+/// Output: if intersects then modify the hit parameter ray.t, store the barycentric coordinates of the hit point and return true,
+/// otherwise return false
+bool intersectRayWithTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, Ray &ray, glm::vec2 &barycentric)
 {
     Plane plane = trianglePlane(v0, v1, v2);
     float prevT = ray.t;
     if (intersectRayWithPlane(plane, ray))
     {
-        if (pointInTriangle(v0, v1, v2, plane.normal, ray.origin + ray.direction * ray.t))
+        const glm::vec3 p = ray.origin + ray.direction * ray.t;
+        if (pointInTriangle(v0, v1, v2, plane.normal, p))
         {
-            float alpha = area(ray.origin + ray.direction * ray.t, v1, v2) / area(v0, v1, v2);
-            float beta = area(ray.origin + ray.direction * ray.t, v0, v2) / area(v0, v1, v2);
-            float gamma = area(ray.origin + ray.direction * ray.t, v0, v1) / area(v0, v1, v2);
-            glm::vec3 normalInterpolated = glm::normalize(alpha * n1 + beta * n2 + gamma * n3);
-            // update the hitinfo for further calculations
-            if (glm::dot(plane.normal, -ray.direction) > 0)
-            {
-                hitInfo.normal = normalInterpolated;
-            }
-            else
-            {
-                hitInfo.normal = -normalInterpolated;
-            }
+            const float triangleArea = area(v0, v1, v2);
+            barycentric = glm::vec2(area(p, v0, v2), area(p, v0, v1)) / triangleArea;
             return true;
         }
         // rollback the value of t in case there was a plane intersection but no triangle intersection
@@ -113,6 +104,32 @@ bool intersectRayWithTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const gl
     return false;
 }
 
+/// Input: a triangle of the mesh that the ray hits and the barycentric coordinates of the hit point
+/// Output: the vertex normals interpolated with the barycentric coordinates, flipped towards the ray origin
+glm::vec3 interpolateTriangleNormal(const Mesh &mesh, const Triangle &triangle, const glm::vec2 &barycentric, const Ray &ray)
+{
+    return interpolateTriangleNormal(mesh.positions[triangle[0]], mesh.positions[triangle[1]], mesh.positions[triangle[2]],
+                                     mesh.normals[triangle[0]], mesh.normals[triangle[1]], mesh.normals[triangle[2]], barycentric, ray);
+}
+
+glm::vec3 interpolateTriangleNormal(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+                                    const glm::vec3 &n0, const glm::vec3 &n1, const glm::vec3 &n2,
+                                    const glm::vec2 &barycentric, const Ray &ray)
+{
+    float beta = barycentric.x;
+    float gamma = barycentric.y;
+    float alpha = 1.0f - beta - gamma;
+    glm::vec3 normalInterpolated = glm::normalize(alpha * n0 + beta * n1 + gamma * n2);
+    if (glm::dot(glm::cross(v1 - v0, v2 - v0), -ray.direction) > 0)
+    {
+        return normalInterpolated;
+    }
+    else
+    {
+        return -normalInterpolated;
+    }
+}
+
 /// Input: a sphere with the following attributes: sphere.radius, sphere.center
 /// Output: if intersects then modify the hit parameter ray.t and return true, otherwise return false
 bool intersectRayWithShape(const Sphere &sphere, Ray &ray, HitInfo &hitInfo)
@@ -152,8 +169,8 @@ bool intersectRayWithShape(const Sphere &sphere, Ray &ray, HitInfo &hitInfo)
     }
 
     ray.t = currentT;
-    // update the hitinfo for further calculations
-    hitInfo.normal = glm::normalize(ray.origin + ray.direction * ray.t - sphere.center);
+    // the normal is computed from the hit point when the hit is resolved
+    hitInfo.t = currentT;
     return true;
 }
 
@@ -202,12 +219,15 @@ bool intersectRayWithShape(const AxisAlignedBox &box, Ray &ray)
 bool intersectRayWithShape(const Mesh &mesh, Ray &ray, HitInfo &hitInfo)
 {
     bool hit = false;
-    for (const auto &tri : mesh.triangles)
+    for (uint32_t i = 0; i < mesh.triangles.size(); i++)
     {
-        const auto v0 = mesh.vertices[tri[0]];
-        const auto v1 = mesh.vertices[tri[1]];
-        const auto v2 = mesh.vertices[tri[2]];
-        hit |= intersectRayWithTriangle(v0.p, v1.p, v2.p, ray, hitInfo, v0.n, v1.n, v2.n);
+        const Triangle &tri = mesh.triangles[i];
+        if (intersectRayWithTriangle(mesh.positions[tri[0]], mesh.positions[tri[1]], mesh.positions[tri[2]], ray, hitInfo.barycentric))
+        {
+            hitInfo.t = ray.t;
+            hitInfo.primitive = i;
+            hit = true;
+        }
     }
     return hit;
 }
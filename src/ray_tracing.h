@@ -1,10 +1,32 @@
 #pragma once
 #include "scene.h"
+#include <cstdint>
+#include <limits>
 
+// What the traversal records about the closest hit so far. Kept small because it is written on every closer
+// hit; the normal and material are looked up from it only once per ray (see BoundingVolumeHierarchy::resolveHit).
 struct HitInfo
 {
+    float t = std::numeric_limits<float>::max();
+    // Index of the primitive in the BVH primitive array, or sphereFlag | the index in Scene::spheres.
+    uint32_t primitive = 0;
+    // Weights of the second and third triangle vertex at the hit point (unused for spheres).
+    glm::vec2 barycentric{0.0f};
+    // Index of the hit mesh instance, in which case primitive refers to the hierarchy of the instanced mesh.
+    uint32_t instance = noInstance;
+
+    static constexpr uint32_t sphereFlag = 1u << 31;
+    static constexpr uint32_t noInstance = ~0u;
+    bool isSphere() const { return (primitive & sphereFlag) != 0; }
+};
+
+// Shading information of a hit, resolved from a HitInfo.
+struct SurfacePoint
+{
+    // Facing the ray origin.
     glm::vec3 normal;
-    Material material;
+    // Index into Scene::materials.
+    uint32_t materialId;
 };
 
 bool intersectRayWithPlane(const Plane &plane, Ray &ray);
@@ -14,7 +36,17 @@ bool pointInTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &
 
 Plane trianglePlane(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2);
 
-bool intersectRayWithTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, Ray &ray, HitInfo &hitInfo, const glm::vec3 &n1, const glm::vec3 &n2,const glm::vec3 &n3);
+// Only reads the vertex positions; sets ray.t and the barycentric coordinates of the hit point if the triangle
+// is hit closer than ray.t.
+bool intersectRayWithTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, Ray &ray, glm::vec2 &barycentric);
+// Interpolated vertex normal at the given barycentric coordinates (from intersectRayWithTriangle), facing the
+// ray origin. Call this once for the closest hit instead of for every triangle tested.
+glm::vec3 interpolateTriangleNormal(const Mesh &mesh, const Triangle &triangle, const glm::vec2 &barycentric, const Ray &ray);
+// Same as above for vertex positions and normals that are passed in directly (e.g. decoded from a compact format).
+glm::vec3 interpolateTriangleNormal(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+                                    const glm::vec3 &n0, const glm::vec3 &n1, const glm::vec3 &n2,
+                                    const glm::vec2 &barycentric, const Ray &ray);
 bool intersectRayWithShape(const Sphere &sphere, Ray &ray, HitInfo &hitInfo);
 bool intersectRayWithShape(const AxisAlignedBox &box, Ray &ray);
+// Sets hitInfo.primitive to the index of the closest triangle in mesh.triangles.
 bool intersectRayWithShape(const Mesh &mesh, Ray &ray, HitInfo &hitInfo);
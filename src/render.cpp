@@ -0,0 +1,1197 @@
+#include "render.h"
+#include "camera.h"
+#include "disable_all_warnings.h"
+#include "draw.h"
+#include "ray_statistics.h"
+#include "ray_tracing.h"
+// Disable compiler warnings in third-party code (which we cannot change).
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+/**
+@author Alex
+*/
+static glm::vec3 randomUnitVector()
+{
+    std::random_device mch;
+    std::default_random_engine generator(mch());
+    std::normal_distribution<float> distribution(0.0f, 1.0f);
+    float y = distribution(generator);
+    float x = distribution(generator);
+    float s = distribution(generator);
+    /*float y = rand() - RAND_MAX / 2;
+    float x = rand() - RAND_MAX / 2;
+    float s = rand() - RAND_MAX / 2;*/
+    
+    return glm::normalize(glm::vec3(y, x, s));
+}
+
+static glm::vec3 specularOneLight(Ray &ray, const PointLight &light, const glm::vec3 &fromPosToLight, const SurfacePoint &surface, const Material &material)
+{
+    glm::vec3 fromCamToPos = ray.direction;
+    glm::vec3 reflected = glm::normalize(glm::reflect(fromCamToPos, surface.normal));
+
+    // draw the normal
+    //drawRay(Ray{ ray.origin + ray.direction * ray.t, hitInfo.normal, glm::length(fromCamToPos) }, glm::vec3{ 0.0f, 0.0f, 1.0f });
+
+    float specularCos = glm::dot(reflected, fromPosToLight);
+    if (specularCos <= 0)
+    {
+        // the reflection is not counted because the angle is too high
+        //drawRay(Ray{ ray.origin + ray.direction * ray.t, reflected, glm::length(fromCamToPos) }, glm::vec3{ 1.0f, 0.0f, 0.0f });
+        return glm::vec3(0);
+    }
+
+    // Is * Ks * cos(theta)
+    glm::vec3 result = light.color * material.ks * pow(specularCos, material.shininess);
+    // draw the reflection with the specular colour
+    //drawRay(Ray{ ray.origin + ray.direction * ray.t, reflected, glm::length(fromCamToPos) }, result);
+    return result;
+}
+
+static glm::vec3 diffuseOneLight(Ray &ray, const PointLight &light, const glm::vec3 &fromPosToLight, const SurfacePoint &surface, const Material &material)
+{
+    drawRay(Ray{ray.origin + ray.direction * ray.t, surface.normal, 5.0f}, glm::vec3{0.0f, 0.0f, 1.0f});
+    float diffuseCos = glm::dot(fromPosToLight, surface.normal);
+
+    if (diffuseCos <= 0)
+    { // this point is facing away from the light
+        drawRay(Ray{ray.origin + ray.direction * ray.t, fromPosToLight, 5.0f}, glm::vec3{1.0f, 0.0f, 0.0f});
+        return glm::vec3(0);
+    }
+
+    drawRay(Ray{ray.origin + ray.direction * ray.t, fromPosToLight, 5.0f}, glm::vec3{0.0f, 1.0f, 0.0f});
+    // Id * Kd * cos(theta)
+    return light.color * material.kd * diffuseCos;
+}
+/**
+* @author Alex, added bvh to the function signature
+* first for loop
+**/
+
+static bool pointInShadow(glm::vec3 &pointOn, const PointLight &light, const BoundingVolumeHierarchy &bvh)
+{
+    glm::vec3 fromPosToLight = light.position - pointOn;
+    Ray ray{pointOn, glm::normalize(fromPosToLight), std::numeric_limits<float>::max()};
+
+    // set an offset to the ray not to always intersect the object at which we have our point
+    float epsilon = 0.001;
+    ray.origin += epsilon * ray.direction;
+
+    // only check the distance of the intersected object if we intersected something
+    HitInfo shadowRayHitInfo;
+    RAY_STATS_COUNT(ShadowRays);
+    if (bvh.intersect(ray, shadowRayHitInfo))
+    {
+        //drawRay(ray, glm::vec3(0.0f, 1.0f, 0.0f));
+        // if there is an object between us and the light source, we are in shadow
+        if (ray.t + epsilon >= glm::length(fromPosToLight))
+        {
+            //drawRay(ray, glm::vec3(0.0f, 1.0f, 0.0f));
+            return false;
+        }
+
+        Ray afterHit;
+        afterHit.origin = ray.origin + ray.t * ray.direction;
+        afterHit.direction = ray.direction;
+        afterHit.t = glm::length(fromPosToLight) - ray.t;
+        //drawRay(afterHit, glm::vec3(1.0f, 0.0f, 0.0f));
+        return true;
+    }
+
+    //drawRay(ray, glm::vec3(0.0f, 0.0f, 1.0f));
+    return false;
+}
+
+// static glm::vec3 shading(Ray &ray, HitInfo &hitInfo, const Scene &scene, const BoundingVolumeHierarchy &bvh)
+// {
+//     const std::vector<PointLight> &pointLights = scene.pointLights;
+//     glm::vec3 pointOn = ray.origin + ray.direction * ray.t;
+//     glm::vec3 result(0.0f);
+
+//     for (const PointLight &light : pointLights)
+//     {
+//         const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
+//         if (pointInShadow(pointOn, light, bvh))
+//         {
+//             continue;
+//         }
+
+//         glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, hitInfo);
+//         glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, hitInfo);
+//         result += diffuse;
+//         result += specular;
+//     }
+
+//     return result;
+// }
+
+static glm::vec3 shading(Ray &ray, const SurfacePoint &surface, const Material &material, const Scene &scene, const BoundingVolumeHierarchy &bvh)
+{
+    const std::vector<PointLight> &pointLights = scene.pointLights;
+    const std::vector<SphericalLight> &sphericalLights = scene.sphericalLight;
+    glm::vec3 pointOn = ray.origin + ray.direction * ray.t;
+    glm::vec3 result(0.0f);
+    float softShadowCounter = 0.0f;
+
+    for (const SphericalLight &spherical : sphericalLights)
+    {
+        const PointLight &light = {spherical.position, spherical.color};
+
+        const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
+        glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, surface, material);
+        glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, surface, material);
+        softShadowCounter = 0.0f;
+        for (int i = 1; i <= 200; i++)
+        {
+            glm::vec3 randomPointOnSphere = spherical.position + spherical.radius * randomUnitVector();
+            Ray newRay = {pointOn + (float)(0.001) * (glm::normalize(randomPointOnSphere - pointOn)), glm::normalize(randomPointOnSphere - pointOn), length(newRay.origin - randomPointOnSphere)};
+            HitInfo newHitInfo;
+            float lightT = length(newRay.origin - randomPointOnSphere);
+            RAY_STATS_COUNT(ShadowRays);
+            if (!(bvh.intersect(newRay, newHitInfo)))
+            {
+                softShadowCounter += 1.0f;
+                drawRay(newRay, glm::vec3(1));
+            }
+            else
+            {
+                if (newRay.t > lightT)
+                {
+                    softShadowCounter += 1.0f;
+                    drawRay(newRay, glm::vec3(1));
+                }
+                else
+                {
+                    drawRay(newRay, glm::vec3(1, 0, 0));
+                }
+            }
+        }
+        softShadowCounter = softShadowCounter / 200.0f;
+
+        //const PointLight &light = {spherical.position, spherical.color};
+
+        //const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
+        /**if (pointInShadow(pointOn, light, bvh))
+        {
+            continue;
+        }*/
+
+        //glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, hitInfo);
+        //glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, hitInfo);
+        result += diffuse * softShadowCounter;
+        /**std::cout<<"Result is:"<<"x:"<<result.x <<" "<<"y:"<<result.y << " " <<"z:"<<result.z << std::endl;
+        std::cout <<"Diffuse is:"<<"x:"<< diffuse.x << " " <<"y:"<< diffuse.y << " " <<"z:"<< diffuse.z << std::endl;
+        std::cout <<"Specular is:"<<"x"<< specular.x << " " <<"y:"<< specular.y << " " <<"z:"<< specular.z << std::endl;
+        std::cout << std::endl;*/
+        result += specular * softShadowCounter;
+    }
+
+    for (const PointLight &light : pointLights)
+    {
+        const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
+        if (pointInShadow(pointOn, light, bvh))
+        {
+            continue;
+        }
+
+        glm::vec3 diffuse = diffuseOneLight(ray, light, fromPosToLight, surface, material);
+        glm::vec3 specular = specularOneLight(ray, light, fromPosToLight, surface, material);
+        result += diffuse;
+        result += specular;
+    }
+
+    return result;
+}
+
+// Recursive Ray tracing methods
+static void trace(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh);
+static void shade(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh, const HitInfo &hitInfo);
+static void shadeTraced(int level, const Ray &ray, bool hit, const HitInfo &hitInfo, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh);
+
+static void shade(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh, const HitInfo &hitInfo)
+{
+    // The normal and material are only looked up here, once for the closest hit of the ray.
+    const SurfacePoint surface = bvh.resolveHit(ray, hitInfo);
+    const Material &material = scene.materials[surface.materialId];
+
+    //ComputeDirectLight
+    glm::vec3 directColor = shading(ray, surface, material, scene, bvh);
+
+    if (material.ks.x <= 0.01f, material.ks.y <= 0.01f, material.ks.z <= 0.01f)
+    {
+        color = directColor;
+        return;
+    }
+    //ComputeReflectedRay
+    glm::vec3 fromCamToPos = ray.direction;
+    glm::vec3 reflected = glm::normalize(glm::reflect(fromCamToPos, surface.normal));
+    Ray reflectedRay = {ray.origin + ray.direction * ray.t, reflected, glm::length(fromCamToPos)};
+    float epsilon = 0.001;
+    reflectedRay.origin += epsilon * reflectedRay.direction;
+    //drawRay(reflectedRay, glm::vec3{1.0f, 0.0f, 0.0f});
+
+    glm::vec3 reflectedColor;
+    trace(level + 1, reflectedRay, reflectedColor, scene, bvh);
+    // std::cout << material.ks.x << std::endl;
+
+    color = directColor + reflectedColor * material.ks;
+}
+static void trace(int level, Ray ray, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh)
+{
+    if (level >= 2)
+    {
+        //std::cout << "end" << std::endl;
+        color = glm::vec3(0.0f);
+        return;
+    }
+    //std::cout << level << std::endl;
+
+    if (level == 0)
+        RAY_STATS_COUNT(PrimaryRays);
+    else
+        RAY_STATS_COUNT(ReflectionRays);
+
+    HitInfo hitInfo;
+    const bool hit = bvh.intersect(ray, hitInfo);
+    shadeTraced(level, ray, hit, hitInfo, color, scene, bvh);
+}
+
+// Color of a ray whose closest hit has already been found (by trace or as part of a ray packet).
+static void shadeTraced(int level, const Ray &ray, bool hit, const HitInfo &hitInfo, glm::vec3 &color, const Scene &scene, const BoundingVolumeHierarchy &bvh)
+{
+    if (hit)
+    {
+        // Draw a white debug ray.
+        drawRay(ray, glm::vec3(1.0f));
+
+        //std::cout << ray.origin.x << " " << ray.origin.y << " " << ray.origin.z << " " << ray.direction.x << " " << ray.direction.y << " " << ray.direction.z << std::endl;
+
+        // Get the resulting shading
+        shade(level, ray, color, scene, bvh, hitInfo);
+    }
+    else
+    {
+        // Draw a red debug ray if the ray missed.
+        drawRay(ray, glm::vec3(1.0f, 0.0f, 0.0f));
+        // Set the color of the pixel to black if the ray misses.
+        color = glm::vec3(0.0f);
+    }
+}
+
+// NOTE(Mathijs): separate function to make recursion easier (could also be done with lambda + std::function).
+glm::vec3 getFinalColor(const Scene &scene, const BoundingVolumeHierarchy &bvh, Ray ray)
+{
+    //std::cout << "called" << std::endl;
+    glm::vec3 color;
+
+    //Bug Example
+    //ray.origin = {0.0268146, 0.313131, 0.523811};
+    //ray.direction = {0.2711, 0.416066, -0.867983};
+
+    trace(0, ray, color, scene, bvh);
+
+    return color;
+}
+// static glm::vec3 getFinalColor(const Scene &scene, const BoundingVolumeHierarchy &bvh, Ray ray)
+// {
+//     HitInfo hitInfo;
+//     if (bvh.intersect(ray, hitInfo))
+//     {
+//         // Draw a white debug ray.
+//         drawRay(ray, glm::vec3(1.0f));
+static void blurEffect(const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh, Screen &screen, std::vector<glm::vec3> &matrixPixels)
+{
+    const glm::ivec2 resolution = screen.resolution();
+
+    // Trackball cameraNew = camera;
+    // float var_ = 0.01f;
+    // for (size_t i = 0; i < 15; i++)
+    // {
+    //     cameraNew.setLookAt(glm::vec3(var_, 0, 0));
+    //     for (int y = 0; y < resolution.y; y++)
+    //     {
+    //         for (int x = 0; x != resolution.x; x++)
+    //         {
+    //             // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+    //             const glm::vec2 normalizedPixelPos{
+    //                 float(x) / resolution.x * 2.0f - 1.0f,
+    //                 float(y) / resolution.y * 2.0f - 1.0f};
+    //             const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+    //             glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+    //             matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+    //         }
+    //     }
+    //     var_ += 0.01f;
+    // }
+
+    Trackball cameraNew = camera;
+    cameraNew.setLookAt(glm::vec3(0.01, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.02, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.03, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.04, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.05, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.06, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.07, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.08, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.09, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.10, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.11, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.12, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.13, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.14, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+        }
+    }
+
+    cameraNew.setLookAt(glm::vec3(0.15, 0, 0));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            // NOTE: (-1, -1) at the bottom left of the screen, (+1, +1) at the top right of the screen.
+            const glm::vec2 normalizedPixelPos{
+                float(x) / resolution.x * 2.0f - 1.0f,
+                float(y) / resolution.y * 2.0f - 1.0f};
+            const Ray cameraRay = cameraNew.generateRay(normalizedPixelPos);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+
+            matrixPixels.at(y * resolution.x + x) += getFinalColor(scene, bvh, cameraRay);
+            screen.setPixel(x, y, glm::vec3(matrixPixels.at(y * resolution.x + x).x / 16, matrixPixels.at(y * resolution.x + x).y / 16, matrixPixels.at(y * resolution.x + x).z / 16));
+        }
+    }
+}
+
+static void bloomEffect(std::vector<glm::vec3> &matrixPixels, std::vector<glm::vec3> &matrixColorsScreen, Screen &screen, const Scene &scene, const CameraFrame &frame, const BoundingVolumeHierarchy &bvh, const RenderSettings &settings)
+{
+    const glm::ivec2 resolution = screen.resolution();
+    int counter = 1;
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            counter = 1;
+            for (int i = -10; i < 11; i++)
+            {
+                if (y + i < 0 || y + i > resolution.y - 1)
+                    continue;
+                else
+                {
+                    for (int j = -10; j < 11; j++)
+                    {
+                        if (i == 0 && j == 0)
+                            continue;
+                        if (x + j < 0 || x + j > resolution.x - 1)
+                            continue;
+                        else
+                        {
+                            matrixColorsScreen.at((y * resolution.x) + x) += matrixColorsScreen.at(((y + i) * resolution.x) + (x + j));
+                            counter++;
+                        }
+                    }
+                }
+            }
+            matrixColorsScreen.at((y * resolution.x) + x) = glm::vec3(matrixColorsScreen.at((y * resolution.x) + x).x / counter, matrixColorsScreen.at((y * resolution.x) + x).y / counter, matrixColorsScreen.at((y * resolution.x) + x).z / counter);
+
+            const Ray cameraRay = frame.pixelRay(x, y);
+            glm::vec3 color = getFinalColor(scene, bvh, cameraRay);
+            if (settings.bloom == true)
+            {
+                screen.setPixel(x, y, matrixColorsScreen.at((y * resolution.x) + x) + color);
+                matrixPixels.at(y * resolution.x + x) += matrixColorsScreen.at((y * resolution.x) + x) + color;
+            }
+        }
+    }
+}
+//         // Get the resulting shading
+//         glm::vec3 shadingResult = shading(ray, hitInfo, scene);
+
+//         // Set the color of the pixel to white if the ray hits.
+//         return shadingResult;
+//     }
+//     else
+//     {
+//         // Draw a red debug ray if the ray missed.
+//         drawRay(ray, glm::vec3(1.0f, 0.0f, 0.0f));
+//         // Set the color of the pixel to black if the ray misses.
+//         return glm::vec3(0.0f);
+//     }
+// }
+
+/**
+ * Render one ray per pixel with the primary rays traced in packets.
+ *
+ * The screen is divided into tiles of tileSize x tileSize pixels (at most 8x8, smaller at the borders) and the
+ * camera rays of a tile are traced through the BVH together, which shares the traversal between these coherent
+ * rays. The hits are then shaded one by one; the shadow and reflection rays are traced as single rays.
+ * Gives the same colors as calling getFinalColor for every pixel.
+ *
+ * @param &frame CameraFrame generating the primary rays (and giving the image resolution)
+ * @param tileSize width and height of a packet in pixels
+ * @param &colors std::vector reference receiving the color of every pixel (row-major)
+ */
+static void renderPrimaryRayPackets(const Scene &scene, const CameraFrame &frame, const BoundingVolumeHierarchy &bvh,
+                                    int tileSize, std::vector<glm::vec3> &colors)
+{
+    const glm::ivec2 resolution = frame.resolution();
+    tileSize = std::clamp(tileSize, 1, 8);
+    const int tilesX = (resolution.x + tileSize - 1) / tileSize;
+    const int tilesY = (resolution.y + tileSize - 1) / tileSize;
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int tile = 0; tile < tilesX * tilesY; tile++)
+    {
+        const int tileX = (tile % tilesX) * tileSize;
+        const int tileY = (tile / tilesX) * tileSize;
+        const int width = std::min(tileSize, resolution.x - tileX);
+        const int height = std::min(tileSize, resolution.y - tileY);
+
+        std::array<Ray, maxRayPacketSize> rays;
+        std::array<HitInfo, maxRayPacketSize> hitInfos;
+        const size_t numRays = size_t(width * height);
+        frame.generateRays(ScreenTile{{tileX, tileY}, {tileX + width, tileY + height}}, rays);
+        const uint64_t hits = bvh.intersectPacket(gsl::span<Ray>(rays.data(), numRays), gsl::span<HitInfo>(hitInfos.data(), numRays));
+
+        for (size_t i = 0; i < numRays; i++)
+        {
+            RAY_STATS_COUNT(PrimaryRays);
+            const int x = tileX + int(i) % width;
+            const int y = tileY + int(i) / width;
+            shadeTraced(0, rays[i], (hits >> i & 1) != 0, hitInfos[i], colors[size_t(y * resolution.x + x)], scene, bvh);
+        }
+    }
+}
+
+// Width and height of the screen tiles that the wavefront renderer processes at once.
+static constexpr int wavefrontTileSize = 32;
+// Rays of the recursive renderer: the primary rays and one bounce of reflection rays (see trace).
+static constexpr int wavefrontMaxLevel = 2;
+// Shadow rays per spherical light and shaded point (as in shading).
+static constexpr int softShadowSamples = 200;
+
+// Rays of one stage of the wavefront renderer, with one array per field so that every stage only streams
+// through the data it needs. Every ray carries the pixel it contributes to and the weight of its contribution.
+struct RayQueue
+{
+    std::vector<Ray> rays;
+    std::vector<HitInfo> hitInfos;
+    std::vector<uint8_t> hits;
+    std::vector<uint32_t> pixels;
+    std::vector<glm::vec3> weights;
+
+    void push(const Ray &ray, uint32_t pixel, const glm::vec3 &weight)
+    {
+        rays.push_back(ray);
+        pixels.push_back(pixel);
+        weights.push_back(weight);
+    }
+    void clear()
+    {
+        rays.clear();
+        hitInfos.clear();
+        hits.clear();
+        pixels.clear();
+        weights.clear();
+    }
+};
+
+/**
+ * Intersect all rays of a queue with the scene.
+ *
+ * The rays are traced in packets of consecutive rays, so queues that store coherent rays next to each other
+ * (the primary rays of a tile, the shadow rays towards one light) share the traversal between them; the
+ * other packets fall back to single ray traversal inside BoundingVolumeHierarchy::intersectPacket.
+ *
+ * @param &queue RayQueue reference; the t of its rays, its hitInfos and its hits are updated
+ */
+static void intersectQueue(const BoundingVolumeHierarchy &bvh, RayQueue &queue)
+{
+    queue.hitInfos.assign(queue.rays.size(), HitInfo{});
+    queue.hits.assign(queue.rays.size(), 0);
+    for (size_t first = 0; first < queue.rays.size(); first += maxRayPacketSize)
+    {
+        const size_t count = std::min(maxRayPacketSize, queue.rays.size() - first);
+        const uint64_t hits = bvh.intersectPacket(gsl::span<Ray>(queue.rays.data() + first, count), gsl::span<HitInfo>(queue.hitInfos.data() + first, count));
+        for (size_t i = 0; i < count; i++)
+        {
+            queue.hits[first + i] = uint8_t(hits >> i & 1);
+        }
+    }
+}
+
+// Spread the lower 10 bits of value out so that there are two zero bits between every two bits (for Morton codes).
+static uint32_t expandBits(uint32_t value)
+{
+    value = (value * 0x00010001u) & 0xFF0000FFu;
+    value = (value * 0x00000101u) & 0x0F00F00Fu;
+    value = (value * 0x00000011u) & 0xC30C30C3u;
+    value = (value * 0x00000005u) & 0x49249249u;
+    return value;
+}
+
+/**
+ * Reorder the rays of a queue so that rays that are close in the queue also take similar paths through the BVH.
+ *
+ * Secondary rays are queued in the order of the surfaces that spawned them, which does not say much about
+ * where they go (mirror reflections fan out, soft shadow samples of neighbouring pixels interleave). The rays
+ * are binned by the octant of their direction and then by the cell of their origin in a 1024^3 grid over the
+ * origins of the queue, in Morton order. Rays in one octant are traced as packets by intersectPacket instead
+ * of falling back to single rays, and rays from nearby origins visit the same nodes while they are in cache.
+ * The sort is stable, so the rays of one origin (e.g. the samples towards a spherical light) stay in order.
+ *
+ * @param &queue RayQueue reference whose rays, pixels and weights are reordered
+ * @param &scratch RayQueue reference used as temporary storage
+ */
+static void sortQueue(RayQueue &queue, RayQueue &scratch)
+{
+    if (queue.rays.size() <= 1)
+    {
+        return;
+    }
+
+    glm::vec3 lower{std::numeric_limits<float>::max()};
+    glm::vec3 upper{-std::numeric_limits<float>::max()};
+    for (const Ray &ray : queue.rays)
+    {
+        lower = glm::min(lower, ray.origin);
+        upper = glm::max(upper, ray.origin);
+    }
+    // Axes along which all origins coincide map to cell 0 (dividing by their zero extent would give NaN cells).
+    const glm::vec3 extent = upper - lower;
+    glm::vec3 scale{0.0f};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] > 0.0f)
+        {
+            scale[axis] = 1023.0f / extent[axis];
+        }
+    }
+
+    // (key, index) pairs, so sorting them also keeps rays with the same key in queue order.
+    std::vector<std::pair<uint64_t, uint32_t>> keys(queue.rays.size());
+    for (uint32_t i = 0; i < queue.rays.size(); i++)
+    {
+        const Ray &ray = queue.rays[i];
+        const glm::uvec3 cell = glm::uvec3(glm::clamp((ray.origin - lower) * scale, glm::vec3(0.0f), glm::vec3(1023.0f)));
+        const uint32_t octant = uint32_t(std::signbit(ray.direction.x)) | uint32_t(std::signbit(ray.direction.y)) << 1 | uint32_t(std::signbit(ray.direction.z)) << 2;
+        const uint32_t morton = expandBits(cell.x) << 2 | expandBits(cell.y) << 1 | expandBits(cell.z);
+        keys[i] = {uint64_t(octant) << 30 | morton, i};
+    }
+    std::sort(std::begin(keys), std::end(keys));
+
+    scratch.clear();
+    for (const auto &[key, i] : keys)
+    {
+        scratch.push(queue.rays[i], queue.pixels[i], queue.weights[i]);
+    }
+    std::swap(queue, scratch);
+}
+
+/**
+ * Render one ray per pixel with a wavefront (stream) pipeline instead of tracing every pixel to completion.
+ *
+ * Per tile of the screen, all primary rays are generated into a queue (in 8x8 pixel blocks, so that
+ * consecutive rays form coherent packets) and intersected in bulk. The hits are sorted by material and
+ * shaded one material after the other, which fills a queue of shadow rays (towards the point lights and
+ * samples on the spherical lights) and a queue of reflection rays. The shadow queue is intersected in bulk
+ * and every unblocked shadow ray adds the light it carries to its pixel; then the reflection queue is
+ * processed in the same way, weighted by the specular color of the surfaces that reflected it.
+ * Gives the same colors as calling getFinalColor for every pixel (up to the random soft shadow samples).
+ *
+ * @param &frame CameraFrame generating the primary rays (and giving the image resolution)
+ * @param sortSecondaryRays bool stating whether the shadow and reflection queues are reordered with sortQueue
+ * @param &colors std::vector reference receiving the color of every pixel (row-major)
+ */
+static void renderWavefront(const Scene &scene, const CameraFrame &frame, const BoundingVolumeHierarchy &bvh,
+                            bool sortSecondaryRays, std::vector<glm::vec3> &colors)
+{
+    const glm::ivec2 resolution = frame.resolution();
+    const int tilesX = (resolution.x + wavefrontTileSize - 1) / wavefrontTileSize;
+    const int tilesY = (resolution.y + wavefrontTileSize - 1) / wavefrontTileSize;
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int tile = 0; tile < tilesX * tilesY; tile++)
+    {
+        const int tileX = (tile % tilesX) * wavefrontTileSize;
+        const int tileY = (tile / tilesX) * wavefrontTileSize;
+        const int tileEndX = std::min(tileX + wavefrontTileSize, resolution.x);
+        const int tileEndY = std::min(tileY + wavefrontTileSize, resolution.y);
+
+        // Generate the primary rays of the tile.
+        RayQueue queue;
+        std::array<Ray, maxRayPacketSize> cameraRays;
+        for (int blockY = tileY; blockY < tileEndY; blockY += 8)
+        {
+            for (int blockX = tileX; blockX < tileEndX; blockX += 8)
+            {
+                const ScreenTile block{{blockX, blockY}, {std::min(blockX + 8, tileEndX), std::min(blockY + 8, tileEndY)}};
+                frame.generateRays(block, cameraRays);
+                size_t i = 0;
+                for (int y = block.begin.y; y < block.end.y; y++)
+                {
+                    for (int x = block.begin.x; x < block.end.x; x++)
+                    {
+                        const uint32_t pixel = uint32_t(y * resolution.x + x);
+                        colors[pixel] = glm::vec3(0.0f);
+                        queue.push(cameraRays[i++], pixel, glm::vec3(1.0f));
+                    }
+                }
+            }
+        }
+        RAY_STATS_ADD(PrimaryRays, queue.rays.size());
+
+        RayQueue shadowQueue;
+        RayQueue reflectionQueue;
+        RayQueue scratch;
+        std::vector<uint32_t> hitOrder;
+        std::vector<SurfacePoint> surfaces;
+        for (int level = 0; level < wavefrontMaxLevel && !queue.rays.empty(); level++)
+        {
+            // Intersect the whole queue and look up the surfaces that were hit.
+            if (level > 0 && sortSecondaryRays)
+            {
+                sortQueue(queue, scratch);
+            }
+            intersectQueue(bvh, queue);
+            hitOrder.clear();
+            surfaces.resize(queue.rays.size());
+            for (uint32_t i = 0; i < queue.rays.size(); i++)
+            {
+                if (queue.hits[i])
+                {
+                    surfaces[i] = bvh.resolveHit(queue.rays[i], queue.hitInfos[i]);
+                    hitOrder.push_back(i);
+                }
+            }
+            std::stable_sort(std::begin(hitOrder), std::end(hitOrder), [&](uint32_t lhs, uint32_t rhs) {
+                return surfaces[lhs].materialId < surfaces[rhs].materialId;
+            });
+
+            // Shade the hits material by material: queue the shadow rays and the reflection rays.
+            shadowQueue.clear();
+            reflectionQueue.clear();
+            for (uint32_t i : hitOrder)
+            {
+                Ray &ray = queue.rays[i];
+                const SurfacePoint &surface = surfaces[i];
+                const Material &material = scene.materials[surface.materialId];
+                const glm::vec3 pointOn = ray.origin + ray.direction * ray.t;
+                const glm::vec3 &weight = queue.weights[i];
+
+                for (const SphericalLight &spherical : scene.sphericalLight)
+                {
+                    const PointLight light{spherical.position, spherical.color};
+                    const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
+                    const glm::vec3 radiance = diffuseOneLight(ray, light, fromPosToLight, surface, material) + specularOneLight(ray, light, fromPosToLight, surface, material);
+                    for (int sample = 0; sample < softShadowSamples; sample++)
+                    {
+                        const glm::vec3 randomPointOnSphere = spherical.position + spherical.radius * randomUnitVector();
+                        const glm::vec3 direction = glm::normalize(randomPointOnSphere - pointOn);
+                        const glm::vec3 origin = pointOn + 0.001f * direction;
+                        shadowQueue.push(Ray{origin, direction, glm::length(origin - randomPointOnSphere)}, queue.pixels[i], weight * radiance / float(softShadowSamples));
+                    }
+                }
+                for (const PointLight &light : scene.pointLights)
+                {
+                    const glm::vec3 fromPosToLight = glm::normalize(light.position - pointOn);
+                    const glm::vec3 radiance = diffuseOneLight(ray, light, fromPosToLight, surface, material) + specularOneLight(ray, light, fromPosToLight, surface, material);
+                    // same test as pointInShadow: blocked by a hit closer than the light (minus the offset)
+                    const float epsilon = 0.001f;
+                    const float lightDistance = glm::length(light.position - pointOn);
+                    shadowQueue.push(Ray{pointOn + epsilon * fromPosToLight, fromPosToLight, lightDistance - epsilon}, queue.pixels[i], weight * radiance);
+                }
+
+                // same test as shade (which only looks at the blue component)
+                if (material.ks.z > 0.01f && level + 1 < wavefrontMaxLevel)
+                {
+                    const glm::vec3 reflected = glm::normalize(glm::reflect(ray.direction, surface.normal));
+                    Ray reflectedRay = {pointOn, reflected, glm::length(ray.direction)};
+                    reflectedRay.origin += 0.001f * reflectedRay.direction;
+                    reflectionQueue.push(reflectedRay, queue.pixels[i], weight * material.ks);
+                }
+            }
+
+            // Trace the shadow rays; the unblocked ones bring the light to their pixel.
+            RAY_STATS_ADD(ShadowRays, shadowQueue.rays.size());
+            if (sortSecondaryRays)
+            {
+                sortQueue(shadowQueue, scratch);
+            }
+            intersectQueue(bvh, shadowQueue);
+            for (size_t i = 0; i < shadowQueue.rays.size(); i++)
+            {
+                if (!shadowQueue.hits[i])
+                {
+                    colors[shadowQueue.pixels[i]] += shadowQueue.weights[i];
+                }
+            }
+
+            std::swap(queue, reflectionQueue);
+            RAY_STATS_ADD(ReflectionRays, queue.rays.size());
+        }
+    }
+}
+
+/**
+ * Adaptive anti aliasing.
+ *
+ * First trace one ray per pixel, then refine only the pixels whose luminance differs
+ * from one of their neighbours by more than the contrast threshold (edges, shadow borders).
+ * A refined pixel gets a jittered-stratified grid of extra samples, bounded by maxSamplesPerPixel.
+ * With depth of field every extra sample also takes its own stratum of the lens, so the same rays
+ * anti alias the pixel and integrate the defocus blur (which shows up as contrast in the first pass).
+ *
+ * @param &frame CameraFrame generating the camera rays (and giving the image resolution)
+ * @param &colors std::vector reference receiving the final color of every pixel (row-major)
+ * @return the number of rays spent, to be compared against uniform supersampling
+ */
+static SamplingStatistics renderAdaptive(const Scene &scene, const CameraFrame &frame, const BoundingVolumeHierarchy &bvh,
+                                         const AdaptiveSamplingSettings &settings, std::vector<glm::vec3> &colors)
+{
+    const glm::ivec2 resolution = frame.resolution();
+
+    // First pass: one ray per pixel, at the same position as the non anti aliased renderer.
+    std::vector<glm::vec3> firstPass(size_t(resolution.x * resolution.y));
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            firstPass[size_t(y * resolution.x + x)] = getFinalColor(scene, bvh, frame.pixelRay(x, y));
+        }
+    }
+
+    // Second pass: spend extra samples only where the first pass shows contrast.
+    const int gridSize = refinementGridSize(settings.maxSamplesPerPixel);
+    long long refinedPixels = 0;
+#ifdef USE_OPENMP
+#pragma omp parallel for reduction(+ : refinedPixels)
+#endif
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            const size_t i = size_t(y * resolution.x + x);
+            if (neighbourContrast(firstPass, resolution, x, y) <= settings.contrastThreshold)
+            {
+                colors[i] = firstPass[i];
+                continue;
+            }
+
+            glm::vec3 color = firstPass[i];
+            const std::vector<glm::vec2> offsets = stratifiedSamples(gridSize, uint32_t(i));
+            const std::vector<glm::vec2> lensSamples = frame.hasDepthOfField() ? shuffledStratifiedSamples(gridSize, ~uint32_t(i)) : offsets;
+            for (size_t sample = 0; sample < offsets.size(); sample++)
+            {
+                color += getFinalColor(scene, bvh, frame.pixelRay(x, y, offsets[sample], lensSamples[sample]));
+            }
+            colors[i] = color / float(gridSize * gridSize + 1);
+            refinedPixels++;
+        }
+    }
+
+    const uint64_t numPixels = uint64_t(resolution.x) * uint64_t(resolution.y);
+    SamplingStatistics statistics;
+    statistics.refinedPixels = uint64_t(refinedPixels);
+    statistics.raysSpent = numPixels + statistics.refinedPixels * uint64_t(gridSize * gridSize);
+    statistics.raysUniform = numPixels * uint64_t(gridSize * gridSize + 1);
+    return statistics;
+}
+
+// Blue (cheap) -> cyan -> green -> yellow -> red (expensive), value in [0, 1].
+static glm::vec3 heatmapColor(float value)
+{
+    const float v = glm::clamp(value, 0.0f, 1.0f) * 4.0f;
+    if (v < 1.0f)
+        return glm::vec3(0.0f, v, 1.0f);
+    if (v < 2.0f)
+        return glm::vec3(0.0f, 1.0f, 2.0f - v);
+    if (v < 3.0f)
+        return glm::vec3(v - 2.0f, 1.0f, 0.0f);
+    return glm::vec3(1.0f, 4.0f - v, 0.0f);
+}
+
+/**
+ * Color every pixel by the work its primary ray caused in the BVH.
+ *
+ * The cost (nodes visited, triangles tested or their sum) is normalized
+ * by the most expensive pixel of the image so that hot spots stand out in any scene.
+ *
+ * @param heatmapMetric which part of the traversal cost is visualized
+ * @return the most expensive and the average pixel cost
+ */
+std::pair<int, float> renderTraversalCost(const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh, Screen &screen, HeatmapMetric heatmapMetric)
+{
+    const glm::ivec2 resolution = screen.resolution();
+    const CameraFrame frame{camera, resolution};
+    std::vector<int> costs(size_t(resolution.x * resolution.y));
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            Ray cameraRay = frame.pixelRay(x, y);
+            HitInfo hitInfo;
+            TraversalCost cost;
+            bvh.intersect(cameraRay, hitInfo, &cost);
+
+            int &pixelCost = costs[size_t(y * resolution.x + x)];
+            switch (heatmapMetric)
+            {
+            case HeatmapMetric::NodesVisited:
+                pixelCost = cost.nodesVisited;
+                break;
+            case HeatmapMetric::TrianglesTested:
+                pixelCost = cost.trianglesTested + cost.spheresTested;
+                break;
+            default:
+                pixelCost = cost.nodesVisited + cost.trianglesTested + cost.spheresTested;
+                break;
+            }
+        }
+    }
+
+    const int maxCost = std::max(1, *std::max_element(std::begin(costs), std::end(costs)));
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            screen.setPixel(x, y, heatmapColor(float(costs[size_t(y * resolution.x + x)]) / float(maxCost)));
+        }
+    }
+    const double totalCost = std::accumulate(std::begin(costs), std::end(costs), 0.0);
+    return {maxCost, float(totalCost / double(costs.size()))};
+}
+
+// This is the main rendering function. You are free to change this function in any way (including the function signature).
+SamplingStatistics renderRayTracing(const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh, Screen &screen, const RenderSettings &settings)
+{
+    const glm::ivec2 resolution = screen.resolution();
+    // Taken once, so that the render threads do not query the camera (and its window) for every ray.
+    const CameraFrame frame{camera, resolution, settings.lens};
+    std::vector<glm::vec3> matrixColorsScreen(resolution.x * resolution.y + 1);
+    std::vector<glm::vec3> matrixPixels(resolution.x * resolution.y + 1);
+
+    // colors that are traced before the loop over the pixels (adaptive anti aliasing, wavefront or ray packets)
+    std::vector<glm::vec3> tracedColors;
+    SamplingStatistics samplingStatistics;
+    if (settings.adaptiveAntiAliasing)
+    {
+        tracedColors.resize(size_t(resolution.x * resolution.y));
+        samplingStatistics = renderAdaptive(scene, frame, bvh, settings.adaptiveSampling, tracedColors);
+    }
+    else if (!settings.antiAliasing && settings.wavefront)
+    {
+        tracedColors.resize(size_t(resolution.x * resolution.y));
+        renderWavefront(scene, frame, bvh, settings.sortSecondaryRays, tracedColors);
+    }
+    else if (!settings.antiAliasing && settings.rayPacketSize > 1)
+    {
+        tracedColors.resize(size_t(resolution.x * resolution.y));
+        renderPrimaryRayPackets(scene, frame, bvh, settings.rayPacketSize, tracedColors);
+    }
+
+#ifdef USE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x != resolution.x; x++)
+        {
+            glm::vec3 color;
+            Ray cameraRay;
+
+            if (!tracedColors.empty())
+            {
+                color = tracedColors[size_t(y * resolution.x + x)];
+                screen.setPixel(x, y, color);
+                if (settings.bloom)
+                {
+                    matrixPixels.at(y * resolution.x + x) = color;
+                    if (color.x + color.y + color.z > 1)
+                        matrixColorsScreen.at(y * resolution.x + x) = color;
+                    else
+                        matrixColorsScreen.at(y * resolution.x + x) = glm::vec3((0));
+                }
+            }
+            else if (settings.antiAliasing)
+            {
+                float level = 2.0f;
+                for (int y_continued = y * level; y_continued < 2 + (level * y); y_continued++)
+                {
+                    for (int x_continued = x * level; x_continued < 2 + (level * x); x_continued++)
+                    {
+                        const glm::vec2 normalizedPixelPos{
+                            float(x_continued) / resolution.x * (2.0f / level) - 1.0f,
+                            float(y_continued) / resolution.y * (2.0f / level) - 1.0f};
+                        const Ray cameraRay = frame.generateRay(normalizedPixelPos, randomSample(uint32_t(y_continued * int(level) * resolution.x + x_continued)));
+                        color = color + getFinalColor(scene, bvh, cameraRay);
+                        if (settings.bloom)
+                        {
+                            matrixPixels.at(y * resolution.x + x) = getFinalColor(scene, bvh, cameraRay);
+                            if (color.x + color.y + color.z > 1)
+                                matrixColorsScreen.at(y * resolution.x + x) = getFinalColor(scene, bvh, cameraRay);
+                            else
+                                matrixColorsScreen.at(y * resolution.x + x) = glm::vec3((0));
+                        }
+                    }
+                }
+                color = color / (level * 2.5f);
+                screen.setPixel(x, y, color);
+            }
+            else
+            {
+                cameraRay = frame.pixelRay(x, y);
+                color = getFinalColor(scene, bvh, cameraRay);
+                screen.setPixel(x, y, color);
+
+                if (settings.bloom)
+                {
+                    matrixPixels.at(y * resolution.x + x) = getFinalColor(scene, bvh, cameraRay);
+                    if (color.x + color.y + color.z > 1)
+                        matrixColorsScreen.at(y * resolution.x + x) = getFinalColor(scene, bvh, cameraRay);
+                    else
+                        matrixColorsScreen.at(y * resolution.x + x) = glm::vec3((0));
+                }
+            }
+        }
+    }
+    //mean over pixels 20x20
+    //https://developer.nvidia.com/gpugems/gpugems/part-iv-image-processing/chapter-21-real-time-glow
+
+    if (settings.bloom)
+    {
+        bloomEffect(matrixPixels, matrixColorsScreen, screen, scene, frame, bvh, settings);
+    }
+    if (settings.blur)
+    {
+        blurEffect(scene, camera, bvh, screen, matrixPixels);
+    }
+    return samplingStatistics;
+}
+
@@ -0,0 +1,51 @@
+#pragma once
+#include "bounding_volume_hierarchy.h"
+#include "camera.h"
+#include "disable_all_warnings.h"
+#include "sampling.h"
+#include "scene.h"
+#include "screen.h"
+#include "trackball.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <utility>
+
+enum class HeatmapMetric
+{
+    NodesAndTriangles = 0,
+    NodesVisited = 1,
+    TrianglesTested = 2
+};
+
+// Options of the ray tracer (set from the UI in the interactive application).
+struct RenderSettings
+{
+    bool antiAliasing = false;
+    bool adaptiveAntiAliasing = false;
+    AdaptiveSamplingSettings adaptiveSampling;
+    bool bloom = false;
+    bool blur = false;
+    // Depth of field (a zero aperture radius renders with a pinhole camera). The lens is sampled by the camera rays
+    // themselves, so it converges with the anti aliasing samples (best with adaptive anti aliasing).
+    ThinLens lens;
+    // Trace the primary rays in packets of rayPacketSize x rayPacketSize pixels (4 or 8, see
+    // BoundingVolumeHierarchy::intersectPacket) when neither kind of anti aliasing is on; 0 or 1 traces every pixel on its own.
+    int rayPacketSize = 0;
+    // Render with the wavefront pipeline (queues of rays per screen tile that are intersected in bulk) instead of
+    // tracing every pixel to completion, when neither kind of anti aliasing is on. Takes precedence over rayPacketSize.
+    bool wavefront = false;
+    // Bin the shadow and reflection rays of the wavefront pipeline by direction octant and origin (Morton order)
+    // before they are traced, so that consecutive rays traverse the BVH together.
+    bool sortSecondaryRays = true;
+};
+
+// Trace a single ray (recursively, including shadow and reflection rays) and return its color.
+glm::vec3 getFinalColor(const Scene &scene, const BoundingVolumeHierarchy &bvh, Ray ray);
+
+// Ray trace the whole screen. Returns how many camera rays adaptive anti aliasing spent (all zero when it is disabled).
+SamplingStatistics renderRayTracing(const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh, Screen &screen, const RenderSettings &settings);
+
+// Color every pixel by the BVH traversal cost of its primary ray. Returns the max and average cost.
+std::pair<int, float> renderTraversalCost(const Scene &scene, const Trackball &camera, const BoundingVolumeHierarchy &bvh, Screen &screen, HeatmapMetric heatmapMetric);
@@ -0,0 +1,98 @@
+#include "sampling.h"
+#include "disable_all_warnings.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Integer hash with good avalanche behaviour (consecutive seeds give unrelated values).
+static uint32_t hashSeed(uint32_t value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+std::vector<glm::vec2> stratifiedSamples(int gridSize, uint32_t seed)
+{
+    std::minstd_rand generator { seed + 1 }; // minstd_rand must not be seeded with 0.
+    std::uniform_real_distribution<float> jitter { 0.0f, 1.0f };
+
+    std::vector<glm::vec2> samples;
+    samples.reserve(size_t(gridSize * gridSize));
+    const float stratumSize = 1.0f / float(gridSize);
+    for (int y = 0; y < gridSize; y++) {
+        for (int x = 0; x < gridSize; x++) {
+            // Clamp because (x + 1.0f) * stratumSize may round up to exactly 1.
+            const glm::vec2 sample { (float(x) + jitter(generator)) * stratumSize, (float(y) + jitter(generator)) * stratumSize };
+            samples.push_back(glm::min(sample, glm::vec2(std::nextafter(1.0f, 0.0f))));
+        }
+    }
+    return samples;
+}
+
+std::vector<glm::vec2> shuffledStratifiedSamples(int gridSize, uint32_t seed)
+{
+    std::vector<glm::vec2> samples = stratifiedSamples(gridSize, seed);
+    std::minstd_rand generator { hashSeed(seed) % 0x7fffffffu + 1 }; // minstd_rand must not be seeded with 0.
+    std::shuffle(std::begin(samples), std::end(samples), generator);
+    return samples;
+}
+
+glm::vec2 randomSample(uint32_t seed)
+{
+    // The upper 24 bits of a hash, as a float in [0, 1).
+    const uint32_t first = hashSeed(seed);
+    const uint32_t second = hashSeed(first);
+    return { float(first >> 8) / 16777216.0f, float(second >> 8) / 16777216.0f };
+}
+
+glm::vec2 concentricDiskSample(const glm::vec2& sample)
+{
+    // Shirley and Chiu: squares around the center of [-1, 1]^2 are mapped to circles, which keeps the area ratios.
+    const glm::vec2 offset = 2.0f * sample - 1.0f;
+    if (offset.x == 0.0f && offset.y == 0.0f)
+        return glm::vec2(0.0f);
+
+    constexpr float quarterPi = 0.78539816f;
+    float radius, angle;
+    if (std::abs(offset.x) > std::abs(offset.y)) {
+        radius = offset.x;
+        angle = quarterPi * (offset.y / offset.x);
+    } else {
+        radius = offset.y;
+        angle = 2.0f * quarterPi - quarterPi * (offset.x / offset.y);
+    }
+    return radius * glm::vec2(std::cos(angle), std::sin(angle));
+}
+
+int refinementGridSize(int maxSamplesPerPixel)
+{
+    // One ray is already spent on the first pass.
+    return std::max(1, int(std::floor(std::sqrt(float(std::max(maxSamplesPerPixel - 1, 1))))));
+}
+
+float luminance(const glm::vec3& color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+float neighbourContrast(const std::vector<glm::vec3>& image, const glm::ivec2& resolution, int x, int y)
+{
+    const float center = luminance(image[size_t(y * resolution.x + x)]);
+    float contrast = 0.0f;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            const int nx = x + dx, ny = y + dy;
+            if ((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= resolution.x || ny >= resolution.y)
+                continue;
+            contrast = std::max(contrast, std::abs(luminance(image[size_t(ny * resolution.x + nx)]) - center));
+        }
+    }
+    return contrast;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "disable_all_warnings.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <vector>
+
+struct AdaptiveSamplingSettings {
+    // Upper bound on the number of camera rays spent on a single pixel (first pass included).
+    int maxSamplesPerPixel { 16 };
+    // A pixel is refined when its luminance differs from one of its neighbours by more than this.
+    float contrastThreshold { 0.05f };
+};
+
+struct SamplingStatistics {
+    uint64_t raysSpent { 0 }; // Camera rays actually traced.
+    uint64_t raysUniform { 0 }; // Camera rays uniform supersampling at the same per-pixel cap would trace.
+    uint64_t refinedPixels { 0 };
+};
+
+// Jittered-stratified sample positions inside a pixel, in [0, 1)^2.
+// Returns gridSize * gridSize samples, one per stratum. The same seed always gives the same pattern.
+std::vector<glm::vec2> stratifiedSamples(int gridSize, uint32_t seed);
+
+// The same samples as stratifiedSamples in a random order, to pair them with the samples of another stratified pattern
+// (e.g. lens positions with pixel positions) without correlating the strata of the two patterns.
+std::vector<glm::vec2> shuffledStratifiedSamples(int gridSize, uint32_t seed);
+
+// A single random sample in [0, 1)^2. The same seed always gives the same sample; nearby seeds give unrelated samples.
+glm::vec2 randomSample(uint32_t seed);
+
+// Map a sample in [0, 1)^2 to the unit disk (concentric mapping), so that stratified samples stay stratified on the disk.
+glm::vec2 concentricDiskSample(const glm::vec2& sample);
+
+// Size of the stratified grid used to refine a pixel so that, together with the first-pass
+// sample, no more than maxSamplesPerPixel rays are traced.
+int refinementGridSize(int maxSamplesPerPixel);
+
+float luminance(const glm::vec3& color);
+
+// Largest luminance difference between pixel (x, y) and its (up to 8) neighbours in a row-major image.
+float neighbourContrast(const std::vector<glm::vec3>& image, const glm::ivec2& resolution, int x, int y);
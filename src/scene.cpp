@@ -1,46 +1,108 @@
 #include "scene.h"
+#include "disable_all_warnings.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+DISABLE_WARNINGS_POP()
 #include <iostream>
 
-Scene loadScene(SceneType type, const std::filesystem::path& dataDir)
+// Append the meshes of a model to the scene; its material ids are offset to point into the scene material table.
+static void addModel(Scene& scene, Model model)
+{
+    const uint32_t firstMaterialId = uint32_t(scene.materials.size());
+    scene.materials.insert(std::end(scene.materials), std::begin(model.materials), std::end(model.materials));
+    for (Mesh& mesh : model.meshes) {
+        mesh.materialId += firstMaterialId;
+        scene.meshes.emplace_back(std::move(mesh));
+    }
+}
+
+// Same as addModel, but the meshes can only be placed in the scene by instances. Returns the index of the
+// first mesh of the model in scene.instancedMeshes.
+static uint32_t addInstancedModel(Scene& scene, Model model)
+{
+    const uint32_t firstMesh = uint32_t(scene.instancedMeshes.size());
+    const uint32_t firstMaterialId = uint32_t(scene.materials.size());
+    scene.materials.insert(std::end(scene.materials), std::begin(model.materials), std::end(model.materials));
+    for (Mesh& mesh : model.meshes) {
+        mesh.materialId += firstMaterialId;
+        scene.instancedMeshes.emplace_back(std::move(mesh));
+    }
+    return firstMesh;
+}
+
+static void addSphere(Scene& scene, const glm::vec3& center, float radius, const Material& material)
+{
+    scene.spheres.push_back(Sphere { center, radius, uint32_t(scene.materials.size()) });
+    scene.materials.push_back(material);
+}
+
+const char* sceneName(SceneType type)
+{
+    switch (type) {
+    case SingleTriangle:
+        return "SingleTriangle";
+    case Cube:
+        return "Cube";
+    case CornellBox:
+        return "CornellBox";
+    case CornellBoxSphericalLight:
+        return "CornellBoxSphericalLight";
+    case Monkey:
+        return "Monkey";
+    case Dragon:
+        return "Dragon";
+    case Spheres:
+        return "Spheres";
+    case Crowd:
+        return "Crowd";
+    case Custom:
+        return "Custom";
+    };
+    return "Unknown";
+}
+
+Scene loadScene(SceneType type, const std::filesystem::path& dataDir, const MeshLoadSettings& meshLoadSettings)
 {
     Scene scene;
     switch (type) {
     case SingleTriangle: {
         // Load a 3D model with a single triangle
-        auto subMeshes = loadMesh(dataDir / "triangle.obj");
-        subMeshes[0].material.kd = glm::vec3(1.0f);
-        std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+        auto model = loadMesh(dataDir / "triangle.obj", false, meshLoadSettings);
+        model.materials[model.meshes[0].materialId].kd = glm::vec3(1.0f);
+        addModel(scene, std::move(model));
         scene.pointLights.push_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
     } break;
     case Cube: {
         // Load a 3D model of a cube with 12 triangles
-        auto subMeshes = loadMesh(dataDir / "cube.obj");
-        std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+        auto model = loadMesh(dataDir / "cube.obj", false, meshLoadSettings);
+        addModel(scene, std::move(model));
         scene.pointLights.push_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
     } break;
     case CornellBox: {
         // Load a 3D model of a Dragon
-        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true);
-        std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+        auto model = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true, meshLoadSettings);
+        addModel(scene, std::move(model));
         scene.pointLights.push_back(PointLight { glm::vec3(0, 0.58f, 0), glm::vec3(1) }); // Light at the top of the box
     } break;
     case CornellBoxSphericalLight: {
         // Load a 3D model of a Dragon
-        auto subMeshes = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true);
-        std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+        auto model = loadMesh(dataDir / "CornellBox-Mirror-Rotated.obj", true, meshLoadSettings);
+        addModel(scene, std::move(model));
         scene.sphericalLight.push_back(SphericalLight { glm::vec3(0, 0.45f, 0), 0.1f, glm::vec3(1) }); // Light at the top of the box
     } break;
     case Monkey: {
         // Load a 3D model of a Dragon
-        auto subMeshes = loadMesh(dataDir / "monkey-rotated.obj", true);
-        std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+        auto model = loadMesh(dataDir / "monkey-rotated.obj", true, meshLoadSettings);
+        addModel(scene, std::move(model));
         scene.pointLights.push_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
         scene.pointLights.push_back(PointLight { glm::vec3(1, -1, -1), glm::vec3(1) });
     } break;
     case Dragon: {
         // Load a 3D model of a Dragon
-        auto subMeshes = loadMesh(dataDir / "dragon.obj", true);
-        std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+        auto model = loadMesh(dataDir / "dragon.obj", true, meshLoadSettings);
+        addModel(scene, std::move(model));
         scene.pointLights.push_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
     } break;
     /*case AABBs: {
@@ -49,15 +111,35 @@ Scene loadScene(SceneType type, const std::filesystem::path& dataDir)
         //scene.boxes.push_back(AxisAlignedBox { glm::vec3(0.5f, 0.5f, 2.0f), glm::vec3(0.9f, 0.9f, 2.5f) });
     } break;*/
     case Spheres: {
-        scene.spheres.push_back(Sphere { glm::vec3(3.0f, -2.0f, 10.2f), 1.0f, Material { glm::vec3(0.8f, 0.2f, 0.2f) } });
-        scene.spheres.push_back(Sphere { glm::vec3(-2.0f, 2.0f, 4.0f), 2.0f, Material { glm::vec3(0.6f, 0.8f, 0.2f) } });
-        scene.spheres.push_back(Sphere { glm::vec3(0.0f, 0.0f, 6.0f), 0.75f, Material { glm::vec3(0.2f, 0.2f, 0.8f) } });
+        addSphere(scene, glm::vec3(3.0f, -2.0f, 10.2f), 1.0f, Material { glm::vec3(0.8f, 0.2f, 0.2f) });
+        addSphere(scene, glm::vec3(-2.0f, 2.0f, 4.0f), 2.0f, Material { glm::vec3(0.6f, 0.8f, 0.2f) });
+        addSphere(scene, glm::vec3(0.0f, 0.0f, 6.0f), 0.75f, Material { glm::vec3(0.2f, 0.2f, 0.8f) });
         scene.pointLights.push_back(PointLight { glm::vec3(3, 0, 3), glm::vec3(15) });
     } break;
+    case Crowd: {
+        // A grid of monkeys that all share the same mesh (and acceleration structure).
+        auto model = loadMesh(dataDir / "monkey-rotated.obj", true, meshLoadSettings);
+        const uint32_t numMeshes = uint32_t(model.meshes.size());
+        const uint32_t firstMesh = addInstancedModel(scene, std::move(model));
+        constexpr int gridSize = 16;
+        for (int z = 0; z < gridSize; z++) {
+            for (int x = 0; x < gridSize; x++) {
+                const glm::vec3 position { (float(x) + 0.5f) / float(gridSize) * 2.0f - 1.0f, 0.0f, (float(z) + 0.5f) / float(gridSize) * 2.0f - 1.0f };
+                const float angle = float((x * 7 + z * 13) % 16) / 16.0f * glm::two_pi<float>();
+                glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+                transform = glm::rotate(transform, angle, glm::vec3(0, 1, 0));
+                transform = glm::scale(transform, glm::vec3(0.9f / gridSize));
+                for (uint32_t mesh = firstMesh; mesh < firstMesh + numMeshes; mesh++)
+                    scene.instances.push_back(MeshInstance { mesh, transform });
+            }
+        }
+        scene.pointLights.push_back(PointLight { glm::vec3(-1, 1.5f, -1), glm::vec3(1) });
+        scene.pointLights.push_back(PointLight { glm::vec3(1, 1.5f, 1), glm::vec3(0.5f) });
+    } break;
     case Custom: {
         // === Replace custom.obj by your own 3D model (or call your 3D model custom.obj) ===
-        auto subMeshes = loadMesh(dataDir / "custom.obj");
-        std::move(std::begin(subMeshes), std::end(subMeshes), std::back_inserter(scene.meshes));
+        auto model = loadMesh(dataDir / "custom.obj", false, meshLoadSettings);
+        addModel(scene, std::move(model));
         // === CHANGE THE LIGHTING IF DESIRED ===
         scene.pointLights.push_back(PointLight { glm::vec3(-1, 1, -1), glm::vec3(1) });
         // Spherical light: position, radius, color
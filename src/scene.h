@@ -4,8 +4,11 @@
 #include "ray.h"
 // Suppress warnings in third-party code.
 DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <vector>
@@ -20,9 +23,15 @@ enum SceneType {
     //AABBs,
     Spheres,
     //Mixed,
+    Crowd,
     Custom
 };
 
+// All prebuilt scenes, in the order of SceneType.
+constexpr std::array allSceneTypes { SingleTriangle, Cube, CornellBox, CornellBoxSphericalLight, Monkey, Dragon, Spheres, Crowd, Custom };
+// Identifier of a prebuilt scene as used by the benchmark tools (e.g. "CornellBox").
+const char* sceneName(SceneType type);
+
 struct Plane {
     float D = 0.0f;
     glm::vec3 normal { 0.0f, 1.0f, 0.0f };
@@ -36,7 +45,14 @@ struct AxisAlignedBox {
 struct Sphere {
     glm::vec3 center { 0.0f };
     float radius = 1.0f;
-    Material material;
+    // Index into Scene::materials.
+    uint32_t materialId = 0;
+};
+
+// A mesh placed in the scene with a transformation. All instances of a mesh share its vertices and triangles.
+struct MeshInstance {
+    uint32_t mesh = 0; // Index into Scene::instancedMeshes.
+    glm::mat4 transform { 1.0f }; // Object to world space.
 };
 
 struct PointLight {
@@ -51,8 +67,14 @@ struct SphericalLight {
 };
 
 struct Scene {
+    // In world space.
     std::vector<Mesh> meshes;
     std::vector<Sphere> spheres;
+    // In object space; these are only placed in the scene by the instances.
+    std::vector<Mesh> instancedMeshes;
+    std::vector<MeshInstance> instances;
+    // Shared by all meshes and spheres, which refer to it by index (materialId).
+    std::vector<Material> materials;
     //std::vector<AxisAlignedBox> boxes;
 
     std::vector<PointLight> pointLights;
@@ -60,4 +82,4 @@ struct Scene {
 };
 
 // Load a prebuilt scene.
-Scene loadScene(SceneType type, const std::filesystem::path& dataDir);
+Scene loadScene(SceneType type, const std::filesystem::path& dataDir, const MeshLoadSettings& meshLoadSettings = {});
@@ -14,12 +14,6 @@ Screen::Screen(const glm::ivec2& resolution)
     : m_resolution(resolution)
     , m_textureData(size_t(resolution.x * resolution.y), glm::vec3(0.0f))
 {
-    // Generate texture
-    glGenTextures(1, &m_texture);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void Screen::clear(const glm::vec3& color)
@@ -35,6 +29,16 @@ void Screen::setPixel(int x, int y, const glm::vec3& color)
     m_textureData[i] = glm::vec4(color, 1.0f);
 }
 
+glm::ivec2 Screen::resolution() const
+{
+    return m_resolution;
+}
+
+const std::vector<glm::vec3>& Screen::pixels() const
+{
+    return m_textureData;
+}
+
 void Screen::writeBitmapToFile(const std::filesystem::path& filePath)
 {
     std::vector<glm::u8vec4> textureData8Bits(m_textureData.size());
@@ -50,6 +54,15 @@ void Screen::writeBitmapToFile(const std::filesystem::path& filePath)
 
 void Screen::draw()
 {
+    if (m_texture == 0) {
+        // Generate texture
+        glGenTextures(1, &m_texture);
+        glBindTexture(GL_TEXTURE_2D, m_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
     glPushAttrib(GL_ALL_ATTRIB_BITS);
 
     glBindTexture(GL_TEXTURE_2D, m_texture);
@@ -15,6 +15,10 @@ public:
     void clear(const glm::vec3& color);
     void setPixel(int x, int y, const glm::vec3& color);
 
+    glm::ivec2 resolution() const;
+    // Pixels in the order they are written to file (row-major, top row first).
+    const std::vector<glm::vec3>& pixels() const;
+
     void writeBitmapToFile(const std::filesystem::path& filePath);
     void draw();
 
@@ -22,5 +26,6 @@ private:
     glm::ivec2 m_resolution;
     std::vector<glm::vec3> m_textureData;
 
-    uint32_t m_texture;
+    // Created on the first draw() so that a Screen can be used without an OpenGL context (headless rendering).
+    uint32_t m_texture { 0 };
 };